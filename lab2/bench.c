@@ -0,0 +1,415 @@
+//+
+// File:	bench.c
+//
+// Purpose:	Benchmarks for the shell. shell.c is included directly,
+//		with its main compiled out, so that its internal functions can
+//		be timed without a fork or exec in the way:
+//
+//		  split     splitCommandLine tokens/s and MB/s by line length
+//		  dispatch  findInternalCommand ns per lookup, for a builtin and
+//			    for a name that is not one (the cost every external
+//			    command pays first)
+//		  spawn     doExternalCommand commands/s by launch method
+//		  script    end to end commands/s of the shell binary running
+//			    a script, of builtins, of external commands and
+//			    of a loop, each compiled and then cached
+//
+//		Results are written one per line as CSV (benchmark, parameter,
+//		value, unit), or as a JSON array with -j, so runs can be
+//		compared over time.
+//
+//		usage: shellbench [-j] [-s shell] [-t seconds per test]
+//-
+
+#define SHELL_NO_MAIN
+#include "shell.c"
+
+// how long each test runs, set from the command line
+double benchSeconds = 0.5;
+
+// output as JSON rather than CSV
+int benchJson = 0;
+int benchResults = 0;
+
+//+
+// Function:	nowSeconds
+//
+// Purpose:	Read the monotonic clock.
+//
+// Parameters:	(none)
+//
+// Returns	double
+//		the time in seconds
+//-
+
+double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//+
+// Function:	benchReport
+//
+// Purpose:	Write one result.
+//
+// Parameters:
+//	bench	- Benchmark name.
+//	param	- What was varied, such as the line length or launch method.
+//	value	- The measurement.
+//	unit	- Its unit.
+//
+// Returns	void
+//-
+
+void benchReport(const char *bench, const char *param, double value, const char *unit) {
+    if (benchJson) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"param\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+               benchResults ? "," : "[", bench, param, value, unit);
+    } else {
+        if (benchResults == 0) {
+            printf("benchmark,param,value,unit\n");
+        }
+        printf("%s,%s,%.6g,%s\n", bench, param, value, unit);
+    }
+    benchResults++;
+    fflush(stdout);
+}
+
+//+
+// Function:	makeLine
+//
+// Purpose:	Build a command line of about the given length with a mix
+//		of plain words, quoted words, escapes and pipes, like the
+//		generated command lines the tokenizer has to handle.
+//
+// Parameters:
+//	len	- Approximate length of the line in bytes.
+//
+// Returns	char *
+//		the line (malloc'd)
+//-
+
+char * makeLine(size_t len) {
+    static const char *pieces[] = {
+        "cmd", "--option=value", "'single quoted words'", "\"double \\\"quoted\\\"\"",
+        "file\\ name.dat", "t12.dat", "|", "-x", "\"$HOME/dir\"", "argument"
+    };
+    char *line = malloc(len + 64);
+    size_t used = 0;
+    for (int i = 0; used < len; i++) {
+        used += sprintf(line + used, "%s%s", used ? " " : "", pieces[i % 10]);
+    }
+    return line;
+}
+
+//+
+// Function:	benchSplit
+//
+// Purpose:	Time splitCommandLine on one line length. The line is
+//		copied back into the buffer before every split, since the
+//		split works in place; the copy is included in the time.
+//
+// Parameters:
+//	len	- Approximate length of the line in bytes.
+//
+// Returns	void
+//-
+
+void benchSplit(size_t len) {
+    struct arena arena = {NULL, NULL};
+    char *line = makeLine(len);
+    size_t lineLen = strlen(line) + 1;
+    char *work = malloc(lineLen);
+    char **args;
+    long iterations = 0;
+    long tokens = 0;
+
+    double start = nowSeconds();
+    double elapsed;
+    do {
+        // check the clock every 64 lines
+        for (int i = 0; i < 64; i++) {
+            memcpy(work, line, lineLen);
+            arenaReset(&arena);
+            tokens += splitCommandLine(work, &arena, &args);
+        }
+        iterations += 64;
+        elapsed = nowSeconds() - start;
+    } while (elapsed < benchSeconds);
+
+    char param[32];
+    snprintf(param, sizeof(param), "%zu", lineLen - 1);
+    benchReport("split", param, tokens / elapsed / 1e6, "Mtokens/s");
+    benchReport("split", param, iterations * (lineLen - 1) / elapsed / 1e6, "MB/s");
+    free(line);
+    free(work);
+}
+
+//+
+// Function:	benchDispatch
+//
+// Purpose:	Time findInternalCommand, the hashed lookup every command
+//		goes through, on a name. The command itself is not run, so
+//		that its own work doesn't swamp the lookup.
+//
+// Parameters:
+//	param	- Name for the result.
+//	name	- The command name to look up.
+//
+// Returns	void
+//-
+
+void benchDispatch(const char *param, const char *name) {
+    long iterations = 0;
+    long found = 0;
+
+    double start = nowSeconds();
+    double elapsed;
+    do {
+        for (int i = 0; i < 1024; i++) {
+            found += findInternalCommand(name) != NULL;
+        }
+        iterations += 1024;
+        elapsed = nowSeconds() - start;
+    } while (elapsed < benchSeconds);
+
+    // use the result, so that the lookups aren't optimized away
+    if (found != 0 && found != iterations) {
+        fprintf(stderr, "shellbench: %s found only sometimes\n", name);
+    }
+    benchReport("dispatch", param, elapsed / iterations * 1e9, "ns");
+}
+
+//+
+// Function:	benchSpawn
+//
+// Purpose:	Time doExternalCommand running true with each launch
+//		method.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void benchSpawn(void) {
+    char *args[] = {"true", NULL};
+
+    for (int method = 0; launchNames[method] != NULL; method++) {
+        launchMethod = method;
+        long iterations = 0;
+        double start = nowSeconds();
+        double elapsed;
+        do {
+            doExternalCommand(args, 1);
+            iterations++;
+            elapsed = nowSeconds() - start;
+        } while (elapsed < benchSeconds);
+        benchReport("spawn", launchNames[method], iterations / elapsed, "cmds/s");
+    }
+    launchMethod = LAUNCH_POSIX_SPAWN;
+}
+
+//+
+// Function:	runScript
+//
+// Purpose:	Run the shell on a script, with its output thrown away,
+//		and time it from start to exit.
+//
+// Parameters:
+//	shell		- Path of the shell binary.
+//	scriptPath	- The script.
+//
+// Returns	double
+//		the time in seconds, or -1 if it could not be run.
+//-
+
+double runScript(const char *shell, char *scriptPath) {
+    char *args[] = {(char *) shell, scriptPath, NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int status = 0;
+
+    double start = nowSeconds();
+    int err = posix_spawn(&pid, shell, &actions, NULL, args, environ);
+    if (err == 0) {
+        waitpid(pid, &status, 0);
+    }
+    double elapsed = nowSeconds() - start;
+
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "shellbench: %s: %s\n", shell, strerror(err));
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "shellbench: %s exited with status %d\n", shell, status);
+    }
+    return elapsed;
+}
+
+//+
+// Function:	benchScriptFile
+//
+// Purpose:	Time a script twice: the first run compiles it and
+//		writes its cache file, the second runs the cached program.
+//		The script and its cache file are removed afterwards.
+//
+// Parameters:
+//	shell		- Path of the shell binary.
+//	param		- Name for the results ("-cached" is added for the
+//			  second run).
+//	scriptPath	- The script.
+//	count		- Number of commands it runs.
+//
+// Returns	void
+//-
+
+void benchScriptFile(const char *shell, const char *param, char *scriptPath, int count) {
+    char cachedParam[strlen(param) + 8];
+    snprintf(cachedParam, sizeof(cachedParam), "%s-cached", param);
+
+    double elapsed = runScript(shell, scriptPath);
+    if (elapsed > 0) {
+        benchReport("script", param, count / elapsed, "cmds/s");
+        elapsed = runScript(shell, scriptPath);
+        if (elapsed > 0) {
+            benchReport("script", cachedParam, count / elapsed, "cmds/s");
+        }
+    }
+
+    char *realPath = realpath(scriptPath, NULL);
+    char cachePath[CMD_BUFFSIZE];
+    if (realPath != NULL && cacheFile(realPath, cachePath, sizeof(cachePath)) == 0) {
+        unlink(cachePath);
+    }
+    free(realPath);
+    unlink(scriptPath);
+}
+
+//+
+// Function:	benchScript
+//
+// Purpose:	Time the shell running a script of the same command
+//		repeated.
+//
+// Parameters:
+//	shell	- Path of the shell binary.
+//	param	- Name for the result.
+//	line	- The command making up the script.
+//	count	- Number of times it is repeated.
+//
+// Returns	void
+//-
+
+void benchScript(const char *shell, const char *param, const char *line, int count) {
+    char scriptPath[] = "/tmp/shellbenchXXXXXX";
+    int fd = mkstemp(scriptPath);
+    if (fd < 0) {
+        perror("shellbench: mkstemp");
+        return;
+    }
+    FILE *script = fdopen(fd, "w");
+    for (int i = 0; i < count; i++) {
+        fprintf(script, "%s\n", line);
+    }
+    fclose(script);
+    benchScriptFile(shell, param, scriptPath, count);
+}
+
+//+
+// Function:	benchLoop
+//
+// Purpose:	Time the shell running a command in nested for loops,
+//		where each pass expands the loop variables.
+//
+// Parameters:
+//	shell	- Path of the shell binary.
+//	outer	- Number of passes of the outer loop.
+//	inner	- Number of passes of the inner loop.
+//
+// Returns	void
+//-
+
+void benchLoop(const char *shell, int outer, int inner) {
+    char scriptPath[] = "/tmp/shellbenchXXXXXX";
+    int fd = mkstemp(scriptPath);
+    if (fd < 0) {
+        perror("shellbench: mkstemp");
+        return;
+    }
+    FILE *script = fdopen(fd, "w");
+    fprintf(script, "for i in");
+    for (int i = 0; i < outer; i++) {
+        fprintf(script, " %d", i);
+    }
+    fprintf(script, "\ndo\n    for j in");
+    for (int j = 0; j < inner; j++) {
+        fprintf(script, " %d", j);
+    }
+    fprintf(script, "\n    do\n        cd .\n        x=$i.$j\n    done\ndone\n");
+    fclose(script);
+    // the cd and the assignment
+    benchScriptFile(shell, "loop", scriptPath, 2 * outer * inner);
+}
+
+int main(int argc, char *argv[]) {
+    const char *shell = "./shell";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "js:t:")) != -1) {
+        switch (opt) {
+        case 'j':
+            benchJson = 1;
+            break;
+        case 's':
+            shell = optarg;
+            break;
+        case 't':
+            benchSeconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: shellbench [-j] [-s shell] [-t seconds]\n");
+            return 2;
+        }
+    }
+
+    initSearchPath();
+    initJobs();
+
+    // keep the scripts' cache files out of the user's cache
+    char cacheDir[] = "/tmp/shellbenchcacheXXXXXX";
+    if (mkdtemp(cacheDir) == NULL) {
+        perror("shellbench: mkdtemp");
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", cacheDir, 1);
+
+    size_t lengths[] = {64, 1024, 4096, 16384, 65536};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        benchSplit(lengths[i]);
+    }
+
+    benchDispatch("builtin", "pwd");
+    benchDispatch("external", "true");
+
+    benchSpawn();
+
+    // scripts long enough to swamp the shell's own start up
+    benchScript(shell, "builtin", "pwd", 200000);
+    benchScript(shell, "external", "true", 2000);
+    benchScript(shell, "pipeline", "true | true", 1000);
+    benchLoop(shell, 1000, 200);
+
+    char shellCache[sizeof(cacheDir) + 8];
+    snprintf(shellCache, sizeof(shellCache), "%s/shell", cacheDir);
+    rmdir(shellCache);
+    rmdir(cacheDir);
+
+    if (benchJson) {
+        printf("%s\n]\n", benchResults ? "" : "[");
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+//+
+// File:	helpers.c
+//
+// Purpose:	Builtin plugin with small helpers that scripts run over and
+//		over, so that they cost a function call instead of a fork
+//		and exec. Load it into the shell with: load ./helpers.so
+//
+//		The commands are:
+//		   echo [-n] args -> print the arguments, separated by spaces.
+//			      If -n then no newline at the end
+//		   basename path [suffix] -> print path without its directory
+//			      (and without suffix if it ends with it)
+//		   dirname path -> print the directory part of path
+//		   true -> succeed, false -> fail
+//-
+
+#include <stdio.h>
+#include <string.h>
+#include "shellplugin.h"
+
+// where to put each command's exit status
+static int *lastStatus;
+
+//+
+// Function:	echoFunc
+//
+// Purpose:	Print the arguments.
+//
+// Parameters:
+//	args[]	- Array of arguments, optionally -n then the words.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+static void echoFunc(char *args[], int nargs) {
+    int first = 1;
+    int newline = 1;
+
+    if (nargs > 1 && strcmp(args[1], "-n") == 0) {
+        newline = 0;
+        first = 2;
+    }
+    for (int i = first; i < nargs; i++) {
+        fputs(args[i], stdout);
+        if (i + 1 < nargs) {
+            putchar(' ');
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    *lastStatus = 0;
+}
+
+//+
+// Function:	trimSlashes
+//
+// Purpose:	Find the length of a path without its trailing slashes,
+//		keeping a lone /.
+//
+// Parameters:
+//	path	- The path.
+//
+// Returns	size_t
+//		the length
+//-
+
+static size_t trimSlashes(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
+
+//+
+// Function:	basenameFunc
+//
+// Purpose:	Print the last component of a path, as basename(1) does.
+//
+// Parameters:
+//	args[]	- Array of arguments, the path and an optional suffix.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+static void basenameFunc(char *args[], int nargs) {
+    if (nargs < 2 || nargs > 3) {
+        fprintf(stderr, "basename: usage: basename path [suffix]\n");
+        *lastStatus = 1;
+        return;
+    }
+    const char *path = args[1];
+    size_t end = trimSlashes(path);
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    // a path of only slashes
+    if (start == end) {
+        start = end - (end > 0);
+    }
+    if (nargs == 3) {
+        size_t suffixLen = strlen(args[2]);
+        if (suffixLen < end - start && memcmp(path + end - suffixLen, args[2], suffixLen) == 0) {
+            end -= suffixLen;
+        }
+    }
+    printf("%.*s\n", (int) (end - start), path + start);
+    *lastStatus = 0;
+}
+
+//+
+// Function:	dirnameFunc
+//
+// Purpose:	Print the directory part of a path, as dirname(1) does.
+//
+// Parameters:
+//	args[]	- Array of arguments, the path.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+static void dirnameFunc(char *args[], int nargs) {
+    if (nargs != 2) {
+        fprintf(stderr, "dirname: usage: dirname path\n");
+        *lastStatus = 1;
+        return;
+    }
+    const char *path = args[1];
+    size_t end = trimSlashes(path);
+    while (end > 0 && path[end - 1] != '/') {
+        end--;
+    }
+    if (end == 0) {
+        printf(".\n");
+    } else {
+        // drop the slashes before the last component
+        while (end > 1 && path[end - 1] == '/') {
+            end--;
+        }
+        printf("%.*s\n", (int) end, path);
+    }
+    *lastStatus = 0;
+}
+
+static void trueFunc(char *args[], int nargs) {
+    *lastStatus = 0;
+}
+
+static void falseFunc(char *args[], int nargs) {
+    *lastStatus = 1;
+}
+
+int shellPluginInit(const struct shellPluginApi *api) {
+    if (api->version != SHELL_PLUGIN_VERSION) {
+        fprintf(stderr, "helpers: built for plugin version %d, shell has %d\n",
+                SHELL_PLUGIN_VERSION, api->version);
+        return -1;
+    }
+    lastStatus = api->lastStatus;
+    if (api->registerBuiltin("echo", echoFunc) != 0
+            || api->registerBuiltin("basename", basenameFunc) != 0
+            || api->registerBuiltin("dirname", dirnameFunc) != 0
+            || api->registerBuiltin("true", trueFunc) != 0
+            || api->registerBuiltin("false", falseFunc) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -8,6 +9,25 @@
 #include <ctype.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <grp.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include "shellplugin.h"
 
 //+
 // File:	shell.c
@@ -19,422 +39,7412 @@
 //		The commands are:
 //		   cd name -> change to directory name, print an error if the directory doesn't exist.
 //		              If there is no parameter, then change to the home directory.
-//		   ls -> list the entries in the current directory.
-//			      If no arguments, then ignores entries starting with .
+//		   ls -> list the entries in the current directory, or in the
+//			      directories given, sorted by name.
+//			      If no options, then ignores entries starting with .
 //			      If -a then all entries
+//			      If -l then mode, links, owner, group, size and time
+//			      If -S then sorted by size, largest first
+//			      If -t then sorted by time, newest first
 //		   pwd -> print the current directory.
-//		   exit -> exit the shell (default exit value 0)
-//				any argument must be numeric and is the exit value
+//		   exit -> exit the shell (default exit value that of the
+//				last command). Any argument must be numeric and is
+//				the exit value
+//		   hash -> list the remembered locations of external commands.
+//			      If -r then forget all remembered locations
+//			      If -d name then forget the location of name
+//			      If names are given, look them up and remember them
+//		   set -> list the shell options and their values.
+//			      set name value changes an option. The options are
+//			      launch (fork, vfork or posix_spawn) which selects how
+//			      external commands are started, and pipesize which sets
+//			      the buffer size in bytes of pipes (0 = system default).
+//
+//		   jobs -> list the background jobs.
+//		   fg -> wait for a background job (default the most recent),
+//			      given as %n or n.
+//		   wait -> wait for all background jobs, or for the given
+//			      jobs (%n) or process ids.
+//		   par [-j N] [-g] [-a file] command args [::: inputs]
+//			   -> run command once for each input, N at a time (default
+//			      the number of CPUs, at most 4096 or the number of
+//			      inputs after :::). {} in the arguments is replaced by
+//			      the input, otherwise the input is added at the end. The
+//			      inputs follow :::, or are the lines of file (- for stdin).
+//			      If -g then the output of each job is kept together.
+//		   stats -> list the external commands run this session with their
+//			      count, latency percentiles, CPU time and peak memory.
+//			      stats name shows the latency histogram of a command.
+//			      If -r then clear the statistics
+//
+//		   cat -> copy the files given (or stdin) to stdout. The data is
+//			      moved by the kernel with copy_file_range, splice or
+//			      sendfile rather than through a buffer in the shell.
+//
+//		time before a command prints its wall clock time, CPU time,
+//		peak memory and context switches when it finishes.
+//
+//		< file, > file, >> file, 2> file, 2>> file and 2>&1 redirect
+//		the input and output of a command, internal or external.
+//
+//		   history -> list the last 16 commands, history N the last N.
+//			      If -s text then list the commands containing text
+//		Interactive command lines are added to the history file
+//		($HISTFILE, default ~/.shell_history), which is shared by all
+//		shells. A line starting with ! recalls a command: !! the last,
+//		!N number N, !-N the Nth last, !text the last starting with text.
+//
+//		limit options command -> run a command, pipeline or background
+//			      job with limits. -g group puts it in that cgroup v2
+//			      group (made if needed; a relative name is beside the
+//			      shell's own group), with -c cpu.max (a percentage of
+//			      one CPU, or "quota period"), -m memory.max and
+//			      -i io.max. -a cpus sets the CPU affinity (as 0-3,8)
+//			      and -n nodes or -I nodes binds or interleaves memory
+//			      over NUMA nodes. Builtins run in a child process.
+//
+//		   load file.so ... -> load builtin plugins (see shellplugin.h),
+//			      whose commands then run in the shell without a
+//			      fork or exec. With no files, list those loaded.
+//		   source file [args] -> run a script in this shell.
+//		   export name[=value] ... -> put variables in the environment.
+//
+//		Commands separated by | are run as a pipeline. All of the
+//		stages run at the same time, and the shell waits for every one.
+//		A command followed by & runs in the background. Children are
+//		reaped as soon as they exit and finished background jobs are
+//		reported before the next prompt.
+//
+//		Words are separated by spaces or tabs. Single quotes keep
+//		everything up to the closing quote, double quotes keep everything
+//		but \\ before \\, " or $, and \\ outside quotes keeps the next
+//		character. Lines and argument lists have no fixed limit.
+//
+//		A word with an unquoted *, ? or [...] is replaced by the
+//		sorted paths it matches; ** matches any number of directories.
+//		Names starting with . only match a pattern starting with . and
+//		a pattern that matches nothing is left as it is.
+//
+//		name=value sets a shell variable, and $name or ${name} in a
+//		word (not in single quotes) is replaced by its value, or by
+//		the environment variable if there is no shell variable. $? is
+//		the last exit status, $$ the shell's pid, $0..$9 the script
+//		and its arguments and $# their number. An unquoted value is
+//		split into words at spaces, tabs and newlines, and each word
+//		is then matched as a pattern; a quoted one stays one word.
+//
+//		Commands are separated by newlines, ; or &, and # starts a
+//		comment. The control flow commands are
+//		   if list; then list; [elif list; then list;]... [else list;] fi
+//		   while list; do list; done
+//		   for name in words; do list; done
+//		with break and continue in loops. A list succeeds if its
+//		last command does, and a construct that runs no body
+//		succeeds.
+//
+//		Input is compiled before it runs, and a script's compiled
+//		form is cached in $XDG_CACHE_HOME/shell (~/.cache/shell), so
+//		running it again while it is unchanged skips parsing.
+//
+//		Given a file name (shell file.sh args), or when stdin is not a
+//		terminal, the shell runs as a script without prompts. A
+//		script file is mapped into memory and other input is read in
+//		large blocks.
 //
 //		if the command is not recognized an error is printed.
 //-
 
 #define CMD_BUFFSIZE 1024
-#define MAXARGS 10
 
-int splitCommandLine(char * commandBuffer, char* args[], int maxargs);
+struct cmdData;
+struct arena;
+struct job;
+struct placement;
+struct program;
+
+int splitCommandLine(char * commandBuffer, struct arena * arena, char ** argsp[]);
+int scanCommandLine(char * commandBuffer, struct arena * arena, char ** argsp[]);
+int hasExpansions(char * words[], int nwords);
+int expandWords(char * words[], int nwords, struct arena * arena, char *** argsp);
+unsigned int hashString(const char * str);
+int globExpand(char * pattern, struct arena * arena, char *** argsp, int * nargs, int * maxArgs);
+void globUnescape(char * word);
+void arenaReset(struct arena * arena);
 int doInternalCommand(char * args[], int nargs);
 int doExternalCommand(char * args[], int nargs);
+int doPipeline(char * args[], int nargs, int background);
+int countStages(char * args[], int nargs);
+int isOperator(const char * arg, const char * op);
+struct cmdData * findInternalCommand(const char * cmdName);
+char * commandWord(char * args[], int nargs);
+extern const int childFdOrder[3];
+void initSearchPath(void);
+void initJobs(void);
+int notifyJobs(void);
+int reapChildren(int options);
+void recordStats(const char * cmdName, double wall, const struct rusage * ru);
+struct job * newJob(char * args[], int nargs, int background);
+void addJobProcess(struct job * job, pid_t pid, const char * cmdName);
+void waitForJob(struct job * job);
+void freeJob(struct job * job);
+void printTimes(struct timespec * timeStart, struct rusage * selfStart);
+int copyFdData(int inFd, int outFd);
+void histAdd(const char * line);
+char * histRecall(const char * line);
+void * arenaAlloc(struct arena * arena, size_t size);
+struct redirection;
+void closeRedirections(struct redirection * redir);
+int parsePlacement(char * args[], int nargs, struct placement * pl);
+void releasePlacement(struct placement * pl);
+pid_t launchPlaced(char * cmdPath, char * args[], int childFd[3]);
+int placeChild(void);
+extern struct placement * launchPlacement;
+extern struct placement commandPlacement;
+int countConstructs(const char * line, int * depth);
+struct program * compileSource(char * text, const char * name, int * incomplete);
+struct program * loadScript(const char * path);
+void runProgram(struct program * prog);
+void freeProgram(struct program * prog);
+extern char ** scriptArgs;
+extern int numScriptArgs;
+
+extern struct rusage foregroundUsage;
+
+extern int sigChldPipe[2];
+extern int lastStatus;
+extern int interactive;
+extern struct arena lineArena;
+
+////////////////////////////// Input ///////////////////////////////////
+
+// size of the blocks read from a pipe or terminal
+#define READ_BLOCK 65536
+
+// commands are read with read() in blocks rather than with stdio,
+// so that poll() can wait for either more input or an exiting child.
+// A regular file is mapped whole instead. Either way lines are split
+// in place, the newline becoming the null that ends the line.
+struct lineReader {
+    int		fd;
+    int		eof;
+    int		mapped;		// buf is a private mapping of the whole file
+    char *	buf;
+    size_t	size;		// size of buf (mapped bytes, or allocated)
+    size_t	start;		// first byte not yet returned as a line
+    size_t	end;		// end of the data read so far
+    char *	lastLine;	// copy of an unterminated last line of a mapping
+};
+
+// true when reading commands from a terminal, enables prompts
+// and job notices.
+int interactive = 0;
 
 //+
-// Function:	main
+// Function:	openReader
 //
-// Purpose:	The main function. Contains the read
-//		eval print loop for the shell.
+// Purpose:	Set up a line reader for a file descriptor. A regular file
+//		is mapped copy-on-write so that lines can be split in place
+//		without reading it, anything else gets a READ_BLOCK buffer.
 //
-// Parameters:	(none)
+// Parameters:
+//	in	- The line reader.
+//	fd	- The file descriptor to read commands from.
 //
-// Returns:	integer (exit status of shell)
+// Returns	void
 //-
 
-int main() {
+void openReader(struct lineReader *in, int fd) {
+    struct stat statbuf;
+
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+
+    if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && statbuf.st_size > 0) {
+        void *map = mmap(NULL, statbuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+            in->mapped = 1;
+            in->buf = map;
+            in->size = in->end = statbuf.st_size;
+            in->eof = 1;
+            return;
+        }
+    }
+
+    // plus one so there is always room for a final null
+    in->size = READ_BLOCK + 1;
+    in->buf = malloc(in->size);
+    if (in->buf == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+}
 
-    char commandBuffer[CMD_BUFFSIZE];
-    // note the plus one, allows for an extra null
-    char *args[MAXARGS+1];
+//+
+// Function:	printPrompt
+//
+// Purpose:	Report finished background jobs, then print the prompt.
+//		Nothing is printed when running a script.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
 
+void printPrompt(void) {
+    notifyJobs();
+    if (!interactive) {
+        return;
+    }
     // print prompt.. fflush is needed because
     // stdout is line buffered, and won't
     // write to terminal until newline
     printf("%%> ");
     fflush(stdout);
+}
 
-    while(fgets(commandBuffer,CMD_BUFFSIZE,stdin) != NULL){
-        //printf("%s",commandBuffer);
-
-	// remove newline at end of buffer
-	int cmdLen = strlen(commandBuffer);
-	if (commandBuffer[cmdLen-1] == '\n'){
-	    commandBuffer[cmdLen-1] = '\0';
-	    cmdLen--;
-            //printf("<%s>\n",commandBuffer);
-	}
-
-	// split command line into words.(Step 2)
-    
-	int nargs = splitCommandLine(commandBuffer, args, MAXARGS);
-
-    // add a null to end of array (Step 2)
-    args[nargs] = NULL;
-
-	// debugging
-	// printf("%d\n", nargs);
-	// int i;
-	// for (i = 0; i < nargs; i++){
-	//   printf("%d: %s\n",i,args[i]);
-	// }
+//+
+// Function:	nextLine
+//
+// Purpose:	Return the next complete line already in the buffer. The
+//		newline is replaced with a null.
+//
+// Parameters:
+//	in	- The line reader.
+//
+// Returns	char *
+//		the line, or NULL if more input must be read first.
+//-
 
-	// element just past nargs
-	// printf("%d: %p\n",i, args[i]);
+char * nextLine(struct lineReader *in) {
+    char *line = in->buf + in->start;
+    char *newline = memchr(line, '\n', in->end - in->start);
 
-    if (nargs != 0) {
-    if (doInternalCommand(args, nargs) == 0) {
-        if (doExternalCommand(args, nargs) == 0) {
-            fprintf(stderr, "%s: command not found\n", args[0]);
+    if (newline == NULL) {
+        // an unterminated last line is returned at end of file
+        if (in->start == in->end || !in->eof) {
+            return NULL;
         }
+        if (in->mapped) {
+            // the mapping may end on a page boundary, so copy it
+            // to have room for the null
+            free(in->lastLine);
+            in->lastLine = strndup(line, in->end - in->start);
+            in->start = in->end;
+            return in->lastLine;
+        }
+        newline = in->buf + in->end;
+        in->end++;
     }
+    *newline = '\0';
+    in->start = newline + 1 - in->buf;
+    return line;
 }
-    
-	// print prompt
-	printf("%%> ");
-	fflush(stdout);
-    }
-    return 0;
-}
-
-////////////////////////////// String Handling (Step 1) ///////////////////////////////////
 
 //+
-// Function:	skipChar
+// Function:	fillReader
 //
-// Purpose:	This function skips over a given char in a string
-//		For security, will not skip null chars.
+// Purpose:	Read more input into the buffer, after moving any partial
+//		line to the front. The buffer is doubled if a line does
+//		not fit, so there is no limit on line length.
 //
 // Parameters:
-//    charPt Pointer to string
-//    skip character to skip
+//	in	- The line reader.
 //
-// Returns:	Pointer to first character after skipped chars
-//		ID function if the string doesn't start with skip,
-//		or skip is the null character
+// Returns	void
 //-
 
-char * skipChar(char * charPtr, char skip){
-    if (charPtr == NULL || skip == '\0') { // Checks if delimiter is null or if current character is null
-        return charPtr;
+void fillReader(struct lineReader *in) {
+    if (in->start > 0) {
+        memmove(in->buf, in->buf + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->start = 0;
+    }
+    if (in->end == in->size - 1) {
+        char *newBuf = realloc(in->buf, 2 * in->size);
+        if (newBuf == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        in->buf = newBuf;
+        in->size *= 2;
+    }
+    ssize_t n;
+    do {
+        n = read(in->fd, in->buf + in->end, in->size - 1 - in->end);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("read");
+        in->eof = 1;
+    } else if (n == 0) {
+        in->eof = 1;
     } else {
-        while(*charPtr == skip) { // If current char is to be skipped
-            charPtr++; // Increment the pointer address
-        } 
-        return charPtr; // Return new address
+        in->end += n;
     }
 }
 
 //+
-// Funtion:	splitCommandLine
+// Function:	readLine
 //
-// Purpose:	Splits the input command line string into individual arguments.
+// Purpose:	Get the next command line. While waiting for input, any
+//		child that exits is reaped straight away and finished
+//		background jobs are reported.
 //
 // Parameters:
-//	commandBuffer The input command line string to be split into arguments
-//	args[]  An array of character pointers where the split arguments will be stored
-//	maxargs  The maximum number of arguments that can be stored in args[]
-//
-// Returns:	Number of arguments (< maxargs).
+//	in	- The line reader.
 //
+// Returns	char *
+//		the line (without the newline), or NULL at end of input.
 //-
 
-int splitCommandLine(char *commandBuffer, char *args[], int maxargs) {
-    int nargs = 0;  // Number of arguments found
-    char *currentPos = commandBuffer;
-
-    // Loop through the command buffer to find arguments
-    while (*currentPos != '\0') {
-        // Skip over any leading spaces
-        currentPos = skipChar(currentPos, ' ');
+char * readLine(struct lineReader *in) {
+    char *line;
 
-        // If end of string is reached, break the loop
-        if (*currentPos == '\0') {
-            break;
+    while ((line = nextLine(in)) == NULL) {
+        if (in->eof) {
+            return NULL;
         }
 
-        // If number of arguments exceeds maxargs, print an error
-        if (nargs >= maxargs) {
-            fprintf(stderr, "Error: too many arguments (max %d).\n", maxargs);
-            return 0;
+        struct pollfd fds[2] = {
+            {in->fd, POLLIN, 0},
+            {sigChldPipe[0], POLLIN, 0}
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                fillReader(in);
+            }
+            continue;
         }
-
-        // Store the pointer to the current argument
-        args[nargs++] = currentPos;
-
-        // Find the next space or end of the string
-        char *nextSpace = strchr(currentPos, ' ');
-
-        // If no space was found, we are at the last argument
-        if (nextSpace == NULL) {
-            break;
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(sigChldPipe[0], drain, sizeof(drain)) > 0);
+            reapChildren(WNOHANG);
+            // reprint the prompt if a report interrupted it
+            if (notifyJobs() && interactive) {
+                printf("%%> ");
+                fflush(stdout);
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            fillReader(in);
         }
-
-        // Null-terminate the current argument
-        *nextSpace = '\0';
-
-        // Move to the next character after the space
-        currentPos = nextSpace + 1;
     }
-    return nargs;
+    return line;
 }
 
-////////////////////////////// External Program  (Note this is step 4, complete doeInternalCommand first!!) ///////////////////////////////////
-
-// list of directorys to check for command.
-// terminated by null value
-char * path[] = {
-    ".",
-    "/bin",
-    "/usr/bin",
-    NULL
-};
+// bench.c includes this file and supplies its own main
+#ifndef SHELL_NO_MAIN
 
 //+
-// Function:	doExternalCommand
+// Function:	main
 //
-// Purpose:	Search for and execute external commands.
+// Purpose:	The main function. Contains the read
+//		eval print loop for the shell.
 //
 // Parameters:
-//	args[]	- Array of arguments where args[0] is the command to be executed.
-//	nargs	- Number of arguments in the args array.
+//	argc	- Number of command line arguments.
+//	argv[]	- argv[1] is an optional script file to run.
 //
-// Returns	int
-//		1 = Found and executed the file.
-//		0 = Could not find or execute the file.
+// Returns:	integer (exit status of shell)
 //-
 
-int doExternalCommand(char *args[], int nargs) {
-    struct stat statbuf;
-    char cmd_path[CMD_BUFFSIZE];
-    int i = 0;
+int main(int argc, char *argv[]) {
 
-    // Iterate over all directories in the path array
-    while (path[i] != NULL) {
-        // Construct the full path to the command
-        snprintf(cmd_path, sizeof(cmd_path), "%s/%s", path[i], args[0]);
+    struct lineReader input;
+    char *commandBuffer;
+    // commands typed so far of an unfinished for, while or if, and
+    // how many constructs they leave open
+    char *pending = NULL;
+    size_t pendingLen = 0, pendingMax = 0;
+    int depth = 0;
+    int incomplete = 0;
 
-        // Check if the file exists and is executable
-        if (stat(cmd_path, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && (statbuf.st_mode & S_IXUSR)) {
-            // If the file is found and executable fork a child process to execute it
-            pid_t pid = fork();
-
-            if (pid == 0) {
-                // This is the child process execute the command
-                execv(cmd_path, args);
-                // If execv returns, there was an error
-                perror("execv");
-                exit(EXIT_FAILURE);
-            } else if (pid > 0) {
-                // Parent process: wait for the child to complete
-                int status;
-                wait(&status);
-                return 1;  // Command executed successfully
-            } else {
-                // Fork failed
-                perror("fork");
-                return 0;
-            }
-        }
+    // $0 is the shell or script, then the script's arguments
+    scriptArgs = argv + (argc > 1);
+    numScriptArgs = argc - (argc > 1);
 
-        // Move to the next directory in the path
-        i++;
+    // build the list of directories searched for external commands
+    initSearchPath();
+    // reap children as they exit
+    initJobs();
+
+    if (argc > 1) {
+        // a script is compiled whole, or its cached program mapped
+        struct program *prog = loadScript(argv[1]);
+        if (prog == NULL) {
+            exit(lastStatus);
+        }
+        runProgram(prog);
+        return lastStatus;
     }
 
-    // If no executable file was found, return 0
-    return 0;
+    interactive = isatty(0);
+    openReader(&input, 0);
+
+    printPrompt();
+
+    while((commandBuffer = readLine(&input)) != NULL){
+	if (interactive) {
+	    // recall with !, then remember the line as typed or recalled
+	    if (commandBuffer[0] == '!' && (commandBuffer = histRecall(commandBuffer)) == NULL) {
+	        printPrompt();
+	        continue;
+	    }
+	    histAdd(commandBuffer);
+	}
+
+	// add the line to any unfinished command, and compile the whole
+	// once the constructs it opens could all be closed
+	if (countConstructs(commandBuffer, &depth) != 0) {
+	    pendingLen = 0;
+	    depth = 0;
+	    lastStatus = 2;
+	    printPrompt();
+	    continue;
+	}
+	size_t len = strlen(commandBuffer);
+	if (pendingLen + len + 2 > pendingMax) {
+	    pendingMax = 2 * (pendingLen + len + 2);
+	    pending = realloc(pending, pendingMax);
+	    if (pending == NULL) {
+	        perror("malloc");
+	        exit(1);
+	    }
+	}
+	if (pendingLen > 0) {
+	    pending[pendingLen++] = '\n';
+	}
+	memcpy(pending + pendingLen, commandBuffer, len + 1);
+	pendingLen += len;
+	struct program *prog = NULL;
+	if (depth <= 0) {
+	    // compiling changes the text, which is kept if it turns out
+	    // to be unfinished after all
+	    char *source = malloc(pendingLen + 1);
+	    if (source == NULL) {
+	        perror("malloc");
+	        exit(1);
+	    }
+	    memcpy(source, pending, pendingLen + 1);
+	    prog = compileSource(source, NULL, &incomplete);
+	    free(source);
+	} else {
+	    incomplete = 1;
+	}
+	if (incomplete) {
+	    if (interactive) {
+	        printf("> ");
+	        fflush(stdout);
+	    }
+	    continue;
+	}
+	pendingLen = 0;
+	depth = 0;
+	if (prog == NULL) {
+	    lastStatus = 2;
+	} else {
+	    arenaReset(&lineArena);
+	    runProgram(prog);
+	    freeProgram(prog);
+	}
+
+	// print prompt
+	printPrompt();
+    }
+    if (incomplete) {
+        fprintf(stderr, "syntax error: unexpected end of file\n");
+        lastStatus = 2;
+    }
+    return lastStatus;
 }
 
-////////////////////////////// Internal Command Handling (Step 3) ///////////////////////////////////
+#endif
 
-// define command handling function pointer type
-typedef void(*commandFunction)(char * args[], int nargs);
+////////////////////////////// String Handling (Step 1) ///////////////////////////////////
 
-// associate a command name with a command handling function
-struct cmdData{
-   char 	* cmdName;
-   commandFunction 	cmdFunc;
+// memory for the words of one command line. Blocks are kept when the
+// arena is reset, so after the first few lines parsing allocates
+// nothing.
+struct arenaBlock {
+    struct arenaBlock *	next;
+    size_t		size;		// bytes in data[]
+    size_t		used;
+    char		data[];
 };
 
-// prototypes for command handling functions
-void exitFunc();
-void pwdFunc(char *args[], int nargs);
-void cdFunc(char *args[], int nargs);
-void lsFunc(char *args[], int nargs);
+struct arena {
+    struct arenaBlock *	first;
+    struct arenaBlock *	current;
+};
 
-// list commands and functions
-// must be terminated by {NULL, NULL} 
-// in a real shell, this would be a hashtable.
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
 
-struct cmdData commands[] = {
-   {"exit", exitFunc},
-   {"pwd", pwdFunc},
-   {"cd", cdFunc},
-   {"ls", lsFunc},
-   { NULL, NULL}		// terminator
-};
+// holds the argument array of the command line being run, reset
+// for every line
+struct arena lineArena;
 
 //+
-// Function:	doInternalCommand
+// Function:	arenaAlloc
 //
-// Purpose:	Checks if the first argument is an internal command and executes it if found.
+// Purpose:	Allocate memory from an arena. It is only released, all
+//		at once, by arenaReset.
 //
 // Parameters:
-//	args[]	- Array of arguments where args[0] is the command to check.
-//	nargs	- Number of arguments in the args array.
+//	arena	- The arena.
+//	size	- Number of bytes needed.
 //
-// Returns	int
-//		1 = args[0] is an internal command
-//		0 = args[0] is not an internal command
+// Returns	void *
+//		the memory, aligned to ARENA_ALIGN (exits if out of memory).
 //-
 
-int doInternalCommand(char * args[], int nargs) {
-    // Loop through the list of internal commands
-    for (int i = 0; commands[i].cmdName != NULL; i++) {
-        // Compare the input command (args[0]) with each internal command
-        if (strcmp(args[0], commands[i].cmdName) == 0) {
-            // Call the associated command function
-            commands[i].cmdFunc(args, nargs);
-            return 1;  // Return 1 to indicate that the command was found and executed
+void * arenaAlloc(struct arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    struct arenaBlock *block = arena->current;
+    // use the next kept block if this one is full
+    while (block != NULL && block->used + size > block->size) {
+        block = block->next;
+        if (block != NULL) {
+            block->used = 0;
+        }
+    }
+    if (block == NULL) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct arenaBlock) + blockSize);
+        if (block == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        block->size = blockSize;
+        block->used = 0;
+        // keep it after the current block so that it is reused
+        if (arena->current == NULL) {
+            block->next = NULL;
+            arena->first = block;
+        } else {
+            block->next = arena->current->next;
+            arena->current->next = block;
         }
     }
+    arena->current = block;
 
-    // If no matching internal command was found, return 0
-    return 0;
+    void *mem = block->data + block->used;
+    block->used += size;
+    return mem;
 }
-///////////////////////////////
-// comand Handling Functions //
-///////////////////////////////
 
 //+
-// Function:	exitFunc
+// Function:	arenaReset
 //
-// Purpose:	To exit with given status
+// Purpose:	Release everything allocated from an arena, keeping
+//		the blocks for reuse.
 //
 // Parameters:
-//	no parameters
+//	arena	- The arena.
 //
 // Returns	void
-//		no return
 //-
 
-void exitFunc() {
-    exit(0); 
+void arenaReset(struct arena *arena) {
+    arena->current = arena->first;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
 }
 
+// a point in an arena to release back to
+struct arenaMark {
+    struct arenaBlock *	block;
+    size_t		used;
+};
+
 //+
-// Function:	pwdFunc
+// Function:	arenaMark
 //
-// Purpose:	To print the current working directory.
+// Purpose:	Remember how much of an arena is in use, so that what
+//		is allocated after it can be released with arenaRelease.
 //
 // Parameters:
-//	args[]	- Array of arguments (not used here).
-//	nargs	- Number of arguments (not used here).
+//	arena	- The arena.
+//
+// Returns	struct arenaMark
+//		the mark
+//-
+
+struct arenaMark arenaMark(struct arena *arena) {
+    struct arenaMark mark = {arena->current, 0};
+    if (mark.block != NULL) {
+        mark.used = mark.block->used;
+    }
+    return mark;
+}
+
+//+
+// Function:	arenaRelease
+//
+// Purpose:	Release everything allocated from an arena since a mark.
+//
+// Parameters:
+//	arena	- The arena.
+//	mark	- The mark, from arenaMark.
 //
 // Returns	void
 //-
 
-void pwdFunc(char *args[], int nargs) {
-    char *cwd = getcwd(NULL, 0);  // Get the current working directory
-    if (cwd != NULL) {
-        printf("%s\n", cwd);  // Print the working directory
-        free(cwd);  // Free the memory allocated by getcwd
+void arenaRelease(struct arena *arena, struct arenaMark mark) {
+    if (mark.block == NULL) {
+        arenaReset(arena);
     } else {
-        perror("pwd");  // Print error if getcwd fails
+        arena->current = mark.block;
+        mark.block->used = mark.used;
     }
 }
 
 //+
-// Function:	cdFunc
+// Function:	arenaFree
 //
-// Purpose:	To change the current working directory.
+// Purpose:	Free an arena's blocks, leaving it empty.
 //
 // Parameters:
-//	args[]	- Array of arguments where args[1] is the directory to change to.
-//	nargs	- Number of arguments (1 or 2).
+//	arena	- The arena.
 //
 // Returns	void
 //-
 
-void cdFunc(char *args[], int nargs) {
-    const char *targetDir;
-    
-    // If no argument, change to the home directory
-    if (nargs == 1) {
-        struct passwd *pw = getpwuid(getuid());  // Get the home directory of the current user
-        if (pw != NULL) {
-            targetDir = pw->pw_dir;  // Set the target directory to the user's home directory
-        } else {
-            fprintf(stderr, "cd: could not find home directory\n");
-            return;
-        }
-    } else {
-        targetDir = args[1];  // Set the target directory to the argument
+void arenaFree(struct arena *arena) {
+    struct arenaBlock *block = arena->first;
+    while (block != NULL) {
+        struct arenaBlock *next = block->next;
+        free(block);
+        block = next;
     }
+    arena->first = arena->current = NULL;
+}
 
-    // Try to change to the target directory
-    if (chdir(targetDir) != 0) {
-        perror("cd");  // Print error if chdir fails
+// shell operators, longest first. Unquoted operators in a command
+// line are returned as pointers to these strings, so a quoted "|"
+// is just an ordinary word.
+char * operators[] = {
+    "2>&1",
+    "2>>",
+    "2>",
+    ">>",
+    ">",
+    "<",
+    "|",
+    "&",
+    ";",
+    NULL
+};
+
+// characters that end a run of ordinary word characters. The 2 of
+// 2> is only an operator at the start of a word.
+const char wordSpecials[] = " \t\r'\"\\|&<>;";
+
+// characters that end a word
+const char wordSpaces[] = " \t\r";
+
+// characters that make a word a glob pattern, and those that are
+// escaped with a backslash when quoted in a pattern. Quoted blanks
+// are escaped too, so that splitting the word into fields at the
+// blanks of variable values leaves them alone.
+const char globSpecials[] = "*?[";
+const char globEscaped[] = "*?[]\\ \t\n";
+
+// the same adding $, for words that are expanded
+const char expandSpecials[] = "*?[$";
+const char expandEscaped[] = "*?[]\\$ \t\n";
+
+// first character of a word that expandWords has to expand
+#define WORD_EXPAND '\001'
+
+// stands for a $ inside double quotes in such a word, whose value is
+// not split or matched as a pattern
+#define WORD_QUOTED_VAR '\003'
+
+//+
+// Function:	copyQuoted
+//
+// Purpose:	Copy quoted characters of a word. When the word is to be
+//		expanded the special ones are escaped, so that they stand
+//		for themselves.
+//
+// Parameters:
+//	out	- Where to copy to (may overlap in, below it, if not escaping).
+//	in	- The characters.
+//	len	- How many.
+//	escape	- Characters to escape, or NULL if not expanding.
+//
+// Returns	char *
+//		the end of the copy
+//-
+
+char * copyQuoted(char *out, const char *in, size_t len, const char *escape) {
+    if (escape == NULL) {
+        memmove(out, in, len);
+        return out + len;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (strchr(escape, in[i]) != NULL) {
+            *out++ = '\\';
+        }
+        *out++ = in[i];
     }
+    return out;
 }
 
 //+
-// Function:	filter
+// Function:	isOperator
 //
-// Purpose:	To filter out hidden files (those starting with a dot).
+// Purpose:	Checks if an argument is the given shell operator.
 //
 // Parameters:
-//	d	- A pointer to a struct dirent.
+//	arg	- The argument to check.
+//	op	- The operator, e.g. "|", or NULL for any operator.
 //
 // Returns	int
-//		1 = if the file should be displayed (not hidden).
-//		0 = if the file should not be displayed (hidden).
+//		1 = arg is the unquoted operator
+//		0 = arg is an ordinary word
 //-
 
-int filter(const struct dirent *d) {
-    return d->d_name[0] != '.';  // Return 0 (false) if the name starts with a dot, 1 (true) otherwise
+int isOperator(const char *arg, const char *op) {
+    for (int i = 0; operators[i] != NULL; i++) {
+        if (arg == operators[i]) {
+            return op == NULL || strcmp(arg, op) == 0;
+        }
+    }
+    return 0;
 }
 
 //+
-// Function:	lsFunc
+// Function:	matchOperator
 //
-// Purpose:	List the contents of the current directory.
+// Purpose:	Checks if the text starts with a shell operator.
+//		Only called at the start of a word or at a special
+//		character, so the 2 in echo a2>f stays part of the word.
 //
 // Parameters:
-//	args[]	- Array of arguments where args[1] could be "-a" to show all files.
-//	nargs	- Number of arguments (1 or 2).
+//	text	- The text to check.
 //
-// Returns	void
+// Returns	char *
+//		the operator from operators[], or NULL if there is none.
 //-
 
-void lsFunc(char *args[], int nargs) {
-    struct dirent **namelist;
-    int numEnts;
-
-    if (nargs == 1) {
-        // No arguments: List files, excluding hidden ones
-        numEnts = scandir(".", &namelist, filter, NULL);  // No sorting
-    } else if (strcmp(args[1], "-a") == 0) {
-        // "-a" argument: List all files, including hidden ones
-        numEnts = scandir(".", &namelist, NULL, NULL);  // No sorting, no filter
-    } else {
-        // Invalid argument
-        fprintf(stderr, "ls: invalid option '%s'\n", args[1]);
-        return;
+char * matchOperator(const char *text) {
+    for (int i = 0; operators[i] != NULL; i++) {
+        if (strncmp(text, operators[i], strlen(operators[i])) == 0) {
+            return operators[i];
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function:	addArg
+//
+// Purpose:	Append an argument to the argument array. The array lives
+//		in the arena and is moved to one twice the size when full.
+//
+// Parameters:
+//	arena	- The arena.
+//	argsp	- Pointer to the argument array.
+//	nargs	- Pointer to the number of arguments.
+//	maxArgs	- Pointer to the size of the array.
+//	arg	- The new argument.
+//
+// Returns	void
+//-
+
+void addArg(struct arena *arena, char ***argsp, int *nargs, int *maxArgs, char *arg) {
+    // one extra for the null at the end
+    if (*nargs + 1 >= *maxArgs) {
+        int newMax = *maxArgs ? 2 * *maxArgs : 32;
+        char **newArgs = arenaAlloc(arena, newMax * sizeof(char *));
+        if (*nargs > 0) {
+            memcpy(newArgs, *argsp, *nargs * sizeof(char *));
+        }
+        *argsp = newArgs;
+        *maxArgs = newMax;
+    }
+    (*argsp)[(*nargs)++] = arg;
+    (*argsp)[*nargs] = NULL;
+}
+
+//+
+// Funtion:	splitCommandLine
+//
+// Purpose:	Splits the input command line string into individual
+//		arguments, expanding variables and glob patterns.
+//
+// Parameters:
+//	commandBuffer The input command line string to be split into arguments
+//	arena   The arena the argument array is allocated from
+//	argsp   Set to the null terminated argument array
+//
+// Returns:	Number of arguments, or -1 (with a message) if a quote is
+//		not closed.
+//
+//-
+
+int splitCommandLine(char *commandBuffer, struct arena *arena, char **argsp[]) {
+    char **words;
+    int nwords = scanCommandLine(commandBuffer, arena, &words);
+    if (nwords <= 0 || !hasExpansions(words, nwords)) {
+        *argsp = words;
+        return nwords;
+    }
+    return expandWords(words, nwords, arena, argsp);
+}
+
+//+
+// Funtion:	scanCommandLine
+//
+// Purpose:	Splits a command line into words, without expanding them.
+//		Quotes and backslashes are removed as the words are found.
+//		The words are built in place in commandBuffer, which works
+//		because a word is never longer than the text it came from.
+//		Runs of ordinary characters are found with strcspn, which
+//		glibc implements with SSE4.2 string instructions.
+//		A word with an unquoted glob character or $ is instead
+//		kept for expandWords: it starts with WORD_EXPAND and its
+//		quoted characters are escaped with a backslash.
+//
+// Parameters:
+//	commandBuffer The input command line string to be split into words
+//	arena   The arena the word array is allocated from
+//	argsp   Set to the null terminated word array
+//
+// Returns:	Number of words, or -1 (with a message) if a quote is
+//		not closed.
+//
+//-
+
+int scanCommandLine(char *commandBuffer, struct arena *arena, char **argsp[]) {
+    int nargs = 0;  // Number of arguments found
+    int maxArgs = 0;
+    char *in = commandBuffer;
+
+    // Lines with a glob character or $ have their words built in a
+    // buffer instead, with quoted characters escaped. Others (most
+    // lines) pay only this scan. A word takes at most a marker, twice
+    // its length and a null.
+    char *escBuf = NULL;
+    if (strpbrk(commandBuffer, expandSpecials) != NULL) {
+        escBuf = arenaAlloc(arena, 4 * strlen(commandBuffer) + 1);
+    }
+
+    *argsp = NULL;
+    addArg(arena, argsp, &nargs, &maxArgs, NULL);
+    nargs = 0;
+
+    // Loop through the command buffer to find arguments
+    while (1) {
+        // Skip over any leading spaces and tabs
+        in += strspn(in, wordSpaces);
+
+        // If end of string is reached, break the loop; # starts a
+        // comment that runs to the end of the line
+        if (*in == '\0' || *in == '#') {
+            break;
+        }
+
+        char *op = matchOperator(in);
+        if (op != NULL) {
+            addArg(arena, argsp, &nargs, &maxArgs, op);
+            in += strlen(op);
+            continue;
+        }
+
+        // copy the word down over the quotes removed so far, or after
+        // the space for the marker when escaping
+        char *word = escBuf ? escBuf + 1 : in;
+        char *out = word;
+        int expand = 0;		// has an unquoted glob character or $
+        while (1) {
+            size_t run = strcspn(in, wordSpecials);
+            if (escBuf != NULL) {
+                for (size_t i = 0; i < run && !expand; i++) {
+                    expand = strchr(expandSpecials, in[i]) != NULL;
+                }
+                memcpy(out, in, run);
+            } else if (out != in) {
+                memmove(out, in, run);
+            }
+            out += run;
+            in += run;
+
+            if (*in == '\'') {
+                // everything up to the closing quote is literal
+                char *close = strchr(in + 1, '\'');
+                if (close == NULL) {
+                    fprintf(stderr, "syntax error: unterminated '\n");
+                    return -1;
+                }
+                out = copyQuoted(out, in + 1, close - in - 1, escBuf ? expandEscaped : NULL);
+                in = close + 1;
+            } else if (*in == '"') {
+                in++;
+                while (1) {
+                    run = strcspn(in, "\"\\");
+                    // $ still expands inside double quotes
+                    if (escBuf != NULL && memchr(in, '$', run) != NULL) {
+                        expand = 1;
+                    }
+                    char *quoted = out;
+                    out = copyQuoted(out, in, run, escBuf ? globEscaped : NULL);
+                    for (; escBuf != NULL && quoted < out; quoted++) {
+                        if (*quoted == '$') {
+                            *quoted = WORD_QUOTED_VAR;
+                        }
+                    }
+                    in += run;
+                    if (*in == '"') {
+                        in++;
+                        break;
+                    } else if (*in == '\0') {
+                        fprintf(stderr, "syntax error: unterminated \"\n");
+                        return -1;
+                    }
+                    // backslash only escapes these inside double quotes
+                    if (in[1] == '"' || in[1] == '\\' || in[1] == '$') {
+                        in++;
+                    }
+                    out = copyQuoted(out, in++, 1, escBuf ? expandEscaped : NULL);
+                }
+            } else if (*in == '\\') {
+                // keep the next character, whatever it is
+                in++;
+                if (*in != '\0') {
+                    out = copyQuoted(out, in++, 1, escBuf ? expandEscaped : NULL);
+                }
+            } else {
+                // space, operator or end of line
+                break;
+            }
+        }
+
+        // the operator must be matched before the null is written
+        op = (*in != '\0' && strchr(wordSpaces, *in) == NULL) ? matchOperator(in) : NULL;
+        if (*in != '\0') {
+            in += op ? strlen(op) : 1;
+        }
+        *out = '\0';
+
+        if (escBuf != NULL) {
+            if (expand) {
+                *--word = WORD_EXPAND;
+            } else {
+                globUnescape(word);
+            }
+            escBuf = out + 1;
+            addArg(arena, argsp, &nargs, &maxArgs, word);
+        } else {
+            // Store the pointer to the current argument
+            addArg(arena, argsp, &nargs, &maxArgs, word);
+        }
+        if (op != NULL) {
+            addArg(arena, argsp, &nargs, &maxArgs, op);
+        }
+    }
+    return nargs;
+}
+
+////////////////////////////// Globbing ///////////////////////////////////
+
+// Words with unquoted *, ? or [ are patterns, replaced by the sorted
+// list of the paths they match. A pattern reaches here with its
+// quoted characters escaped with a backslash. It is compiled once,
+// each / separated segment becoming a literal name, a sequence of
+// match operations, or ** which matches any number of directories.
+// Only directories that a pattern segment must search are read,
+// each with a few large getdents64 calls and without a stat of
+// every entry, so a pattern like t1*.dat in a directory of 200,000
+// files costs one pass over the names.
+
+// a directory entry as returned by getdents64
+struct linuxDirent64 {
+    uint64_t		d_ino;
+    int64_t		d_off;
+    unsigned short	d_reclen;
+    unsigned char	d_type;
+    char		d_name[];
+};
+
+// size of the buffer for getdents64 while globbing
+#define GLOB_DIRENT_BUFF (256 * 1024)
+
+enum globOpTypes {GLOB_LITERAL, GLOB_ANY, GLOB_STAR, GLOB_CLASS};
+
+struct globOp {
+    int		type;
+    int		len;		// GLOB_LITERAL: length of text
+    const char *text;		// GLOB_LITERAL: the characters
+    uint64_t *	set;		// GLOB_CLASS: 256 bit set of characters
+};
+
+enum globSegTypes {GLOB_SEG_NAME, GLOB_SEG_PATTERN, GLOB_SEG_RECURSE};
+
+struct globSegment {
+    int			type;
+    char *		name;		// GLOB_SEG_NAME: the name, unescaped
+    struct globOp *	ops;		// GLOB_SEG_PATTERN
+    int			numOps;
+    int			matchDot;	// may match names starting with .
+    int			minLen;		// shortest name that can match
+    const char *	tail;		// literal the name must end with, or NULL
+    int			tailLen;
+};
+
+struct globState {
+    struct arena *	arena;
+    struct globSegment *segs;
+    int			numSegs;
+    int			dirsOnly;	// the pattern ends with /
+    char *		path;		// the path being built
+    size_t		pathMax;
+    char *		dirents;	// getdents64 buffer
+    char **		found;		// matches, in the arena
+    int			numFound;
+    int			maxFound;
+};
+
+//+
+// Function:	globUnescape
+//
+// Purpose:	Remove the backslashes from an escaped word, in place.
+//
+// Parameters:
+//	word	- The word.
+//
+// Returns	void
+//-
+
+void globUnescape(char *word) {
+    char *out = word;
+    for (char *in = word; *in != '\0'; in++) {
+        if (*in == '\\' && in[1] != '\0') {
+            in++;
+        }
+        *out++ = *in;
+    }
+    *out = '\0';
+}
+
+//+
+// Function:	globCompileClass
+//
+// Purpose:	Compile a [...] bracket expression into a character set.
+//		A leading ! or ^ negates it, a ] first is literal, a-z is
+//		a range.
+//
+// Parameters:
+//	pattern	- Points at the [.
+//	set	- The set to fill in (256 bits, cleared by the caller).
+//
+// Returns	const char *
+//		the character after the closing ], or NULL if there is no
+//		closing ] (and [ is then literal).
+//-
+
+const char * globCompileClass(const char *pattern, uint64_t set[4]) {
+    const char *p = pattern + 1;
+    int negate = 0;
+
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    int first = 1;
+    while (*p != ']' || first) {
+        first = 0;
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        if (*p == '\0') {
+            return NULL;
+        }
+        unsigned char lo = *p++, hi = lo;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            p++;
+            if (*p == '\\' && p[1] != '\0') {
+                p++;
+            }
+            hi = *p++;
+        }
+        for (unsigned int c = lo; c <= hi; c++) {
+            set[c / 64] |= 1ull << (c % 64);
+        }
+    }
+    if (negate) {
+        for (int i = 0; i < 4; i++) {
+            set[i] = ~set[i];
+        }
+    }
+    // never match the null at the end of a name
+    set[0] &= ~1ull;
+    return p + 1;
+}
+
+//+
+// Function:	globCompileSegment
+//
+// Purpose:	Compile one segment of a pattern.
+//
+// Parameters:
+//	seg	- The segment to fill in.
+//	text	- The escaped text of the segment (null terminated).
+//	arena	- Where to allocate the operations.
+//
+// Returns	void
+//-
+
+void globCompileSegment(struct globSegment *seg, char *text, struct arena *arena) {
+    if (strcmp(text, "**") == 0) {
+        seg->type = GLOB_SEG_RECURSE;
+        return;
+    }
+
+    // the worst case is an operation per character
+    size_t textLen = strlen(text);
+    seg->ops = arenaAlloc(arena, (textLen + 1) * sizeof(struct globOp));
+    seg->numOps = 0;
+    seg->minLen = 0;
+    // literal runs are unescaped into a copy of the text
+    char *lit = arenaAlloc(arena, textLen + 1);
+    struct globOp *op = NULL;
+    int special = 0;
+
+    for (const char *p = text; *p != '\0'; ) {
+        if (*p == '*' || *p == '?' || *p == '[') {
+            uint64_t *set = NULL;
+            const char *next = p + 1;
+            if (*p == '[') {
+                set = arenaAlloc(arena, 4 * sizeof(uint64_t));
+                memset(set, 0, 4 * sizeof(uint64_t));
+                next = globCompileClass(p, set);
+            }
+            if (next != NULL) {
+                special = 1;
+                // a run of stars is one star
+                if (*p == '*' && op != NULL && op->type == GLOB_STAR) {
+                    p = next;
+                    continue;
+                }
+                op = &seg->ops[seg->numOps++];
+                op->type = (*p == '*') ? GLOB_STAR : (*p == '?') ? GLOB_ANY : GLOB_CLASS;
+                op->set = set;
+                seg->minLen += (*p != '*');
+                p = next;
+                continue;
+            }
+        }
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        if (op == NULL || op->type != GLOB_LITERAL) {
+            op = &seg->ops[seg->numOps++];
+            op->type = GLOB_LITERAL;
+            op->text = lit;
+            op->len = 0;
+        }
+        *lit++ = *p++;
+        op->len++;
+        seg->minLen++;
+    }
+    *lit = '\0';
+
+    if (!special) {
+        // nothing to match, the name is used as it is
+        seg->type = GLOB_SEG_NAME;
+        seg->name = seg->numOps ? (char *) seg->ops[0].text : "";
+        return;
+    }
+    seg->type = GLOB_SEG_PATTERN;
+    seg->matchDot = seg->ops[0].type == GLOB_LITERAL && seg->ops[0].text[0] == '.';
+    seg->tail = NULL;
+    if (seg->numOps > 1 && seg->ops[seg->numOps - 1].type == GLOB_LITERAL) {
+        seg->tail = seg->ops[seg->numOps - 1].text;
+        seg->tailLen = seg->ops[seg->numOps - 1].len;
+    }
+}
+
+//+
+// Function:	globMatch
+//
+// Purpose:	Match a name against a compiled segment. On a mismatch
+//		it goes back to the last * and lets it take one more
+//		character, which is enough for any number of stars, so
+//		the time is at most the product of the name and pattern
+//		lengths and usually linear.
+//
+// Parameters:
+//	seg	- The compiled segment.
+//	name	- The name.
+//	nameLen	- Its length.
+//
+// Returns	int
+//		1 if it matches, 0 if not.
+//-
+
+int globMatch(struct globSegment *seg, const char *name, size_t nameLen) {
+    if (nameLen < (size_t) seg->minLen || (name[0] == '.' && !seg->matchDot)) {
+        return 0;
+    }
+    // most patterns end with a suffix such as .dat, check it first
+    if (seg->tail != NULL && memcmp(name + nameLen - seg->tailLen, seg->tail, seg->tailLen) != 0) {
+        return 0;
+    }
+
+    const unsigned char *s = (const unsigned char *) name;
+    const unsigned char *end = s + nameLen;
+    int op = 0;
+    int starOp = -1;
+    const unsigned char *starS = NULL;
+
+    while (1) {
+        if (op < seg->numOps) {
+            struct globOp *o = &seg->ops[op];
+            if (o->type == GLOB_STAR) {
+                starOp = op++;
+                starS = s;
+                continue;
+            }
+            if (o->type == GLOB_LITERAL) {
+                if (end - s >= o->len && memcmp(s, o->text, o->len) == 0) {
+                    s += o->len;
+                    op++;
+                    continue;
+                }
+            } else if (s < end && (o->type == GLOB_ANY || (o->set[*s / 64] & (1ull << (*s % 64))))) {
+                s++;
+                op++;
+                continue;
+            }
+        } else if (s == end) {
+            return 1;
+        }
+        // mismatch, let the last star take one more character
+        if (starOp < 0 || starS == end) {
+            return 0;
+        }
+        s = ++starS;
+        op = starOp + 1;
+    }
+}
+
+//+
+// Function:	globAddPath
+//
+// Purpose:	Add a component to the path being built.
+//
+// Parameters:
+//	st	- The expansion.
+//	len	- Length of the path so far.
+//	name	- The component.
+//	nameLen	- Its length.
+//
+// Returns	size_t
+//		the new length of the path
+//-
+
+size_t globAddPath(struct globState *st, size_t len, const char *name, size_t nameLen) {
+    // room for a /, the name, a / for dirsOnly and the null
+    if (len + nameLen + 3 > st->pathMax) {
+        while (len + nameLen + 3 > st->pathMax) {
+            st->pathMax *= 2;
+        }
+        st->path = realloc(st->path, st->pathMax);
+        if (st->path == NULL) {
+            perror("glob");
+            exit(1);
+        }
+    }
+    if (len > 0 && st->path[len - 1] != '/') {
+        st->path[len++] = '/';
+    }
+    memcpy(st->path + len, name, nameLen);
+    len += nameLen;
+    st->path[len] = '\0';
+    return len;
+}
+
+//+
+// Function:	globFound
+//
+// Purpose:	Record a matching path.
+//
+// Parameters:
+//	st	- The expansion.
+//	len	- Length of the path.
+//
+// Returns	void
+//-
+
+void globFound(struct globState *st, size_t len) {
+    if (st->numFound == st->maxFound) {
+        int newMax = st->maxFound ? 2 * st->maxFound : 64;
+        char **newFound = arenaAlloc(st->arena, newMax * sizeof(char *));
+        if (st->numFound > 0) {
+            memcpy(newFound, st->found, st->numFound * sizeof(char *));
+        }
+        st->found = newFound;
+        st->maxFound = newMax;
+    }
+    char *path = arenaAlloc(st->arena, len + 2);
+    memcpy(path, st->path, len);
+    if (st->dirsOnly) {
+        path[len++] = '/';
+    }
+    path[len] = '\0';
+    st->found[st->numFound++] = path;
+}
+
+//+
+// Function:	globIsDir
+//
+// Purpose:	Check whether a directory entry is a directory, using
+//		its type when the file system reports one.
+//
+// Parameters:
+//	dirFd	- The directory.
+//	d	- The entry.
+//	follow	- 1 to follow a symbolic link.
+//
+// Returns	int
+//		1 if it is a directory.
+//-
+
+int globIsDir(int dirFd, struct linuxDirent64 *d, int follow) {
+    struct stat st;
+
+    if (d->d_type == DT_DIR) {
+        return 1;
+    }
+    if (d->d_type != DT_UNKNOWN && !(follow && d->d_type == DT_LNK)) {
+        return 0;
+    }
+    return fstatat(dirFd, d->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+//+
+// Function:	globWalk
+//
+// Purpose:	Match the pattern segments from seg on, below the path
+//		built so far.
+//
+// Parameters:
+//	st	- The expansion.
+//	len	- Length of the path so far (0 for the current directory).
+//	seg	- The first segment to match.
+//
+// Returns	void
+//-
+
+void globWalk(struct globState *st, size_t len, int seg) {
+    struct stat sb;
+
+    if (seg == st->numSegs) {
+        if (len > 0 && (!st->dirsOnly || (stat(st->path, &sb) == 0 && S_ISDIR(sb.st_mode)))) {
+            globFound(st, len);
+        }
+        return;
+    }
+
+    struct globSegment *g = &st->segs[seg];
+    if (g->type == GLOB_SEG_NAME) {
+        size_t newLen = globAddPath(st, len, g->name, strlen(g->name));
+        // a literal last name must exist; a missing directory is
+        // found when it is read
+        if (seg + 1 < st->numSegs || lstat(st->path, &sb) == 0) {
+            globWalk(st, newLen, seg + 1);
+        }
+        st->path[len] = '\0';
+        return;
+    }
+
+    if (g->type == GLOB_SEG_RECURSE) {
+        // ** matches no directories as well as any number
+        globWalk(st, len, seg + 1);
+    }
+
+    int dirFd = open(len ? st->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return;
+    }
+
+    // Collect the matching names before going further, so that the
+    // buffer can be reused and only one directory is open at a time.
+    // For ** each name is preceded by 'd' for a directory or 'f'.
+    char *names = NULL;
+    size_t namesUsed = 0, namesSize = 0;
+    int last = (seg + 1 == st->numSegs);
+    long n;
+
+    while ((n = syscall(SYS_getdents64, dirFd, st->dirents, GLOB_DIRENT_BUFF)) > 0) {
+        for (long pos = 0; pos < n; pos += ((struct linuxDirent64 *) (st->dirents + pos))->d_reclen) {
+            struct linuxDirent64 *d = (struct linuxDirent64 *) (st->dirents + pos);
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            size_t nameLen = strlen(name);
+            char kind = 0;
+            if (g->type == GLOB_SEG_RECURSE) {
+                // descend into directories, but not hidden ones or links;
+                // a final ** also matches the other entries
+                if (name[0] == '.') {
+                    continue;
+                }
+                kind = globIsDir(dirFd, d, 0) ? 'd' : 'f';
+                if (kind == 'f' && !(last && !st->dirsOnly)) {
+                    continue;
+                }
+            } else if (!globMatch(g, name, nameLen)
+                    || (!last && !globIsDir(dirFd, d, 1))) {
+                continue;
+            }
+            if (namesUsed + nameLen + 2 > namesSize) {
+                namesSize = namesSize ? 2 * namesSize : 4096;
+                while (namesUsed + nameLen + 2 > namesSize) {
+                    namesSize *= 2;
+                }
+                names = realloc(names, namesSize);
+                if (names == NULL) {
+                    perror("glob");
+                    exit(1);
+                }
+            }
+            if (kind != 0) {
+                names[namesUsed++] = kind;
+            }
+            memcpy(names + namesUsed, name, nameLen + 1);
+            namesUsed += nameLen + 1;
+        }
+    }
+    close(dirFd);
+
+    for (size_t pos = 0; pos < namesUsed; ) {
+        char kind = 0;
+        if (g->type == GLOB_SEG_RECURSE) {
+            kind = names[pos++];
+        }
+        size_t nameLen = strlen(names + pos);
+        size_t newLen = globAddPath(st, len, names + pos, nameLen);
+        if (kind == 'd') {
+            // the directory itself is matched by the ** matching nothing
+            globWalk(st, newLen, seg);
+        } else if (kind == 'f') {
+            globFound(st, newLen);
+        } else if (last && !st->dirsOnly) {
+            // no need to look at the entry again
+            globFound(st, newLen);
+        } else {
+            globWalk(st, newLen, seg + 1);
+        }
+        st->path[len] = '\0';
+        pos += nameLen + 1;
+    }
+    free(names);
+}
+
+//+
+// Function:	globCompare
+//
+// Purpose:	qsort comparison of two paths.
+//
+// Parameters:
+//	a, b	- Pointers to the paths.
+//
+// Returns	int
+//		<0, 0 or >0 as strcmp
+//-
+
+int globCompare(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+//+
+// Function:	globExpand
+//
+// Purpose:	Expand a pattern, adding the paths it matches to the
+//		arguments in sorted order.
+//
+// Parameters:
+//	pattern	- The escaped pattern.
+//	arena	- Where the paths and the arguments are allocated.
+//	argsp	- The arguments, as for addArg.
+//	nargs	- Number of arguments.
+//	maxArgs	- Size of the arguments array.
+//
+// Returns	int
+//		the number of paths added.
+//-
+
+int globExpand(char *pattern, struct arena *arena, char ***argsp, int *nargs, int *maxArgs) {
+    struct globState st;
+    memset(&st, 0, sizeof(st));
+    st.arena = arena;
+
+    // split a copy at the slashes, which can't be escaped or in a
+    // class, so that the pattern is whole if it matches nothing
+    size_t patLen = strlen(pattern);
+    st.segs = arenaAlloc(arena, (patLen / 2 + 1) * sizeof(struct globSegment));
+    int absolute = (pattern[0] == '/');
+    char *p = arenaAlloc(arena, patLen + 1);
+    memcpy(p, pattern, patLen + 1);
+    while (*p != '\0') {
+        char *slash = strchr(p, '/');
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        if (*p != '\0') {
+            globCompileSegment(&st.segs[st.numSegs++], p, arena);
+        }
+        if (slash == NULL) {
+            break;
+        }
+        st.dirsOnly = (slash[1] == '\0');
+        p = slash + 1;
+    }
+
+    st.pathMax = 4096;
+    st.path = malloc(st.pathMax);
+    st.dirents = malloc(GLOB_DIRENT_BUFF);
+    if (st.path == NULL || st.dirents == NULL) {
+        perror("glob");
+        exit(1);
+    }
+    size_t len = 0;
+    if (absolute) {
+        st.path[len++] = '/';
+    }
+    st.path[len] = '\0';
+    globWalk(&st, len, 0);
+    free(st.path);
+    free(st.dirents);
+
+    qsort(st.found, st.numFound, sizeof(char *), globCompare);
+    for (int i = 0; i < st.numFound; i++) {
+        addArg(arena, argsp, nargs, maxArgs, st.found[i]);
+    }
+    return st.numFound;
+}
+
+////////////////////////////// Variables ///////////////////////////////////
+
+// Shell variables are set with name=value and expanded with $name or
+// ${name}; a name that is not a shell variable is looked up in the
+// environment. $? is the status of the last command, $$ the shell's
+// process id, $0 to $9 the script and its arguments and $# their
+// number. An unquoted value is split into fields at blanks (space,
+// tab and newline), and each field is matched as a pattern, so that
+// for f in $files loops over the files. In double quotes, or in an
+// assignment, a value is substituted as it is.
+
+#define VAR_BUCKETS 256		// must be a power of two
+
+struct variable {
+    struct variable *	next;
+    unsigned int	hashVal;
+    char *		value;		// malloc'd
+    char		name[];
+};
+
+struct variable * varTable[VAR_BUCKETS];
+
+// the script and its arguments, for $0 to $9 and $#
+char ** scriptArgs = NULL;
+int numScriptArgs = 0;
+
+//+
+// Function:	isVarName
+//
+// Purpose:	Find the length of the variable name at the start of a
+//		string.
+//
+// Parameters:
+//	text	- The string.
+//
+// Returns	size_t
+//		length of the name, 0 if it doesn't start with one.
+//-
+
+size_t isVarName(const char *text) {
+    size_t len = 0;
+    if (!isalpha((unsigned char) text[0]) && text[0] != '_') {
+        return 0;
+    }
+    while (isalnum((unsigned char) text[len]) || text[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+//+
+// Function:	findVar
+//
+// Purpose:	Look up a shell variable.
+//
+// Parameters:
+//	name	- The name (need not be null terminated).
+//	len	- Its length.
+//
+// Returns	struct variable *
+//		the variable, or NULL if it is not set.
+//-
+
+struct variable * findVar(const char *name, size_t len) {
+    // hashString of the len characters
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619u;
+    }
+    for (struct variable *var = varTable[h & (VAR_BUCKETS - 1)]; var != NULL; var = var->next) {
+        if (var->hashVal == h && strncmp(var->name, name, len) == 0 && var->name[len] == '\0') {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function:	setVar
+//
+// Purpose:	Set a shell variable.
+//
+// Parameters:
+//	name	- The name.
+//	value	- Its new value (copied).
+//
+// Returns	void
+//-
+
+void setVar(const char *name, const char *value) {
+    size_t len = strlen(name);
+    struct variable *var = findVar(name, len);
+    char *copy = strdup(value);
+
+    if (copy == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (var == NULL) {
+        var = malloc(sizeof(struct variable) + len + 1);
+        if (var == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(var->name, name, len + 1);
+        var->hashVal = hashString(name);
+        var->next = varTable[var->hashVal & (VAR_BUCKETS - 1)];
+        varTable[var->hashVal & (VAR_BUCKETS - 1)] = var;
+    } else {
+        free(var->value);
+    }
+    var->value = copy;
+    // a variable from the environment stays exported
+    if (getenv(name) != NULL) {
+        setenv(name, value, 1);
+    }
+}
+
+//+
+// Function:	varValue
+//
+// Purpose:	Find the value of the variable reference at the start
+//		of a string (just after the $).
+//
+// Parameters:
+//	ref	- The reference: name, {name}, ?, $, # or a digit.
+//	refLen	- Set to the length of the reference, 0 if there is
+//		  none (and the $ is literal).
+//	buf	- Space for values that are numbers.
+//
+// Returns	const char *
+//		the value, "" for an unset variable.
+//-
+
+const char * varValue(const char *ref, size_t *refLen, char buf[24]) {
+    const char *name = ref;
+    size_t len;
+
+    *refLen = 1;
+    switch (ref[0]) {
+    case '?':
+        snprintf(buf, 24, "%d", lastStatus);
+        return buf;
+    case '$':
+        snprintf(buf, 24, "%d", (int) getpid());
+        return buf;
+    case '#':
+        snprintf(buf, 24, "%d", numScriptArgs > 0 ? numScriptArgs - 1 : 0);
+        return buf;
+    }
+    if (isdigit((unsigned char) ref[0])) {
+        int n = ref[0] - '0';
+        return n < numScriptArgs ? scriptArgs[n] : "";
+    }
+
+    if (ref[0] == '{') {
+        name = ref + 1;
+        len = isVarName(name);
+        if (len == 0 || name[len] != '}') {
+            *refLen = 0;
+            return "";
+        }
+        *refLen = len + 2;
+    } else {
+        len = isVarName(name);
+        *refLen = len;
+        if (len == 0) {
+            return "";
+        }
+    }
+
+    struct variable *var = findVar(name, len);
+    if (var != NULL) {
+        return var->value;
+    }
+    char envName[len + 1];
+    memcpy(envName, name, len);
+    envName[len] = '\0';
+    const char *value = getenv(envName);
+    return value ? value : "";
+}
+
+//+
+// Function:	expandVars
+//
+// Purpose:	Substitute the variables of an escaped word. Quoted values
+//		are escaped, so that they are not taken as patterns or
+//		split. Unquoted ones, if split is set, are left for
+//		expandWords to split at their blanks and match.
+//
+// Parameters:
+//	word	- The escaped word (after WORD_EXPAND).
+//	arena	- Where to allocate the result.
+//	split	- 1 to leave unquoted values to be split, 0 to treat
+//		  every value as quoted (for an assignment).
+//
+// Returns	char *
+//		the escaped word with its variables substituted.
+//-
+
+char * expandVars(const char *word, struct arena *arena, int split) {
+    char buf[24];
+    size_t refLen;
+    size_t len = 0;
+
+    // the length first, then the copy
+    for (const char *p = word; *p != '\0'; ) {
+        if (*p == '\\' && p[1] != '\0') {
+            len += 2;
+            p += 2;
+        } else if (*p == '$' || *p == WORD_QUOTED_VAR) {
+            const char *escape = (split && *p == '$') ? "\\" : globEscaped;
+            const char *value = varValue(p + 1, &refLen, buf);
+            for (len += (refLen == 0); *value != '\0'; value++) {
+                len += 1 + (strchr(escape, *value) != NULL);
+            }
+            p += 1 + refLen;
+        } else {
+            len++;
+            p++;
+        }
+    }
+
+    char *result = arenaAlloc(arena, len + 1);
+    char *out = result;
+    for (const char *p = word; *p != '\0'; ) {
+        if (*p == '\\' && p[1] != '\0') {
+            *out++ = *p++;
+            *out++ = *p++;
+        } else if (*p == '$' || *p == WORD_QUOTED_VAR) {
+            const char *escape = (split && *p == '$') ? "\\" : globEscaped;
+            const char *value = varValue(p + 1, &refLen, buf);
+            if (refLen == 0) {
+                *out++ = '$';
+            }
+            out = copyQuoted(out, value, strlen(value), escape);
+            p += 1 + refLen;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+//+
+// Function:	hasGlob
+//
+// Purpose:	Check an escaped word for an unescaped glob character.
+//
+// Parameters:
+//	word	- The escaped word.
+//
+// Returns	int
+//		1 if it is a pattern.
+//-
+
+int hasGlob(const char *word) {
+    for (const char *p = word; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (strchr(globSpecials, *p) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//+
+// Function:	hasExpansions
+//
+// Purpose:	Check whether any word from scanCommandLine needs
+//		expanding.
+//
+// Parameters:
+//	words[]	- The words.
+//	nwords	- Number of words.
+//
+// Returns	int
+//		1 if expandWords must be called.
+//-
+
+int hasExpansions(char *words[], int nwords) {
+    for (int i = 0; i < nwords; i++) {
+        if (words[i][0] == WORD_EXPAND) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//+
+// Function:	expandWords
+//
+// Purpose:	Expand the words from scanCommandLine into arguments:
+//		variables are substituted, the result split into fields at
+//		the blanks of unquoted values, then patterns replaced by
+//		the paths they match. Other words are used as they are.
+//		A word that is only an unquoted empty value goes away.
+//
+// Parameters:
+//	words[]	- The words.
+//	nwords	- Number of words.
+//	arena	- Where the arguments are allocated.
+//	argsp	- Set to the null terminated argument array.
+//
+// Returns	int
+//		number of arguments.
+//-
+
+int expandWords(char *words[], int nwords, struct arena *arena, char ***argsp) {
+    int nargs = 0;
+    int maxArgs = 0;
+
+    *argsp = NULL;
+    addArg(arena, argsp, &nargs, &maxArgs, NULL);
+    nargs = 0;
+    for (int i = 0; i < nwords; i++) {
+        if (words[i][0] != WORD_EXPAND) {
+            addArg(arena, argsp, &nargs, &maxArgs, words[i]);
+            continue;
+        }
+        char *p = expandVars(words[i] + 1, arena, 1);
+        int fields = 0;
+        while (1) {
+            // quoted blanks are escaped, so these came from values
+            p += strspn(p, " \t\n");
+            if (*p == '\0') {
+                break;
+            }
+            char *field = p;
+            while (*p != '\0' && strchr(" \t\n", *p) == NULL) {
+                p += (*p == '\\' && p[1] != '\0') ? 2 : 1;
+            }
+            if (*p != '\0') {
+                *p++ = '\0';
+            }
+            // a pattern that matches nothing is left as it is
+            if (!hasGlob(field) || globExpand(field, arena, argsp, &nargs, &maxArgs) == 0) {
+                globUnescape(field);
+                addArg(arena, argsp, &nargs, &maxArgs, field);
+            }
+            fields++;
+        }
+        // but "$empty" is still an empty argument
+        if (fields == 0 && strchr(words[i], WORD_QUOTED_VAR) != NULL) {
+            addArg(arena, argsp, &nargs, &maxArgs, p);
+        }
+    }
+    return nargs;
+}
+
+////////////////////////////// External Program  (Note this is step 4, complete doeInternalCommand first!!) ///////////////////////////////////
+
+// list of directorys to check for command.
+// terminated by null value
+// only used if PATH is not set in the environment.
+char * path[] = {
+    ".",
+    "/bin",
+    "/usr/bin",
+    NULL
+};
+
+// a directory that is searched for commands, along with its
+// modification time when it was last checked. A new or removed
+// command changes the mtime of the directory that holds it.
+struct searchDir {
+    char *	dirName;
+    struct timespec	mtime;
+};
+
+// the directories actually searched, in order.
+struct searchDir * searchPath = NULL;
+int numSearchDirs = 0;
+// true if any of the directories is relative (e.g. "."),
+// in which case cd invalidates remembered locations.
+int searchPathRelative = 0;
+
+// remembered location of a command, chained in a hash bucket.
+struct hashEntry {
+    struct hashEntry *	next;
+    unsigned int	hashVal;
+    int			hits;		// number of times the entry was used
+    char *		cmdName;
+    char *		cmdPath;	// full path to the executable
+};
+
+#define HASH_INIT_BUCKETS 64		// must be a power of two
+#define HASH_CHECK_INTERVAL_MS 1000	// how often directory mtimes are checked
+
+struct hashEntry ** hashTable = NULL;
+unsigned int hashBuckets = 0;
+unsigned int hashCount = 0;
+// when the directory mtimes were last checked
+struct timespec lastDirCheck;
+
+//+
+// Function:	initSearchPath
+//
+// Purpose:	Builds the list of directories to search for external
+//		commands. If PATH is set it is used, otherwise the
+//		built in path[] list. As with other shells an empty
+//		PATH component means the current directory.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void initSearchPath(void) {
+    char *envPath = getenv("PATH");
+    int maxDirs;
+
+    if (envPath != NULL && *envPath != '\0') {
+        // one directory per ':' separated component
+        maxDirs = 1;
+        for (char *p = envPath; *p != '\0'; p++) {
+            if (*p == ':') {
+                maxDirs++;
+            }
+        }
+    } else {
+        for (maxDirs = 0; path[maxDirs] != NULL; maxDirs++);
+    }
+
+    searchPath = calloc(maxDirs, sizeof(struct searchDir));
+    if (searchPath == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    numSearchDirs = 0;
+
+    if (envPath != NULL && *envPath != '\0') {
+        // copy, the components are null terminated in place
+        char *dirs = strdup(envPath);
+        char *next = dirs;
+        while (next != NULL) {
+            char *dir = next;
+            next = strchr(next, ':');
+            if (next != NULL) {
+                *next++ = '\0';
+            }
+            searchPath[numSearchDirs++].dirName = (*dir == '\0') ? "." : dir;
+        }
+    } else {
+        for (int i = 0; path[i] != NULL; i++) {
+            searchPath[numSearchDirs++].dirName = path[i];
+        }
+    }
+
+    // record the current mtimes of the directories
+    searchPathRelative = 0;
+    for (int i = 0; i < numSearchDirs; i++) {
+        struct stat statbuf;
+        if (stat(searchPath[i].dirName, &statbuf) == 0) {
+            searchPath[i].mtime = statbuf.st_mtim;
+        }
+        if (searchPath[i].dirName[0] != '/') {
+            searchPathRelative = 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &lastDirCheck);
+}
+
+//+
+// Function:	hashString
+//
+// Purpose:	FNV-1a hash of a string.
+//
+// Parameters:
+//	str	- The string to hash.
+//
+// Returns	unsigned int
+//		the hash value
+//-
+
+unsigned int hashString(const char *str) {
+    unsigned int h = 2166136261u;
+    while (*str != '\0') {
+        h ^= (unsigned char) *str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//+
+// Function:	hashLookup
+//
+// Purpose:	Find the remembered location of a command.
+//
+// Parameters:
+//	cmdName	- The command to look up.
+//	h	- hashString(cmdName)
+//
+// Returns	struct hashEntry *
+//		the entry, or NULL if the command is not remembered.
+//-
+
+struct hashEntry * hashLookup(const char *cmdName, unsigned int h) {
+    if (hashBuckets == 0) {
+        return NULL;
+    }
+    for (struct hashEntry *ent = hashTable[h & (hashBuckets - 1)]; ent != NULL; ent = ent->next) {
+        if (ent->hashVal == h && strcmp(ent->cmdName, cmdName) == 0) {
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function:	hashClear
+//
+// Purpose:	Forget all remembered command locations.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void hashClear(void) {
+    for (unsigned int i = 0; i < hashBuckets; i++) {
+        struct hashEntry *ent = hashTable[i];
+        while (ent != NULL) {
+            struct hashEntry *next = ent->next;
+            free(ent);
+            ent = next;
+        }
+        hashTable[i] = NULL;
+    }
+    hashCount = 0;
+}
+
+//+
+// Function:	hashRemove
+//
+// Purpose:	Forget the remembered location of one command.
+//
+// Parameters:
+//	cmdName	- The command to forget.
+//
+// Returns	int
+//		1 = the command was remembered and has been removed
+//		0 = the command was not remembered
+//-
+
+int hashRemove(const char *cmdName) {
+    if (hashBuckets == 0) {
+        return 0;
+    }
+    unsigned int h = hashString(cmdName);
+    struct hashEntry **prev = &hashTable[h & (hashBuckets - 1)];
+    for (struct hashEntry *ent = *prev; ent != NULL; prev = &ent->next, ent = ent->next) {
+        if (ent->hashVal == h && strcmp(ent->cmdName, cmdName) == 0) {
+            *prev = ent->next;
+            free(ent);
+            hashCount--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//+
+// Function:	hashInsert
+//
+// Purpose:	Remember the location of a command. The table is
+//		doubled when the average chain length reaches two.
+//
+// Parameters:
+//	cmdName	- The name of the command.
+//	cmdPath	- The full path to the executable.
+//	h	- hashString(cmdName)
+//
+// Returns	struct hashEntry *
+//		the new entry, or NULL if out of memory.
+//-
+
+struct hashEntry * hashInsert(const char *cmdName, const char *cmdPath, unsigned int h) {
+    if (hashCount >= 2 * hashBuckets) {
+        unsigned int newBuckets = hashBuckets ? 2 * hashBuckets : HASH_INIT_BUCKETS;
+        struct hashEntry **newTable = calloc(newBuckets, sizeof(struct hashEntry *));
+        if (newTable == NULL) {
+            return NULL;
+        }
+        // rehash the existing entries into the new table
+        for (unsigned int i = 0; i < hashBuckets; i++) {
+            struct hashEntry *ent = hashTable[i];
+            while (ent != NULL) {
+                struct hashEntry *next = ent->next;
+                ent->next = newTable[ent->hashVal & (newBuckets - 1)];
+                newTable[ent->hashVal & (newBuckets - 1)] = ent;
+                ent = next;
+            }
+        }
+        free(hashTable);
+        hashTable = newTable;
+        hashBuckets = newBuckets;
+    }
+
+    // entry and both strings are allocated together
+    size_t nameLen = strlen(cmdName) + 1;
+    size_t pathLen = strlen(cmdPath) + 1;
+    struct hashEntry *ent = malloc(sizeof(struct hashEntry) + nameLen + pathLen);
+    if (ent == NULL) {
+        return NULL;
+    }
+    ent->cmdName = (char *) (ent + 1);
+    ent->cmdPath = ent->cmdName + nameLen;
+    memcpy(ent->cmdName, cmdName, nameLen);
+    memcpy(ent->cmdPath, cmdPath, pathLen);
+    ent->hashVal = h;
+    ent->hits = 0;
+    ent->next = hashTable[h & (hashBuckets - 1)];
+    hashTable[h & (hashBuckets - 1)] = ent;
+    hashCount++;
+    return ent;
+}
+
+//+
+// Function:	checkSearchDirs
+//
+// Purpose:	Forget all remembered locations if any directory in the
+//		search path has been modified. To keep the common case free
+//		of system calls the directories are only checked once every
+//		HASH_CHECK_INTERVAL_MS milliseconds.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void checkSearchDirs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    long elapsedMs = (now.tv_sec - lastDirCheck.tv_sec) * 1000
+                   + (now.tv_nsec - lastDirCheck.tv_nsec) / 1000000;
+    if (elapsedMs < HASH_CHECK_INTERVAL_MS) {
+        return;
+    }
+    lastDirCheck = now;
+
+    int changed = 0;
+    for (int i = 0; i < numSearchDirs; i++) {
+        struct stat statbuf;
+        struct timespec mtime = {0, 0};
+        if (stat(searchPath[i].dirName, &statbuf) == 0) {
+            mtime = statbuf.st_mtim;
+        }
+        if (mtime.tv_sec != searchPath[i].mtime.tv_sec || mtime.tv_nsec != searchPath[i].mtime.tv_nsec) {
+            searchPath[i].mtime = mtime;
+            changed = 1;
+        }
+    }
+    if (changed) {
+        hashClear();
+    }
+}
+
+//+
+// Function:	searchDirsNow
+//
+// Purpose:	Force the next lookup to recheck the search directories.
+//		Used after a cd when the search path has relative entries.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void searchDirsNow(void) {
+    lastDirCheck.tv_sec = 0;
+    lastDirCheck.tv_nsec = 0;
+}
+
+//+
+// Function:	isExecutable
+//
+// Purpose:	Checks if a path names a regular executable file.
+//
+// Parameters:
+//	cmdPath	- The path to check.
+//
+// Returns	int
+//		1 = the file exists and is executable
+//		0 = otherwise
+//-
+
+int isExecutable(const char *cmdPath) {
+    struct stat statbuf;
+    return stat(cmdPath, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && (statbuf.st_mode & S_IXUSR);
+}
+
+//+
+// Function:	findCommand
+//
+// Purpose:	Find the executable for a command. Names containing a /
+//		are used as is. Otherwise the remembered location is used
+//		if there is one, and the search path is only walked
+//		(one stat per directory) the first time a name is seen.
+//
+// Parameters:
+//	cmdName	- The name of the command (args[0]).
+//
+// Returns	char *
+//		full path to the executable, or NULL if it was not found.
+//		The string is owned by the cache and is only valid until
+//		the next lookup.
+//-
+
+char * findCommand(char *cmdName) {
+    char cmdPath[CMD_BUFFSIZE];
+
+    if (strchr(cmdName, '/') != NULL) {
+        return isExecutable(cmdName) ? cmdName : NULL;
+    }
+
+    checkSearchDirs();
+
+    unsigned int h = hashString(cmdName);
+    struct hashEntry *ent = hashLookup(cmdName, h);
+    if (ent != NULL) {
+        ent->hits++;
+        return ent->cmdPath;
+    }
+
+    // Iterate over all directories in the search path
+    for (int i = 0; i < numSearchDirs; i++) {
+        // Construct the full path to the command
+        snprintf(cmdPath, sizeof(cmdPath), "%s/%s", searchPath[i].dirName, cmdName);
+
+        // Check if the file exists and is executable
+        if (isExecutable(cmdPath)) {
+            ent = hashInsert(cmdName, cmdPath, h);
+            if (ent == NULL) {
+                // out of memory, run it without remembering it
+                static char uncached[CMD_BUFFSIZE];
+                strcpy(uncached, cmdPath);
+                return uncached;
+            }
+            ent->hits++;
+            return ent->cmdPath;
+        }
+    }
+    return NULL;
+}
+
+////////////////////////////// Redirection ///////////////////////////////////
+
+// the redirections of one command. Files are opened close-on-exec by
+// the shell and put in place with dup2 in the child (or by the spawn
+// file actions), then closed in the shell once the command is started.
+struct redirection {
+    int		childFd[3];	// descriptors for fds 0, 1 and 2, -1 to inherit
+    int		numOpened;
+    int *	opened;		// files opened for the command
+};
+
+//+
+// Function:	isRedirection
+//
+// Purpose:	Checks if an argument is a redirection operator.
+//
+// Parameters:
+//	arg	- The argument to check.
+//
+// Returns	int
+//		1 = arg is <, >, >>, 2>, 2>> or 2>&1
+//		0 = otherwise
+//-
+
+int isRedirection(const char *arg) {
+    return isOperator(arg, "<") || isOperator(arg, ">") || isOperator(arg, ">>")
+        || isOperator(arg, "2>") || isOperator(arg, "2>>") || isOperator(arg, "2>&1");
+}
+
+//+
+// Function:	commandWord
+//
+// Purpose:	Find the command name, skipping any redirections that
+//		come before it (as in < file cmd).
+//
+// Parameters:
+//	args[]	- Array of arguments.
+//	nargs	- Number of arguments.
+//
+// Returns	char *
+//		the command name, or NULL if there are only redirections.
+//-
+
+char * commandWord(char *args[], int nargs) {
+    for (int i = 0; i < nargs; i++) {
+        if (!isRedirection(args[i])) {
+            return args[i];
+        }
+        if (!isOperator(args[i], "2>&1")) {
+            i++;
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function:	parseRedirections
+//
+// Purpose:	Open the files of the redirections in a command, left to
+//		right, and remove the redirections from its arguments.
+//		redir->childFd must be set up first (e.g. with pipe ends);
+//		a redirection replaces what was there.
+//
+// Parameters:
+//	args[]	- Null terminated array of arguments, compacted in place.
+//	nargs	- Pointer to the number of arguments, updated.
+//	redir	- The redirections.
+//
+// Returns	int
+//		0 = success
+//		-1 = syntax error or a file could not be opened (with a
+//		     message); any files opened have been closed.
+//-
+
+int parseRedirections(char *args[], int *nargs, struct redirection *redir) {
+    int kept = 0;
+
+    redir->numOpened = 0;
+    redir->opened = NULL;
+    for (int i = 0; i < *nargs; i++) {
+        char *op = args[i];
+        if (!isRedirection(op)) {
+            args[kept++] = op;
+            continue;
+        }
+        if (redir->opened == NULL) {
+            redir->opened = arenaAlloc(&lineArena, *nargs * sizeof(int));
+        }
+        if (isOperator(op, "2>&1")) {
+            // stderr goes wherever stdout goes at this point
+            redir->childFd[2] = redir->childFd[1] >= 0 ? redir->childFd[1] : 1;
+            continue;
+        }
+        if (i + 1 == *nargs || isOperator(args[i + 1], args[i + 1])) {
+            fprintf(stderr, "syntax error near '%s'\n", op);
+            closeRedirections(redir);
+            return -1;
+        }
+
+        char *fileName = args[++i];
+        int flags, target;
+        if (isOperator(op, "<")) {
+            flags = O_RDONLY;
+            target = 0;
+        } else {
+            int append = isOperator(op, ">>") || isOperator(op, "2>>");
+            flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+            target = (op[0] == '2') ? 2 : 1;
+        }
+        int fd = open(fileName, flags | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", fileName, strerror(errno));
+            closeRedirections(redir);
+            return -1;
+        }
+        redir->opened[redir->numOpened++] = fd;
+        redir->childFd[target] = fd;
+    }
+    args[kept] = NULL;
+    *nargs = kept;
+    return 0;
+}
+
+//+
+// Function:	closeRedirections
+//
+// Purpose:	Close the files opened for a command's redirections, once
+//		the command has been started or has finished.
+//
+// Parameters:
+//	redir	- The redirections.
+//
+// Returns	void
+//-
+
+void closeRedirections(struct redirection *redir) {
+    for (int i = 0; i < redir->numOpened; i++) {
+        close(redir->opened[i]);
+    }
+    redir->numOpened = 0;
+}
+
+//+
+// Function:	hasRedirection
+//
+// Purpose:	Checks if a command has any redirections.
+//
+// Parameters:
+//	args[]	- Array of arguments.
+//	nargs	- Number of arguments.
+//
+// Returns	int
+//		1 if there is a redirection operator, 0 otherwise.
+//-
+
+int hasRedirection(char *args[], int nargs) {
+    for (int i = 0; i < nargs; i++) {
+        if (isRedirection(args[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////// Process Launch ///////////////////////////////////
+
+extern char **environ;
+
+// ways of starting an external command. fork copies the page tables
+// of the shell, so its cost grows with the size of the shell. vfork
+// and posix_spawn (clone with CLONE_VM|CLONE_VFORK in glibc) share the
+// shell's memory until the child calls exec.
+enum launchMethods {
+    LAUNCH_FORK,
+    LAUNCH_VFORK,
+    LAUNCH_POSIX_SPAWN
+};
+
+// names of the launch methods for the set builtin, in enum order.
+const char * launchNames[] = {
+    "fork",
+    "vfork",
+    "posix_spawn",
+    NULL
+};
+
+int launchMethod = LAUNCH_POSIX_SPAWN;
+
+// size requested for pipe buffers with F_SETPIPE_SZ, 0 = leave
+// the kernel default (64k on Linux).
+int pipeSize = 0;
+
+//+
+// Function:	setupChildFds
+//
+// Purpose:	In a forked child, move the given descriptors onto
+//		stdin, stdout and stderr. The shell opens its pipes and
+//		files close-on-exec, so nothing else leaks into the command.
+//
+// Parameters:
+//	childFd[]	- descriptors for fd 0, 1 and 2, -1 to inherit.
+//			  May be NULL to inherit all three.
+//
+// Returns	void
+//-
+
+// stderr is set before stdout, so that "2>&1 > file" sends stderr
+// to the original stdout as other shells do
+const int childFdOrder[3] = {0, 2, 1};
+
+void setupChildFds(int childFd[3]) {
+    if (childFd == NULL) {
+        return;
+    }
+    for (int j = 0; j < 3; j++) {
+        int i = childFdOrder[j];
+        if (childFd[i] == i) {
+            // dup2 onto itself would leave close-on-exec set
+            fcntl(i, F_SETFD, 0);
+        } else if (childFd[i] >= 0) {
+            dup2(childFd[i], i);
+        }
+    }
+}
+
+//+
+// Function:	launchCommand
+//
+// Purpose:	Start an external command in a child process using the
+//		selected launch method. Does not wait for the child.
+//
+// Parameters:
+//	cmdPath	- Full path to the executable.
+//	args[]	- Null terminated argument array for the command.
+//	childFd[]	- descriptors to use for the child's stdin, stdout
+//			  and stderr, -1 to inherit. NULL to inherit all three.
+//
+// Returns	pid_t
+//		process id of the child, or -1 if it could not be started.
+//-
+
+pid_t launchCommand(char *cmdPath, char *args[], int childFd[3]) {
+    pid_t pid;
+
+    // our own buffered output must come before the command's
+    fflush(stdout);
+
+    if (launchPlacement != NULL) {
+        return launchPlaced(cmdPath, args, childFd);
+    }
+
+    if (launchMethod == LAUNCH_POSIX_SPAWN) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_t *actionsPtr = NULL;
+        if (childFd != NULL) {
+            posix_spawn_file_actions_init(&actions);
+            for (int j = 0; j < 3; j++) {
+                int i = childFdOrder[j];
+                if (childFd[i] >= 0) {
+                    posix_spawn_file_actions_adddup2(&actions, childFd[i], i);
+                }
+            }
+            actionsPtr = &actions;
+        }
+        // posix_spawn reports a failed exec as its return value
+        int err = posix_spawn(&pid, cmdPath, actionsPtr, NULL, args, environ);
+        if (actionsPtr != NULL) {
+            posix_spawn_file_actions_destroy(actionsPtr);
+        }
+        if (err != 0) {
+            fprintf(stderr, "%s: %s\n", cmdPath, strerror(err));
+            return -1;
+        }
+        return pid;
+    }
+
+    if (launchMethod == LAUNCH_VFORK) {
+        // the child runs in our memory until it execs, so it can
+        // hand a failed exec's errno straight back to the parent.
+        volatile int execErr = 0;
+        pid = vfork();
+        if (pid == 0) {
+            setupChildFds(childFd);
+            execv(cmdPath, args);
+            execErr = errno;
+            _exit(127);
+        } else if (pid < 0) {
+            perror("vfork");
+            return -1;
+        }
+        if (execErr != 0) {
+            fprintf(stderr, "%s: %s\n", cmdPath, strerror(execErr));
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+        return pid;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        // This is the child process execute the command
+        setupChildFds(childFd);
+        execv(cmdPath, args);
+        // If execv returns, there was an error
+        perror("execv");
+        exit(127);
+    } else if (pid < 0) {
+        // Fork failed
+        perror("fork");
+        return -1;
+    }
+    return pid;
+}
+
+//+
+// Function:	doExternalCommand
+//
+// Purpose:	Search for and execute external commands.
+//
+// Parameters:
+//	args[]	- Array of arguments where args[0] is the command to be executed.
+//	nargs	- Number of arguments in the args array.
+//
+// Returns	int
+//		1 = Found and executed the file.
+//		0 = Could not find or execute the file.
+//-
+
+int doExternalCommand(char *args[], int nargs) {
+    char *cmdWord = commandWord(args, nargs);
+    char *cmdPath = cmdWord ? findCommand(cmdWord) : NULL;
+
+    if (cmdPath == NULL) {
+        // If no executable file was found, return 0
+        return 0;
+    }
+
+    struct job *job = newJob(args, nargs, 0);
+    struct redirection redir = {{-1, -1, -1}, 0, NULL};
+    int withRedir = hasRedirection(args, nargs);
+    if (withRedir && parseRedirections(args, &nargs, &redir) != 0) {
+        lastStatus = 1;
+        freeJob(job);
+        return 1;
+    }
+
+    pid_t pid = launchCommand(cmdPath, args, withRedir ? redir.childFd : NULL);
+    closeRedirections(&redir);
+    if (pid > 0) {
+        // wait for this child to complete
+        addJobProcess(job, pid, args[0]);
+        waitForJob(job);
+    } else {
+        lastStatus = 127;
+        freeJob(job);
+    }
+    // found, even if it could not be started
+    return 1;
+}
+
+////////////////////////////// Placement ///////////////////////////////////
+
+// The limit prefix starts the processes of a command line in a
+// cgroup v2 group, with a CPU affinity and a NUMA memory policy.
+// The group is prepared in the shell (made, limits written, opened)
+// and the child is created inside it with clone3(CLONE_INTO_CGROUP),
+// so it never runs outside it. Where clone3 can't do that (older
+// kernels, or a group on another hierarchy) a vfork child moves
+// itself into the group before exec. Affinity and memory policy are
+// set by the child, which only makes system calls before exec.
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+#define PLACE_MAX_NODES 1024
+
+// the kernel's struct clone_args, up to the cgroup field
+struct cloneArgs {
+    uint64_t	flags;
+    uint64_t	pidfd;
+    uint64_t	childTid;
+    uint64_t	parentTid;
+    uint64_t	exitSignal;
+    uint64_t	stack;
+    uint64_t	stackSize;
+    uint64_t	tls;
+    uint64_t	setTid;
+    uint64_t	setTidSize;
+    uint64_t	cgroup;
+};
+
+struct placement {
+    int		groupFd;	// the group directory, -1 if no group
+    int		procsFd;	// its cgroup.procs, for moving in a child
+    int		useAffinity;
+    cpu_set_t	cpus;
+    int		memPolicy;	// 0, MPOL_BIND or MPOL_INTERLEAVE
+    unsigned long nodes[PLACE_MAX_NODES / (8 * sizeof(unsigned long))];
+};
+
+// the placement of the current command line, if it has one
+struct placement commandPlacement;
+struct placement * launchPlacement = NULL;
+
+// clone3 is tried until the kernel refuses it
+int cloneIntoCgroup = 1;
+
+//+
+// Function:	parseIdList
+//
+// Purpose:	Parse a list of numbers and ranges, such as 0-3,8,10-11,
+//		into a bit mask.
+//
+// Parameters:
+//	list	- The list.
+//	mask	- Bit mask to set the bits in (cleared first).
+//	maxId	- Number of bits in the mask.
+//
+// Returns	int
+//		0 on success, -1 if the list is malformed or out of range.
+//-
+
+int parseIdList(const char *list, unsigned long *mask, int maxId) {
+    const int bitsPerWord = 8 * sizeof(unsigned long);
+
+    memset(mask, 0, maxId / 8);
+    while (1) {
+        char *end;
+        long lo = strtol(list, &end, 10);
+        long hi = lo;
+        if (end == list || lo < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            hi = strtol(list, &end, 10);
+            if (end == list || hi < lo) {
+                return -1;
+            }
+        }
+        if (hi >= maxId) {
+            return -1;
+        }
+        for (long id = lo; id <= hi; id++) {
+            mask[id / bitsPerWord] |= 1ul << (id % bitsPerWord);
+        }
+        if (*end == '\0') {
+            return 0;
+        }
+        if (*end != ',') {
+            return -1;
+        }
+        list = end + 1;
+    }
+}
+
+//+
+// Function:	cgroupPath
+//
+// Purpose:	Find the directory of a cgroup v2 group. An absolute
+//		group is below the cgroup2 mount, a relative one is below
+//		the parent of the shell's own group, next to it.
+//
+// Parameters:
+//	group	- The group name.
+//	path	- Where to put the path.
+//	size	- Size of path.
+//
+// Returns	int
+//		0 on success, -1 (with a message) if there is no cgroup2
+//		file system.
+//-
+
+int cgroupPath(const char *group, char *path, size_t size) {
+    char line[CMD_BUFFSIZE];
+    char mount[CMD_BUFFSIZE] = "";
+    char own[CMD_BUFFSIZE] = "";
+
+    FILE *mounts = fopen("/proc/self/mounts", "re");
+    if (mounts != NULL) {
+        while (fgets(line, sizeof(line), mounts) != NULL) {
+            char dir[CMD_BUFFSIZE], type[64];
+            if (sscanf(line, "%*s %1023s %63s", dir, type) == 2 && strcmp(type, "cgroup2") == 0) {
+                strcpy(mount, dir);
+                break;
+            }
+        }
+        fclose(mounts);
+    }
+    if (mount[0] == '\0') {
+        fprintf(stderr, "limit: no cgroup2 file system mounted\n");
+        return -1;
+    }
+
+    if (group[0] != '/') {
+        // the v2 entry is 0::/path
+        FILE *self = fopen("/proc/self/cgroup", "re");
+        if (self != NULL) {
+            while (fgets(line, sizeof(line), self) != NULL) {
+                if (strncmp(line, "0::", 3) == 0) {
+                    line[strcspn(line, "\n")] = '\0';
+                    strcpy(own, line + 3);
+                    break;
+                }
+            }
+            fclose(self);
+        }
+        char *slash = strrchr(own, '/');
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        snprintf(path, size, "%s%s/%s", mount, own, group);
+    } else {
+        snprintf(path, size, "%s%s", mount, group);
+    }
+    return 0;
+}
+
+//+
+// Function:	cgroupWrite
+//
+// Purpose:	Write a value to a file of a group.
+//
+// Parameters:
+//	dirFd	- The group directory.
+//	file	- The file, such as cpu.max.
+//	value	- What to write.
+//
+// Returns	int
+//		0 on success, -1 (with a message) on error.
+//-
+
+int cgroupWrite(int dirFd, const char *file, const char *value) {
+    int fd = openat(dirFd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+        fprintf(stderr, "limit: %s: %s\n", file, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+//+
+// Function:	openGroup
+//
+// Purpose:	Make a group if it doesn't exist, with the controllers
+//		its limits need enabled in its parent, and write the limits.
+//
+// Parameters:
+//	group	- The group name.
+//	limits	- The values for cpu.max, memory.max and io.max, NULL
+//		  for those not to change.
+//	pl	- The placement, whose groupFd and procsFd are set.
+//
+// Returns	int
+//		0 on success, -1 (with a message) on error.
+//-
+
+const char * limitFiles[] = {"cpu.max", "memory.max", "io.max"};
+const char * limitControllers[] = {"+cpu", "+memory", "+io"};
+
+int openGroup(const char *group, char *limits[3], struct placement *pl) {
+    char path[2 * CMD_BUFFSIZE];
+
+    if (cgroupPath(group, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "limit: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    pl->groupFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pl->groupFd < 0) {
+        fprintf(stderr, "limit: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int parentFd = openat(pl->groupFd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < 3; i++) {
+        if (limits[i] == NULL) {
+            continue;
+        }
+        // enabling one already enabled is harmless; if it can't be
+        // enabled the limit file is missing and that is reported
+        if (parentFd >= 0) {
+            int fd = openat(parentFd, "cgroup.subtree_control", O_WRONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                if (write(fd, limitControllers[i], strlen(limitControllers[i])) < 0) {
+                    // reported below
+                }
+                close(fd);
+            }
+        }
+        if (cgroupWrite(pl->groupFd, limitFiles[i], limits[i]) != 0) {
+            if (parentFd >= 0) {
+                close(parentFd);
+            }
+            return -1;
+        }
+    }
+    if (parentFd >= 0) {
+        close(parentFd);
+    }
+    pl->procsFd = openat(pl->groupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (pl->procsFd < 0) {
+        fprintf(stderr, "limit: %s/cgroup.procs: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+//+
+// Function:	parsePlacement
+//
+// Purpose:	Parse the options of a limit prefix and prepare the
+//		placement: make the group and write its limits.
+//
+// Parameters:
+//	args[]	- The command line, starting with limit.
+//	nargs	- Number of arguments.
+//	pl	- The placement to fill in.
+//
+// Returns	int
+//		number of arguments used (limit and its options), or -1
+//		(with a message) on error.
+//-
+
+int parsePlacement(char *args[], int nargs, struct placement *pl) {
+    char *group = NULL;
+    char *limits[3] = {NULL, NULL, NULL};
+    char cpuMax[64];
+    int i;
+
+    memset(pl, 0, sizeof(*pl));
+    pl->groupFd = -1;
+    pl->procsFd = -1;
+
+    for (i = 1; i < nargs && args[i][0] == '-' && !isOperator(args[i], NULL); i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (args[i][1] == '\0' || args[i][2] != '\0' || i + 1 >= nargs) {
+            break;
+        }
+        char *value = args[++i];
+        switch (args[i - 1][1]) {
+        case 'g':
+            group = value;
+            break;
+        case 'c':
+            if (value[0] != '\0' && value[strlen(value) - 1] == '%') {
+                // percent of one CPU over the default 100ms period
+                snprintf(cpuMax, sizeof(cpuMax), "%ld 100000", (long) (atof(value) * 1000));
+                value = cpuMax;
+            }
+            limits[0] = value;
+            break;
+        case 'm':
+            limits[1] = value;
+            break;
+        case 'i':
+            limits[2] = value;
+            break;
+        case 'a':
+            if (parseIdList(value, (unsigned long *) &pl->cpus, CPU_SETSIZE) != 0) {
+                fprintf(stderr, "limit: bad CPU list %s\n", value);
+                return -1;
+            }
+            pl->useAffinity = 1;
+            break;
+        case 'n':
+        case 'I':
+            if (parseIdList(value, pl->nodes, PLACE_MAX_NODES) != 0) {
+                fprintf(stderr, "limit: bad node list %s\n", value);
+                return -1;
+            }
+            pl->memPolicy = (args[i - 1][1] == 'n') ? MPOL_BIND : MPOL_INTERLEAVE;
+            break;
+        default:
+            i--;
+            goto usage;
+        }
+    }
+    if (i >= nargs || isOperator(args[i], NULL)) {
+        goto usage;
+    }
+    if (group == NULL && (limits[0] || limits[1] || limits[2])) {
+        fprintf(stderr, "limit: -c, -m and -i need a group (-g)\n");
+        return -1;
+    }
+    if (group != NULL && openGroup(group, limits, pl) != 0) {
+        releasePlacement(pl);
+        return -1;
+    }
+    return i;
+
+usage:
+    fprintf(stderr, "usage: limit [-g group [-c cpu] [-m memory] [-i io]] [-a cpus] [-n|-I nodes] command\n");
+    return -1;
+}
+
+//+
+// Function:	releasePlacement
+//
+// Purpose:	Close what parsePlacement opened. The group stays, with
+//		any processes still running in it.
+//
+// Parameters:
+//	pl	- The placement.
+//
+// Returns	void
+//-
+
+void releasePlacement(struct placement *pl) {
+    if (pl->groupFd >= 0) {
+        close(pl->groupFd);
+    }
+    if (pl->procsFd >= 0) {
+        close(pl->procsFd);
+    }
+    pl->groupFd = pl->procsFd = -1;
+}
+
+//+
+// Function:	placeChild
+//
+// Purpose:	In a new child, apply the placement: join the group if
+//		the child wasn't created in it, then set the affinity and
+//		the memory policy. Makes only system calls, so it is safe
+//		in a vfork child.
+//
+// Parameters:	(none; uses launchPlacement)
+//
+// Returns	int
+//		0 on success, -1 (with a message) on error.
+//-
+
+int placeChild(void) {
+    struct placement *pl = launchPlacement;
+    static const char msgGroup[] = "limit: can't join the group\n";
+    static const char msgAffinity[] = "limit: can't set the CPU affinity\n";
+    static const char msgPolicy[] = "limit: can't set the memory policy\n";
+
+    if (pl->procsFd >= 0 && write(pl->procsFd, "0", 1) < 0) {
+        write(2, msgGroup, sizeof(msgGroup) - 1);
+        return -1;
+    }
+    if (pl->useAffinity && sched_setaffinity(0, sizeof(pl->cpus), &pl->cpus) != 0) {
+        write(2, msgAffinity, sizeof(msgAffinity) - 1);
+        return -1;
+    }
+    if (pl->memPolicy != 0
+            && syscall(SYS_set_mempolicy, pl->memPolicy, pl->nodes, PLACE_MAX_NODES) != 0) {
+        write(2, msgPolicy, sizeof(msgPolicy) - 1);
+        return -1;
+    }
+    return 0;
+}
+
+//+
+// Function:	launchPlaced
+//
+// Purpose:	Start an external command with launchPlacement applied.
+//		Used by launchCommand instead of the launch method.
+//
+// Parameters:
+//	cmdPath	- Full path to the executable.
+//	args[]	- Null terminated argument array for the command.
+//	childFd[]	- As for launchCommand.
+//
+// Returns	pid_t
+//		process id of the child, or -1 if it could not be started.
+//-
+
+pid_t launchPlaced(char *cmdPath, char *args[], int childFd[3]) {
+    struct placement *pl = launchPlacement;
+    pid_t pid = -1;
+
+#ifdef SYS_clone3
+    if (pl->groupFd >= 0 && cloneIntoCgroup) {
+        struct cloneArgs ca;
+        memset(&ca, 0, sizeof(ca));
+        ca.flags = CLONE_INTO_CGROUP;
+        ca.exitSignal = SIGCHLD;
+        ca.cgroup = pl->groupFd;
+        // like fork, but the child starts in the group
+        pid = syscall(SYS_clone3, &ca, sizeof(ca));
+        if (pid == 0) {
+            pl->procsFd = -1;
+            if (placeChild() != 0) {
+                _exit(126);
+            }
+            setupChildFds(childFd);
+            execv(cmdPath, args);
+            perror(cmdPath);
+            _exit(127);
+        }
+        if (pid > 0) {
+            return pid;
+        }
+        // the child is moved in instead, from now on if the kernel
+        // has no clone3 or no CLONE_INTO_CGROUP
+        if (errno == ENOSYS || errno == E2BIG || errno == EINVAL) {
+            cloneIntoCgroup = 0;
+        }
+    }
+#endif
+
+    volatile int execErr = 0;
+    pid = vfork();
+    if (pid == 0) {
+        if (placeChild() != 0) {
+            _exit(126);
+        }
+        setupChildFds(childFd);
+        execv(cmdPath, args);
+        execErr = errno;
+        _exit(127);
+    } else if (pid < 0) {
+        perror("vfork");
+        return -1;
+    }
+    if (execErr != 0) {
+        fprintf(stderr, "%s: %s\n", cmdPath, strerror(execErr));
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+////////////////////////////// Jobs ///////////////////////////////////
+
+// longest command name kept for statistics
+#define STATS_NAME_LEN 32
+
+// a process of a job
+struct jobProc {
+    pid_t	pid;		// 0 once reaped
+    char	cmdName[STATS_NAME_LEN];	// last part of args[0]
+};
+
+// a command line that has been started, with one process
+// for each stage of the pipeline.
+struct job {
+    int		jobId;
+    int		background;
+    int		numProcs;	// processes started
+    int		numLive;	// processes not yet reaped
+    int		maxProcs;	// size of procs[]
+    struct jobProc *	procs;
+    int		status;		// wait status of the last stage
+    struct timespec	start;	// when the job was created
+    struct rusage	usage;	// summed over the reaped processes
+    char *	cmdText;
+};
+
+// jobs indexed by jobId - 1, NULL if the id is free
+struct job ** jobTable = NULL;
+int jobTableSize = 0;
+
+// exit status of the last foreground command
+int lastStatus = 0;
+
+// resource usage of the foreground jobs waited for, summed for
+// the time prefix
+struct rusage foregroundUsage;
+
+// written by the SIGCHLD handler so that the read loop in main
+// wakes up and reaps children as soon as they exit.
+int sigChldPipe[2] = {-1, -1};
+
+//+
+// Function:	sigChldHandler
+//
+// Purpose:	SIGCHLD handler. Only writes to the self pipe, the
+//		children are reaped by the read loop.
+//
+// Parameters:
+//	sig	- The signal number (not used).
+//
+// Returns	void
+//-
+
+void sigChldHandler(int sig) {
+    int savedErrno = errno;
+    // the pipe is non-blocking, if it is full a wakeup is pending anyway
+    write(sigChldPipe[1], "", 1);
+    errno = savedErrno;
+}
+
+//+
+// Function:	initJobs
+//
+// Purpose:	Create the self pipe and install the SIGCHLD handler.
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void initJobs(void) {
+    if (pipe2(sigChldPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigChldHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+//+
+// Function:	newJob
+//
+// Purpose:	Create a job and give it the lowest free job number.
+//		The command text is rebuilt from the arguments.
+//
+// Parameters:
+//	args[]	- The arguments of the command line.
+//	nargs	- Number of arguments.
+//	background	- 1 if the job runs in the background.
+//
+// Returns	struct job *
+//		the new job (exits the shell if out of memory).
+//-
+
+struct job * newJob(char *args[], int nargs, int background) {
+    int slot;
+    for (slot = 0; slot < jobTableSize && jobTable[slot] != NULL; slot++);
+    if (slot == jobTableSize) {
+        int newSize = jobTableSize ? 2 * jobTableSize : 16;
+        struct job **newTable = realloc(jobTable, newSize * sizeof(struct job *));
+        if (newTable == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        memset(newTable + jobTableSize, 0, (newSize - jobTableSize) * sizeof(struct job *));
+        jobTable = newTable;
+        jobTableSize = newSize;
+    }
+
+    size_t textLen = 0;
+    for (int i = 0; i < nargs; i++) {
+        textLen += strlen(args[i]) + 1;
+    }
+    struct job *job = calloc(1, sizeof(struct job) + textLen + 1);
+    if (job == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    job->cmdText = (char *) (job + 1);
+    char *text = job->cmdText;
+    for (int i = 0; i < nargs; i++) {
+        if (i > 0) {
+            *text++ = ' ';
+        }
+        text = stpcpy(text, args[i]);
+    }
+
+    job->jobId = slot + 1;
+    job->background = background;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    jobTable[slot] = job;
+    return job;
+}
+
+//+
+// Function:	addJobProcess
+//
+// Purpose:	Record a process started for a job.
+//
+// Parameters:
+//	job	- The job.
+//	pid	- The process id of the new process.
+//	cmdName	- The command it runs (args[0]), for statistics.
+//
+// Returns	void
+//-
+
+void addJobProcess(struct job *job, pid_t pid, const char *cmdName) {
+    if (job->numProcs == job->maxProcs) {
+        int newMax = job->maxProcs ? 2 * job->maxProcs : 4;
+        struct jobProc *newProcs = realloc(job->procs, newMax * sizeof(struct jobProc));
+        if (newProcs == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        job->procs = newProcs;
+        job->maxProcs = newMax;
+    }
+    struct jobProc *proc = &job->procs[job->numProcs++];
+    const char *slash = strrchr(cmdName, '/');
+    proc->pid = pid;
+    snprintf(proc->cmdName, sizeof(proc->cmdName), "%s", slash ? slash + 1 : cmdName);
+    job->numLive++;
+}
+
+//+
+// Function:	freeJob
+//
+// Purpose:	Remove a job from the job table and free it.
+//
+// Parameters:
+//	job	- The job.
+//
+// Returns	void
+//-
+
+void freeJob(struct job *job) {
+    jobTable[job->jobId - 1] = NULL;
+    free(job->procs);
+    free(job);
+}
+
+//+
+// Function:	exitCode
+//
+// Purpose:	Convert a wait status to a shell exit code.
+//
+// Parameters:
+//	status	- The status returned by waitpid.
+//
+// Returns	int
+//		the exit value, or 128 plus the signal number if the
+//		process was killed by a signal.
+//-
+
+int exitCode(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+//+
+// Function:	addUsage
+//
+// Purpose:	Add one rusage to another. Times and counts are summed,
+//		the maximum resident set size is the larger of the two.
+//
+// Parameters:
+//	total	- The sum.
+//	ru	- The usage to add.
+//
+// Returns	void
+//-
+
+void addUsage(struct rusage *total, const struct rusage *ru) {
+    timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+    if (ru->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = ru->ru_maxrss;
+    }
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+//+
+// Function:	reapChildren
+//
+// Purpose:	Reap exited children with wait4 and record their status
+//		and resource usage in their jobs and in the per-command
+//		statistics. Every child is collected through this function,
+//		so a wait never loses another job's status.
+//
+// Parameters:
+//	options	- 0 to block until at least one child exits, or WNOHANG.
+//
+// Returns	int
+//		the number of children reaped.
+//-
+
+int reapChildren(int options) {
+    int numReaped = 0;
+    int status;
+    struct rusage ru;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, options, &ru)) > 0) {
+        numReaped++;
+        // after the first, collect the rest without blocking
+        options |= WNOHANG;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        for (int j = 0; j < jobTableSize; j++) {
+            struct job *job = jobTable[j];
+            if (job == NULL) {
+                continue;
+            }
+            for (int i = 0; i < job->numProcs; i++) {
+                if (job->procs[i].pid == pid) {
+                    job->procs[i].pid = 0;
+                    job->numLive--;
+                    // the last stage gives the status of a pipeline
+                    if (i == job->numProcs - 1) {
+                        job->status = status;
+                    }
+                    addUsage(&job->usage, &ru);
+                    double wall = (now.tv_sec - job->start.tv_sec) + (now.tv_nsec - job->start.tv_nsec) / 1e9;
+                    recordStats(job->procs[i].cmdName, wall, &ru);
+                    goto next;
+                }
+            }
+        }
+    next:
+        ;
+    }
+    return numReaped;
+}
+
+//+
+// Function:	waitForJob
+//
+// Purpose:	Wait until every process of a job has exited, set the
+//		exit status of the last command, and free the job.
+//
+// Parameters:
+//	job	- The job.
+//
+// Returns	void
+//-
+
+void waitForJob(struct job *job) {
+    while (job->numLive > 0) {
+        if (reapChildren(0) == 0) {
+            // no children left, should not happen
+            break;
+        }
+    }
+    lastStatus = exitCode(job->status);
+    addUsage(&foregroundUsage, &job->usage);
+    freeJob(job);
+}
+
+//+
+// Function:	printTimes
+//
+// Purpose:	Report the cost of a timed command on stderr: wall clock
+//		time, then user and system time, peak memory and context
+//		switches of the shell itself plus the foreground jobs it
+//		waited for.
+//
+// Parameters:
+//	timeStart	- Monotonic time when the command started.
+//	selfStart	- The shell's own usage when the command started.
+//
+// Returns	void
+//-
+
+void printTimes(struct timespec *timeStart, struct rusage *selfStart) {
+    struct timespec now;
+    struct rusage self, total;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &self);
+
+    // what the shell used running the command (e.g. a builtin)
+    total = foregroundUsage;
+    timersub(&self.ru_utime, &selfStart->ru_utime, &self.ru_utime);
+    timersub(&self.ru_stime, &selfStart->ru_stime, &self.ru_stime);
+    self.ru_nvcsw -= selfStart->ru_nvcsw;
+    self.ru_nivcsw -= selfStart->ru_nivcsw;
+    self.ru_maxrss = 0;
+    addUsage(&total, &self);
+
+    double real = (now.tv_sec - timeStart->tv_sec) + (now.tv_nsec - timeStart->tv_nsec) / 1e9;
+    fflush(stdout);
+    fprintf(stderr, "\nreal\t%dm%.3fs\n", (int) (real / 60), real - 60 * (int) (real / 60));
+    fprintf(stderr, "user\t%ldm%ld.%03lds\n", (long) total.ru_utime.tv_sec / 60,
+            (long) total.ru_utime.tv_sec % 60, (long) total.ru_utime.tv_usec / 1000);
+    fprintf(stderr, "sys\t%ldm%ld.%03lds\n", (long) total.ru_stime.tv_sec / 60,
+            (long) total.ru_stime.tv_sec % 60, (long) total.ru_stime.tv_usec / 1000);
+    fprintf(stderr, "maxrss\t%ldkB\n", total.ru_maxrss);
+    fprintf(stderr, "csw\t%ld voluntary, %ld involuntary\n", total.ru_nvcsw, total.ru_nivcsw);
+}
+
+//+
+// Function:	jobState
+//
+// Purpose:	Describe the state of a job for jobs and notices.
+//
+// Parameters:
+//	job	- The job.
+//	buf	- Buffer for the description.
+//	bufLen	- Size of the buffer.
+//
+// Returns	char *
+//		buf
+//-
+
+char * jobState(struct job *job, char *buf, size_t bufLen) {
+    if (job->numLive > 0) {
+        snprintf(buf, bufLen, "Running");
+    } else if (WIFSIGNALED(job->status)) {
+        snprintf(buf, bufLen, "%s", strsignal(WTERMSIG(job->status)));
+    } else if (WEXITSTATUS(job->status) != 0) {
+        snprintf(buf, bufLen, "Exit %d", WEXITSTATUS(job->status));
+    } else {
+        snprintf(buf, bufLen, "Done");
+    }
+    return buf;
+}
+
+//+
+// Function:	notifyJobs
+//
+// Purpose:	Report background jobs that have finished and remove
+//		them from the job table.
+//
+// Parameters:	(none)
+//
+// Returns	int
+//		the number of jobs reported.
+//-
+
+int notifyJobs(void) {
+    int numReported = 0;
+    char state[64];
+
+    for (int j = 0; j < jobTableSize; j++) {
+        struct job *job = jobTable[j];
+        if (job != NULL && job->background && job->numLive == 0) {
+            // scripts don't report finished jobs
+            if (interactive) {
+                printf("[%d]  %-24s%s\n", job->jobId, jobState(job, state, sizeof(state)), job->cmdText);
+                numReported++;
+            }
+            freeJob(job);
+        }
+    }
+    return numReported;
+}
+
+//+
+// Function:	findJob
+//
+// Purpose:	Find the background job named by a job spec.
+//
+// Parameters:
+//	spec	- %n or n for job n, NULL for the most recent job.
+//	cmdName	- Name of the builtin, for error messages.
+//
+// Returns	struct job *
+//		the job, or NULL (with a message) if there is no such job.
+//-
+
+struct job * findJob(const char *spec, const char *cmdName) {
+    if (spec == NULL) {
+        for (int j = jobTableSize - 1; j >= 0; j--) {
+            if (jobTable[j] != NULL && jobTable[j]->background) {
+                return jobTable[j];
+            }
+        }
+        fprintf(stderr, "%s: no current job\n", cmdName);
+        return NULL;
+    }
+
+    char *end;
+    long id = strtol(spec + (spec[0] == '%'), &end, 10);
+    if (*end == '\0' && id >= 1 && id <= jobTableSize && jobTable[id - 1] != NULL
+            && jobTable[id - 1]->background) {
+        return jobTable[id - 1];
+    }
+    fprintf(stderr, "%s: %s: no such job\n", cmdName, spec);
+    return NULL;
+}
+
+////////////////////////////// Pipelines ///////////////////////////////////
+
+//+
+// Function:	startBuiltinStage
+//
+// Purpose:	Run an internal command as one stage of a pipeline. The
+//		command runs in a forked copy of the shell so that it can
+//		read and write the pipes concurrently with the other stages.
+//
+// Parameters:
+//	args[]	- Null terminated arguments for the stage.
+//	nargs	- Number of arguments.
+//	childFd[]	- descriptors for the stage's stdin, stdout and stderr.
+//
+// Returns	pid_t
+//		process id of the child, or -1 if it could not be started.
+//-
+
+pid_t startBuiltinStage(char *args[], int nargs, int childFd[3]) {
+    // don't let the child repeat anything still buffered
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (launchPlacement != NULL && placeChild() != 0) {
+            _exit(126);
+        }
+        setupChildFds(childFd);
+        doInternalCommand(args, nargs);
+        fflush(stdout);
+        _exit(0);
+    } else if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+//+
+// Function:	countStages
+//
+// Purpose:	Count the stages of a pipeline.
+//
+// Parameters:
+//	args[]	- Array of arguments, stages separated by "|".
+//	nargs	- Number of arguments in the args array.
+//
+// Returns	int
+//		the number of stages (1 if there is no |)
+//-
+
+int countStages(char *args[], int nargs) {
+    int numStages = 1;
+    for (int i = 0; i < nargs; i++) {
+        if (isOperator(args[i], "|")) {
+            numStages++;
+        }
+    }
+    return numStages;
+}
+
+//+
+// Function:	doPipeline
+//
+// Purpose:	Run a command line as a job, one process per stage. Every
+//		stage is started before any is waited for, so all of them
+//		run concurrently, connected by close-on-exec pipes. A
+//		foreground job is waited for until every stage is reaped.
+//
+// Parameters:
+//	args[]	- Array of arguments, stages separated by "|".
+//	nargs	- Number of arguments in the args array.
+//	background	- 1 to return without waiting for the job.
+//
+// Returns	int
+//		1 = the job was started
+//		0 = syntax error, nothing was run
+//-
+
+int doPipeline(char *args[], int nargs, int background) {
+    int numStages = countStages(args, nargs);
+
+    // split into stages in place, each "|" becomes the null
+    // that terminates the argument list of the stage before it
+    int stageStart[numStages];
+    int stageArgs[numStages];
+    int stage = 0;
+    stageStart[0] = 0;
+    for (int i = 0; i <= nargs; i++) {
+        if (i == nargs || isOperator(args[i], "|")) {
+            stageArgs[stage] = i - stageStart[stage];
+            if (stageArgs[stage] == 0) {
+                fprintf(stderr, "syntax error near '|'\n");
+                return 0;
+            }
+            if (i < nargs) {
+                stageStart[++stage] = i + 1;
+            }
+        }
+    }
+    struct job *job = newJob(args, nargs, background);
+    for (stage = 1; stage < numStages; stage++) {
+        args[stageStart[stage] - 1] = NULL;
+    }
+
+    int prevRead = -1;
+    pid_t lastPid = -1;
+    for (stage = 0; stage < numStages; stage++) {
+        char **stageArgv = &args[stageStart[stage]];
+        struct redirection redir = {{prevRead, -1, -1}, 0, NULL};
+        int pipeFds[2] = {-1, -1};
+
+        if (stage < numStages - 1) {
+            if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+                perror("pipe");
+                break;
+            }
+            if (pipeSize > 0 && fcntl(pipeFds[1], F_SETPIPE_SZ, pipeSize) < 0) {
+                perror("F_SETPIPE_SZ");
+            }
+            redir.childFd[1] = pipeFds[1];
+        }
+
+        pid_t pid = -1;
+        char *cmdPath;
+        if (parseRedirections(stageArgv, &stageArgs[stage], &redir) != 0) {
+            // message already printed
+        } else if (stageArgs[stage] == 0) {
+            // only redirections, like > file
+        } else if (findInternalCommand(stageArgv[0]) != NULL) {
+            pid = startBuiltinStage(stageArgv, stageArgs[stage], redir.childFd);
+        } else if ((cmdPath = findCommand(stageArgv[0])) != NULL) {
+            pid = launchCommand(cmdPath, stageArgv, redir.childFd);
+        } else {
+            fprintf(stderr, "%s: command not found\n", stageArgv[0]);
+        }
+        closeRedirections(&redir);
+        if (pid > 0) {
+            addJobProcess(job, pid, stageArgv[0]);
+            lastPid = pid;
+        } else if (stage == numStages - 1) {
+            // the last stage gives the status, report the failure
+            job->status = 127 << 8;
+        }
+
+        // the children have their copies, close ours
+        if (prevRead >= 0) {
+            close(prevRead);
+        }
+        if (pipeFds[1] >= 0) {
+            close(pipeFds[1]);
+        }
+        prevRead = pipeFds[0];
+    }
+    if (prevRead >= 0) {
+        close(prevRead);
+    }
+
+    if (background && job->numLive > 0) {
+        if (interactive) {
+            printf("[%d] %d\n", job->jobId, (int) lastPid);
+        }
+    } else {
+        waitForJob(job);
+    }
+    return 1;
+}
+
+////////////////////////////// Statistics ///////////////////////////////////
+
+// latency histogram buckets, bucket i counts commands that took
+// less than 2^i microseconds (the last bucket takes the rest)
+#define STATS_BUCKETS 32
+#define STATS_HASH_SIZE 256
+
+// what the external commands with one name have cost this session
+struct cmdStats {
+    struct cmdStats *	next;
+    unsigned int	hashVal;
+    char		cmdName[STATS_NAME_LEN];
+    long		count;
+    double		wallTotal;	// seconds
+    double		wallMax;
+    struct rusage	usage;		// summed, max for ru_maxrss
+    long		histogram[STATS_BUCKETS];
+};
+
+struct cmdStats * statsTable[STATS_HASH_SIZE];
+
+//+
+// Function:	recordStats
+//
+// Purpose:	Add one finished process to the statistics of its command.
+//
+// Parameters:
+//	cmdName	- The command name.
+//	wall	- Wall clock time from start to reaping, in seconds.
+//	ru	- Resource usage from wait4.
+//
+// Returns	void
+//-
+
+void recordStats(const char *cmdName, double wall, const struct rusage *ru) {
+    unsigned int h = hashString(cmdName);
+    struct cmdStats *st;
+
+    for (st = statsTable[h % STATS_HASH_SIZE]; st != NULL; st = st->next) {
+        if (st->hashVal == h && strcmp(st->cmdName, cmdName) == 0) {
+            break;
+        }
+    }
+    if (st == NULL) {
+        st = calloc(1, sizeof(struct cmdStats));
+        if (st == NULL) {
+            return;
+        }
+        st->hashVal = h;
+        snprintf(st->cmdName, sizeof(st->cmdName), "%s", cmdName);
+        st->next = statsTable[h % STATS_HASH_SIZE];
+        statsTable[h % STATS_HASH_SIZE] = st;
+    }
+
+    st->count++;
+    st->wallTotal += wall;
+    if (wall > st->wallMax) {
+        st->wallMax = wall;
+    }
+    addUsage(&st->usage, ru);
+
+    int bucket = 0;
+    for (double us = wall * 1e6; us >= 1.0 && bucket < STATS_BUCKETS - 1; us /= 2) {
+        bucket++;
+    }
+    st->histogram[bucket]++;
+}
+
+//+
+// Function:	statsPercentile
+//
+// Purpose:	Estimate a latency percentile from a histogram, as the
+//		upper edge of the bucket it falls in (at most the maximum).
+//
+// Parameters:
+//	st	- The statistics of a command.
+//	pct	- The percentile, 0 to 100.
+//
+// Returns	double
+//		the latency in seconds
+//-
+
+double statsPercentile(struct cmdStats *st, double pct) {
+    long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += st->histogram[i];
+        if (seen * 100.0 >= pct * st->count) {
+            double edge = (1L << i) / 1e6;
+            return (i == STATS_BUCKETS - 1 || edge > st->wallMax) ? st->wallMax : edge;
+        }
+    }
+    return st->wallMax;
+}
+
+//+
+// Function:	formatSeconds
+//
+// Purpose:	Format a time with a unit that suits its size.
+//
+// Parameters:
+//	secs	- The time in seconds.
+//	buf	- Buffer for the text.
+//	bufLen	- Size of the buffer.
+//
+// Returns	char *
+//		buf
+//-
+
+char * formatSeconds(double secs, char *buf, size_t bufLen) {
+    if (secs < 1e-3) {
+        snprintf(buf, bufLen, "%.0fus", secs * 1e6);
+    } else if (secs < 1.0) {
+        snprintf(buf, bufLen, "%.1fms", secs * 1e3);
+    } else {
+        snprintf(buf, bufLen, "%.2fs", secs);
+    }
+    return buf;
+}
+
+//+
+// Function:	printHistogram
+//
+// Purpose:	Print the latency histogram of a command, one bar per
+//		non-empty bucket.
+//
+// Parameters:
+//	st	- The statistics of the command.
+//
+// Returns	void
+//-
+
+void printHistogram(struct cmdStats *st) {
+    char low[16], high[16];
+    long most = 0;
+    int first = STATS_BUCKETS, last = 0;
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        if (st->histogram[i] > 0) {
+            most = st->histogram[i] > most ? st->histogram[i] : most;
+            first = i < first ? i : first;
+            last = i;
+        }
+    }
+    printf("%s: %ld runs\n", st->cmdName, st->count);
+    for (int i = first; i <= last; i++) {
+        int bar = (int) (40 * st->histogram[i] / most);
+        formatSeconds(i == 0 ? 0 : (1L << (i - 1)) / 1e6, low, sizeof(low));
+        formatSeconds((1L << i) / 1e6, high, sizeof(high));
+        printf("  %8s - %-8s |%-40.*s %ld\n", low, high, bar,
+               "########################################", st->histogram[i]);
+    }
+}
+
+////////////////////////////// History ///////////////////////////////////
+
+// The history is an append-only log of command lines, one per line,
+// plus an index file so that it never has to be parsed. Both are
+// mapped when first needed. The index holds the offset of every entry
+// in blocks of HIST_BLOCK_ENTRIES, and for each block a bloom filter
+// of the trigrams of its entries, so a search only reads the blocks
+// that can match. Shells append under an exclusive flock on the index,
+// each adding its line with one O_APPEND write and then indexing
+// whatever the log has gained, its own line and any others. Other
+// shells change the index once the lock is dropped, so entries are
+// looked up only as far as this shell last indexed, which never
+// changes under it, and a rebuild clears the index in place rather
+// than truncating it under another shell's mapping.
+
+#define HIST_MAGIC 0x31584948		// "HIX1"
+#define HIST_BLOCK_ENTRIES 256
+#define HIST_BLOOM_BITS 32768
+#define HIST_SHOW_DEFAULT 16
+// blocks added to the index file at a time
+#define HIST_GROW_BLOCKS 16
+
+struct histHeader {
+    uint32_t	magic;
+    uint32_t	blockEntries;	// HIST_BLOCK_ENTRIES when written
+    uint64_t	numEntries;
+    uint64_t	logSize;	// bytes of the log that are indexed
+    uint64_t	reserved[5];
+};
+
+struct histBlock {
+    uint64_t	offset[HIST_BLOCK_ENTRIES];
+    uint64_t	bloom[HIST_BLOOM_BITS / 64];
+};
+
+struct history {
+    int			state;		// 0 not opened, 1 open, -1 unavailable
+    int			logFd;
+    int			indexFd;
+    const char *	log;		// mapping of the log
+    size_t		logSize;	// bytes in the log file
+    size_t		logMapped;	// bytes mapped, past the end of the file
+    struct histHeader *	index;		// mapping of the index file
+    size_t		indexMapped;
+    // the index as of the last time this shell held the lock
+    uint64_t		numEntries;
+    uint64_t		indexedSize;	// bytes of the log indexed
+};
+
+struct history hist = {0, -1, -1, NULL, 0, 0, NULL, 0, 0, 0};
+
+//+
+// Function:	histBlocks
+//
+// Purpose:	Get the blocks of the index, which follow the header.
+//
+// Parameters:	(none)
+//
+// Returns	struct histBlock *
+//		the first block
+//-
+
+struct histBlock * histBlocks(void) {
+    return (struct histBlock *) (hist.index + 1);
+}
+
+//+
+// Function:	histRemap
+//
+// Purpose:	Map the log and the index again if their sizes have
+//		changed since they were mapped. The log is mapped with room
+//		to grow, twice its size, so appending a line only needs a
+//		new mapping when it passes the end of the old one.
+//
+// Parameters:	(none)
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int histRemap(void) {
+    struct stat logStat, indexStat;
+
+    if (fstat(hist.logFd, &logStat) != 0 || fstat(hist.indexFd, &indexStat) != 0) {
+        return -1;
+    }
+    // only the first logSize bytes are read, so a mapping past the
+    // end of the file (or of a log another shell truncated) is safe
+    hist.logSize = logStat.st_size;
+    if (hist.logSize > hist.logMapped) {
+        if (hist.log != NULL) {
+            munmap((void *) hist.log, hist.logMapped);
+        }
+        hist.log = NULL;
+        hist.logMapped = 2 * hist.logSize < 65536 ? 65536 : 2 * hist.logSize;
+        void *map = mmap(NULL, hist.logMapped, PROT_READ, MAP_SHARED, hist.logFd, 0);
+        if (map == MAP_FAILED) {
+            hist.logMapped = 0;
+            hist.logSize = 0;
+            return -1;
+        }
+        hist.log = map;
+    }
+    if ((size_t) indexStat.st_size != hist.indexMapped) {
+        if (hist.index != NULL) {
+            munmap(hist.index, hist.indexMapped);
+        }
+        hist.index = NULL;
+        hist.indexMapped = indexStat.st_size;
+        if (hist.indexMapped > 0) {
+            void *map = mmap(NULL, hist.indexMapped, PROT_READ | PROT_WRITE, MAP_SHARED, hist.indexFd, 0);
+            if (map == MAP_FAILED) {
+                hist.indexMapped = 0;
+                return -1;
+            }
+            hist.index = map;
+        }
+    }
+    return 0;
+}
+
+//+
+// Function:	histTrigram
+//
+// Purpose:	Hash three characters to a bit of a block's bloom filter.
+//
+// Parameters:
+//	text	- Points at the three characters.
+//
+// Returns	unsigned int
+//		the bit number
+//-
+
+unsigned int histTrigram(const char *text) {
+    const unsigned char *t = (const unsigned char *) text;
+    uint32_t tri = (t[0] << 16) | (t[1] << 8) | t[2];
+    return (tri * 2654435761u) >> (32 - 15);
+}
+
+//+
+// Function:	histIndexTail
+//
+// Purpose:	Index the lines added to the log since it was last
+//		indexed, and note how far the index goes. A missing or
+//		damaged index (or a log that has shrunk) is rebuilt from
+//		the start. Must be called with the exclusive lock held.
+//
+// Parameters:	(none)
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int histIndexTail(void) {
+    if (histRemap() != 0) {
+        return -1;
+    }
+    if (hist.indexMapped < sizeof(struct histHeader) || hist.index->magic != HIST_MAGIC
+            || hist.index->blockEntries != HIST_BLOCK_ENTRIES || hist.index->logSize > hist.logSize) {
+        hist.numEntries = 0;
+        hist.indexedSize = 0;
+        struct histHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = HIST_MAGIC;
+        header.blockEntries = HIST_BLOCK_ENTRIES;
+        if (hist.indexMapped >= sizeof(struct histHeader)) {
+            // cleared, not truncated, so other shells' mappings stay valid
+            memset(hist.index, 0, hist.indexMapped);
+            *hist.index = header;
+        } else if (pwrite(hist.indexFd, &header, sizeof(header), 0) != sizeof(header) || histRemap() != 0) {
+            return -1;
+        }
+    }
+
+    uint64_t pos = hist.index->logSize;
+    const char *newline;
+    while (pos < hist.logSize && (newline = memchr(hist.log + pos, '\n', hist.logSize - pos)) != NULL) {
+        uint64_t n = hist.index->numEntries;
+        size_t needed = sizeof(struct histHeader) + (n / HIST_BLOCK_ENTRIES + 1) * sizeof(struct histBlock);
+        if (needed > hist.indexMapped) {
+            // new blocks read as zero, an empty bloom filter
+            if (ftruncate(hist.indexFd, needed + (HIST_GROW_BLOCKS - 1) * sizeof(struct histBlock)) != 0
+                    || histRemap() != 0) {
+                return -1;
+            }
+        }
+
+        struct histBlock *block = &histBlocks()[n / HIST_BLOCK_ENTRIES];
+        block->offset[n % HIST_BLOCK_ENTRIES] = pos;
+        for (const char *t = hist.log + pos; t + 3 <= newline; t++) {
+            unsigned int bit = histTrigram(t);
+            block->bloom[bit / 64] |= 1ull << (bit % 64);
+        }
+        pos = newline + 1 - hist.log;
+        hist.index->numEntries = n + 1;
+        hist.index->logSize = pos;
+    }
+    hist.numEntries = hist.index->numEntries;
+    hist.indexedSize = hist.index->logSize;
+    return 0;
+}
+
+//+
+// Function:	histOpen
+//
+// Purpose:	Open and map the history files the first time history is
+//		used. If they can't be opened history is turned off.
+//
+// Parameters:	(none)
+//
+// Returns	int
+//		1 if history is available, 0 if not.
+//-
+
+int histOpen(void) {
+    char logPath[CMD_BUFFSIZE], indexPath[CMD_BUFFSIZE + 8];
+
+    if (hist.state != 0) {
+        return hist.state > 0;
+    }
+    hist.state = -1;
+
+    const char *file = getenv("HISTFILE");
+    if (file == NULL || *file == '\0') {
+        const char *home = getenv("HOME");
+        struct passwd *pw;
+        if (home == NULL && (pw = getpwuid(getuid())) != NULL) {
+            home = pw->pw_dir;
+        }
+        if (home == NULL) {
+            return 0;
+        }
+        snprintf(logPath, sizeof(logPath), "%s/.shell_history", home);
+    } else {
+        snprintf(logPath, sizeof(logPath), "%s", file);
+    }
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", logPath);
+
+    hist.logFd = open(logPath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    hist.indexFd = open(indexPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (hist.logFd < 0 || hist.indexFd < 0) {
+        fprintf(stderr, "history: %s: %s\n", hist.logFd < 0 ? logPath : indexPath, strerror(errno));
+        return 0;
+    }
+    flock(hist.indexFd, LOCK_EX);
+    int err = histIndexTail();
+    flock(hist.indexFd, LOCK_UN);
+    if (err != 0) {
+        fprintf(stderr, "history: %s: %s\n", indexPath, strerror(errno));
+        return 0;
+    }
+    hist.state = 1;
+    return 1;
+}
+
+//+
+// Function:	histSync
+//
+// Purpose:	Pick up lines appended by other shells.
+//
+// Parameters:	(none)
+//
+// Returns	int
+//		1 if history is available, 0 if not.
+//-
+
+int histSync(void) {
+    if (!histOpen()) {
+        return 0;
+    }
+    flock(hist.indexFd, LOCK_EX);
+    histIndexTail();
+    flock(hist.indexFd, LOCK_UN);
+    return 1;
+}
+
+//+
+// Function:	histAdd
+//
+// Purpose:	Append a command line to the history. Blank lines, and
+//		lines starting with a space, are not kept.
+//
+// Parameters:
+//	line	- The command line.
+//
+// Returns	void
+//-
+
+void histAdd(const char *line) {
+    if (line[0] == ' ' || line[strspn(line, wordSpaces)] == '\0' || !histOpen()) {
+        return;
+    }
+    struct iovec iov[2] = {
+        {(void *) line, strlen(line)},
+        {"\n", 1}
+    };
+    flock(hist.indexFd, LOCK_EX);
+    // one write, so lines from different shells never interleave
+    if (writev(hist.logFd, iov, 2) < 0) {
+        perror("history");
+    }
+    histIndexTail();
+    flock(hist.indexFd, LOCK_UN);
+}
+
+//+
+// Function:	histEntry
+//
+// Purpose:	Find an entry of the history, as far as it was indexed
+//		when this shell last held the lock.
+//
+// Parameters:
+//	n	- Entry number, from 0.
+//	len	- Set to the length of the entry.
+//
+// Returns	const char *
+//		the text of the entry in the mapped log (not null
+//		terminated), or NULL if it is not in the index as this
+//		shell last saw it (a rebuild by another shell has moved it).
+//-
+
+const char * histEntry(uint64_t n, size_t *len) {
+    if (n >= hist.numEntries) {
+        return NULL;
+    }
+    struct histBlock *blocks = histBlocks();
+    uint64_t start = blocks[n / HIST_BLOCK_ENTRIES].offset[n % HIST_BLOCK_ENTRIES];
+    uint64_t end = (n + 1 < hist.numEntries)
+                 ? blocks[(n + 1) / HIST_BLOCK_ENTRIES].offset[(n + 1) % HIST_BLOCK_ENTRIES]
+                 : hist.indexedSize;
+    if (end <= start || end > hist.indexedSize) {
+        return NULL;
+    }
+    *len = end - start - 1;
+    return hist.log + start;
+}
+
+//+
+// Function:	histBlockMayMatch
+//
+// Purpose:	Checks a block's bloom filter for all the trigrams of a
+//		search string.
+//
+// Parameters:
+//	block	- The index block.
+//	bits[]	- The bloom bits of the string's trigrams.
+//	numBits	- Number of bits.
+//
+// Returns	int
+//		0 if no entry in the block contains the string, 1 if
+//		some entry may.
+//-
+
+int histBlockMayMatch(struct histBlock *block, unsigned int bits[], int numBits) {
+    for (int i = 0; i < numBits; i++) {
+        if (!(block->bloom[bits[i] / 64] & (1ull << (bits[i] % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//+
+// Function:	histFind
+//
+// Purpose:	Search the history from the newest entry back, skipping
+//		blocks whose bloom filter rules them out.
+//
+// Parameters:
+//	text	- The text to look for.
+//	prefix	- 1 if entries must start with text, 0 if they must
+//		  contain it.
+//	from	- Entry to start at (going back); entries before it are
+//		  searched.
+//
+// Returns	int64_t
+//		number of the newest matching entry before from, or -1.
+//-
+
+int64_t histFind(const char *text, int prefix, int64_t from) {
+    size_t textLen = strlen(text);
+    int numBits = textLen >= 3 ? textLen - 2 : 0;
+    unsigned int bits[numBits + 1];
+
+    for (int i = 0; i < numBits; i++) {
+        bits[i] = histTrigram(text + i);
+    }
+
+    int64_t n = (uint64_t) from <= hist.numEntries ? from - 1 : (int64_t) hist.numEntries - 1;
+    while (n >= 0) {
+        struct histBlock *block = &histBlocks()[n / HIST_BLOCK_ENTRIES];
+        if (!histBlockMayMatch(block, bits, numBits)) {
+            // skip to the last entry of the previous block
+            n = (n / HIST_BLOCK_ENTRIES) * HIST_BLOCK_ENTRIES - 1;
+            continue;
+        }
+        size_t len;
+        const char *entry = histEntry(n, &len);
+        if (entry != NULL && (prefix ? (len >= textLen && memcmp(entry, text, textLen) == 0)
+                                     : memmem(entry, len, text, textLen) != NULL)) {
+            return n;
+        }
+        n--;
+    }
+    return -1;
+}
+
+//+
+// Function:	histRecall
+//
+// Purpose:	Replace a command line starting with ! by the history
+//		entry it names, and echo it as other shells do.
+//
+// Parameters:
+//	line	- The command line, starting with !.
+//
+// Returns	char *
+//		the recalled line (in the line arena), or NULL (with a
+//		message) if there is no such entry.
+//-
+
+char * histRecall(const char *line) {
+    int64_t n = -1;
+    const char *spec = line + 1;
+
+    if (histSync() && hist.numEntries > 0) {
+        int64_t count = hist.numEntries;
+        char *end;
+        long num = strtol(spec, &end, 10);
+        if (strcmp(spec, "!") == 0) {
+            n = count - 1;
+        } else if (*spec != '\0' && *end == '\0') {
+            n = num < 0 ? count + num : num - 1;
+        } else if (*spec != '\0') {
+            n = histFind(spec, 1, count);
+        }
+        if (n >= count) {
+            n = -1;
+        }
+    }
+    size_t len;
+    const char *entry = n >= 0 ? histEntry(n, &len) : NULL;
+    if (entry == NULL) {
+        fprintf(stderr, "%s: event not found\n", line);
+        return NULL;
+    }
+
+    char *recalled = arenaAlloc(&lineArena, len + 1);
+    memcpy(recalled, entry, len);
+    recalled[len] = '\0';
+    printf("%s\n", recalled);
+    return recalled;
+}
+
+////////////////////////////// Scripts ///////////////////////////////////
+
+// Everything the shell runs is first compiled: a script as a whole,
+// an interactive or piped command once it is complete (a for, while
+// or if may take several lines). The program is flat: a header, an
+// array of instructions and a pool of strings, all referred to by
+// offset, so that it can be written to a file and mapped back in.
+// A script's program is cached in $XDG_CACHE_HOME/shell (default
+// ~/.cache/shell) and used as long as the script's size, mtime and
+// inode are unchanged, so running it again skips parsing entirely.
+// Loop bodies run from the compiled words; only words with $ or a
+// pattern are expanded on each pass.
+
+#define PROG_MAGIC 0x31424853		// "SHB1"
+#define PROG_VERSION 4
+
+// a word of the pool that is an operator: this and the index
+#define WORD_OPERATOR '\002'
+
+enum progOps {
+    OP_CMD,		// run the words
+    OP_SET,		// set variable words[0] to words[1]
+    OP_JUMP,		// go to target
+    OP_JUMPFALSE,	// go to target if the last command failed
+    OP_FORSTART,	// expand the words as the list of a for loop
+    OP_FORNEXT,		// set words[0] to the next item, or go to target
+    OP_FOREND,		// drop the list of the innermost for loop
+    OP_STATUS,		// set the status to target
+    OP_SAVESTATUS,	// keep the status in while slot target
+    OP_LOADSTATUS	// set the status from while slot target
+};
+
+struct progHeader {
+    uint32_t	magic;
+    uint32_t	version;
+    // the script the program came from, to check the cache
+    uint64_t	sourceSize;
+    int64_t	mtimeSec;
+    int64_t	mtimeNsec;
+    uint64_t	inode;
+    uint32_t	numInsns;
+    uint32_t	poolSize;
+    uint32_t	pathOff;	// offset in the pool of the script's path
+    uint32_t	reserved;
+};
+
+struct insn {
+    uint16_t	op;
+    uint16_t	reserved;
+    uint32_t	nwords;
+    uint32_t	words;		// pool offset of nwords word offsets
+    uint32_t	target;		// instruction to jump to
+};
+
+struct program {
+    char *		base;		// header, instructions, pool
+    size_t		size;
+    int			mapped;		// base is a mapping of a cache file
+    struct progHeader *	header;
+    struct insn *	insns;
+    char *		pool;
+};
+
+//+
+// Function:	runCommand
+//
+// Purpose:	Run one command line: handles the limit and time
+//		prefixes and a trailing &, then runs a pipeline, a
+//		builtin or an external command.
+//
+// Parameters:
+//	args[]	- The expanded arguments.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void runCommand(char *args[], int nargs) {
+    // limit places every process the command line starts
+    if (nargs > 0 && strcmp(args[0], "limit") == 0) {
+        int used = parsePlacement(args, nargs, &commandPlacement);
+        if (used < 0) {
+            lastStatus = 2;
+            return;
+        }
+        args += used;
+        nargs -= used;
+        launchPlacement = &commandPlacement;
+    }
+
+    // time before the command reports what it cost
+    struct timespec timeStart;
+    struct rusage selfStart;
+    int timed = nargs > 1 && strcmp(args[0], "time") == 0;
+    if (timed) {
+        args++;
+        nargs--;
+        memset(&foregroundUsage, 0, sizeof(foregroundUsage));
+        getrusage(RUSAGE_SELF, &selfStart);
+        clock_gettime(CLOCK_MONOTONIC, &timeStart);
+    }
+
+    if (nargs != 0) {
+        // a trailing & runs the command line in the background
+        int background = isOperator(args[nargs-1], "&");
+        if (background) {
+            args[--nargs] = NULL;
+        }
+        if (nargs == 0) {
+            fprintf(stderr, "syntax error near '&'\n");
+        } else if (background || launchPlacement != NULL || countStages(args, nargs) > 1) {
+            doPipeline(args, nargs, background);
+        } else if (doInternalCommand(args, nargs) == 0) {
+            if (doExternalCommand(args, nargs) == 0) {
+                fprintf(stderr, "%s: command not found\n", args[0]);
+                lastStatus = 127;
+            }
+        }
+    }
+    if (timed) {
+        printTimes(&timeStart, &selfStart);
+    }
+    if (launchPlacement != NULL) {
+        releasePlacement(launchPlacement);
+        launchPlacement = NULL;
+    }
+}
+
+// a command of the source: the words between newlines and ;
+struct srcCmd {
+    char **	words;
+    int		nwords;
+    int		line;
+};
+
+// the innermost loop being compiled
+struct loopInfo {
+    struct loopInfo *	outer;
+    uint32_t		continueTo;
+    int			breaks;		// chain of break jumps, through target
+};
+
+struct compiler {
+    const char *	name;		// script name for messages, or NULL
+    struct arena *	arena;		// the words of the source
+    struct srcCmd *	cmds;
+    int			numCmds;
+    int			maxCmds;
+    int			next;		// next command to compile
+    struct insn *	insns;
+    int			numInsns;
+    int			maxInsns;
+    char *		pool;
+    size_t		poolSize;
+    size_t		poolMax;
+    struct loopInfo *	loop;
+    int			whileDepth;	// while loops being compiled
+    int			incomplete;	// the source ended inside a construct
+};
+
+enum keywords {
+    KW_NONE, KW_IF, KW_THEN, KW_ELIF, KW_ELSE, KW_FI,
+    KW_WHILE, KW_FOR, KW_DO, KW_DONE, KW_BREAK, KW_CONTINUE
+};
+
+// keyword names in enum order, after KW_NONE
+const char * keywordNames[] = {
+    "", "if", "then", "elif", "else", "fi",
+    "while", "for", "do", "done", "break", "continue", NULL
+};
+
+//+
+// Function:	compileError
+//
+// Purpose:	Report a syntax error.
+//
+// Parameters:
+//	c	- The compiler.
+//	line	- Source line of the error.
+//	msg	- The message.
+//	word	- Word the error is about, or NULL.
+//
+// Returns	int
+//		-1
+//-
+
+int compileError(struct compiler *c, int line, const char *msg, const char *word) {
+    if (c->name != NULL) {
+        fprintf(stderr, "%s: line %d: ", c->name, line);
+    }
+    fprintf(stderr, "syntax error: %s%s%s\n", msg, word ? " " : "", word ? word : "");
+    return -1;
+}
+
+//+
+// Function:	cmdKeyword
+//
+// Purpose:	Find the keyword a command starts with. Keywords are only
+//		recognised unquoted, as the first word of a command.
+//
+// Parameters:
+//	cmd	- The command.
+//
+// Returns	int
+//		the keyword, KW_NONE if it doesn't start with one.
+//-
+
+int cmdKeyword(struct srcCmd *cmd) {
+    if (cmd->nwords == 0 || isOperator(cmd->words[0], NULL)) {
+        return KW_NONE;
+    }
+    for (int i = 1; keywordNames[i] != NULL; i++) {
+        if (strcmp(cmd->words[0], keywordNames[i]) == 0) {
+            return i;
+        }
+    }
+    return KW_NONE;
+}
+
+//+
+// Function:	emit
+//
+// Purpose:	Add an instruction to the program being compiled.
+//
+// Parameters:
+//	c	- The compiler.
+//	op	- The operation.
+//	target	- Jump target.
+//
+// Returns	int
+//		index of the instruction.
+//-
+
+int emit(struct compiler *c, int op, uint32_t target) {
+    if (c->numInsns == c->maxInsns) {
+        c->maxInsns = c->maxInsns ? 2 * c->maxInsns : 64;
+        c->insns = realloc(c->insns, c->maxInsns * sizeof(struct insn));
+        if (c->insns == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    struct insn *insn = &c->insns[c->numInsns];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->target = target;
+    return c->numInsns++;
+}
+
+//+
+// Function:	poolAdd
+//
+// Purpose:	Add bytes to the pool of the program being compiled,
+//		aligned for a uint32_t.
+//
+// Parameters:
+//	c	- The compiler.
+//	data	- The bytes.
+//	len	- How many.
+//
+// Returns	uint32_t
+//		their offset in the pool.
+//-
+
+uint32_t poolAdd(struct compiler *c, const void *data, size_t len) {
+    size_t off = (c->poolSize + 3) & ~(size_t) 3;
+    if (off + len > c->poolMax) {
+        c->poolMax = c->poolMax ? 2 * c->poolMax : 4096;
+        while (off + len > c->poolMax) {
+            c->poolMax *= 2;
+        }
+        c->pool = realloc(c->pool, c->poolMax);
+        if (c->pool == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    memset(c->pool + c->poolSize, 0, off - c->poolSize);
+    memcpy(c->pool + off, data, len);
+    c->poolSize = off + len;
+    return off;
+}
+
+//+
+// Function:	poolWords
+//
+// Purpose:	Store the words of an instruction in the pool.
+//
+// Parameters:
+//	c	- The compiler.
+//	insn	- Index of the instruction.
+//	words[]	- The words, operators being pointers into operators[].
+//	nwords	- Number of words.
+//
+// Returns	void
+//-
+
+void poolWords(struct compiler *c, int insn, char *words[], int nwords) {
+    uint32_t offsets[nwords + 1];
+
+    for (int i = 0; i < nwords; i++) {
+        char opWord[3] = {WORD_OPERATOR, 0, 0};
+        const char *word = words[i];
+        for (int j = 0; operators[j] != NULL; j++) {
+            if (words[i] == operators[j]) {
+                opWord[1] = 'A' + j;
+                word = opWord;
+                break;
+            }
+        }
+        offsets[i] = poolAdd(c, word, strlen(word) + 1);
+    }
+    c->insns[insn].words = poolAdd(c, offsets, nwords * sizeof(uint32_t));
+    c->insns[insn].nwords = nwords;
+}
+
+//+
+// Function:	shiftKeyword
+//
+// Purpose:	Consume the keyword starting the next command. Any words
+//		after it (as in "then cmd") are left as a command.
+//
+// Parameters:
+//	c	- The compiler.
+//
+// Returns	void
+//-
+
+void shiftKeyword(struct compiler *c) {
+    struct srcCmd *cmd = &c->cmds[c->next];
+    cmd->words++;
+    if (--cmd->nwords == 0) {
+        c->next++;
+    }
+}
+
+//+
+// Function:	closeKeyword
+//
+// Purpose:	Consume the keyword that ends a construct (fi or done),
+//		which must be alone.
+//
+// Parameters:
+//	c	- The compiler.
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int closeKeyword(struct compiler *c) {
+    struct srcCmd *cmd = &c->cmds[c->next];
+    if (cmd->nwords > 1) {
+        return compileError(c, cmd->line, "unexpected word after", cmd->words[0]);
+    }
+    c->next++;
+    return 0;
+}
+
+//+
+// Function:	patchChain
+//
+// Purpose:	Point a chain of jumps, linked through their targets,
+//		at an instruction.
+//
+// Parameters:
+//	c	- The compiler.
+//	chain	- First jump of the chain, -1 if none.
+//	target	- The instruction.
+//
+// Returns	void
+//-
+
+void patchChain(struct compiler *c, int chain, uint32_t target) {
+    while (chain >= 0) {
+        int next = (int) c->insns[chain].target;
+        c->insns[chain].target = target;
+        chain = next;
+    }
+}
+
+int compileList(struct compiler *c, const int ends[]);
+
+//+
+// Function:	compileIf
+//
+// Purpose:	Compile if list; then list [elif list; then list]...
+//		[else list] fi
+//
+// Parameters:
+//	c	- The compiler, at the if.
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int compileIf(struct compiler *c) {
+    static const int thenEnd[] = {KW_THEN, KW_NONE};
+    static const int bodyEnd[] = {KW_ELIF, KW_ELSE, KW_FI, KW_NONE};
+    static const int elseEnd[] = {KW_FI, KW_NONE};
+    int endChain = -1;
+
+    shiftKeyword(c);
+    while (1) {
+        if (compileList(c, thenEnd) != 0) {
+            return -1;
+        }
+        shiftKeyword(c);
+        int skip = emit(c, OP_JUMPFALSE, 0);
+        if (compileList(c, bodyEnd) != 0) {
+            return -1;
+        }
+        int kw = cmdKeyword(&c->cmds[c->next]);
+        endChain = emit(c, OP_JUMP, endChain);
+        c->insns[skip].target = c->numInsns;
+        if (kw == KW_ELIF) {
+            shiftKeyword(c);
+            continue;
+        }
+        if (kw == KW_ELSE) {
+            shiftKeyword(c);
+            if (compileList(c, elseEnd) != 0) {
+                return -1;
+            }
+        } else {
+            // with no branch run the if succeeds
+            emit(c, OP_STATUS, 0);
+        }
+        patchChain(c, endChain, c->numInsns);
+        return closeKeyword(c);
+    }
+}
+
+//+
+// Function:	compileLoopBody
+//
+// Purpose:	Compile do list done, the body of a loop, with break and
+//		continue going to the given places.
+//
+// Parameters:
+//	c		- The compiler, at the do.
+//	continueTo	- Where continue goes.
+//	breaks		- Set to the chain of the body's break jumps.
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int compileLoopBody(struct compiler *c, uint32_t continueTo, int *breaks) {
+    static const int doneEnd[] = {KW_DONE, KW_NONE};
+    struct loopInfo loop = {c->loop, continueTo, -1};
+
+    shiftKeyword(c);
+    c->loop = &loop;
+    int err = compileList(c, doneEnd);
+    c->loop = loop.outer;
+    *breaks = loop.breaks;
+    if (err != 0) {
+        return -1;
+    }
+    return closeKeyword(c);
+}
+
+//+
+// Function:	compileWhile
+//
+// Purpose:	Compile while list; do list done
+//
+// Parameters:
+//	c	- The compiler, at the while.
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int compileWhile(struct compiler *c) {
+    static const int doEnd[] = {KW_DO, KW_NONE};
+    int breaks;
+
+    // the loop's status is that of the last body command run, or 0,
+    // so it is kept across the list and put back when the list fails
+    int slot = c->whileDepth++;
+    shiftKeyword(c);
+    emit(c, OP_STATUS, 0);
+    uint32_t top = emit(c, OP_SAVESTATUS, slot);
+    if (compileList(c, doEnd) != 0) {
+        return -1;
+    }
+    int exit = emit(c, OP_JUMPFALSE, 0);
+    if (compileLoopBody(c, top, &breaks) != 0) {
+        return -1;
+    }
+    emit(c, OP_JUMP, top);
+    c->insns[exit].target = emit(c, OP_LOADSTATUS, slot);
+    patchChain(c, breaks, c->numInsns);
+    c->whileDepth--;
+    return 0;
+}
+
+//+
+// Function:	compileFor
+//
+// Purpose:	Compile for name in words; do list done
+//
+// Parameters:
+//	c	- The compiler, at the for.
+//
+// Returns	int
+//		0 on success, -1 on error.
+//-
+
+int compileFor(struct compiler *c) {
+    static const int doEnd[] = {KW_DO, KW_NONE};
+    struct srcCmd *cmd = &c->cmds[c->next];
+    int breaks;
+
+    if (cmd->nwords < 3 || isOperator(cmd->words[1], NULL) || cmd->words[1][isVarName(cmd->words[1])] != '\0'
+            || isOperator(cmd->words[2], NULL) || strcmp(cmd->words[2], "in") != 0) {
+        return compileError(c, cmd->line, "expected for name in words", NULL);
+    }
+    int start = emit(c, OP_FORSTART, 0);
+    poolWords(c, start, cmd->words + 3, cmd->nwords - 3);
+    c->next++;
+
+    // nothing may come between the list and do
+    int before = c->numInsns;
+    if (compileList(c, doEnd) != 0) {
+        return -1;
+    }
+    if (c->numInsns != before) {
+        return compileError(c, cmd->line, "expected do after", "for");
+    }
+    int top = emit(c, OP_FORNEXT, 0);
+    poolWords(c, top, cmd->words + 1, 1);
+    if (compileLoopBody(c, top, &breaks) != 0) {
+        return -1;
+    }
+    emit(c, OP_JUMP, top);
+    // break and the end of the list both leave through FOREND
+    c->insns[top].target = c->numInsns;
+    patchChain(c, breaks, c->numInsns);
+    emit(c, OP_FOREND, 0);
+    return 0;
+}
+
+//+
+// Function:	compileSimple
+//
+// Purpose:	Compile a command that is not a construct: an
+//		assignment name=value or a command line.
+//
+// Parameters:
+//	c	- The compiler, at the command.
+//
+// Returns	void
+//-
+
+void compileSimple(struct compiler *c) {
+    struct srcCmd *cmd = &c->cmds[c->next++];
+    char *word = cmd->words[0];
+    int marked = (word[0] == WORD_EXPAND);
+    size_t nameLen = isVarName(word + marked);
+
+    if (cmd->nwords == 1 && !isOperator(word, NULL) && nameLen > 0 && word[marked + nameLen] == '=') {
+        // the value keeps the marker if it needs expanding
+        char *parts[2];
+        parts[0] = arenaAlloc(c->arena, nameLen + 1);
+        memcpy(parts[0], word + marked, nameLen);
+        parts[0][nameLen] = '\0';
+        parts[1] = word + marked + nameLen;
+        if (marked) {
+            *parts[1] = WORD_EXPAND;
+        } else {
+            parts[1]++;
+        }
+        poolWords(c, emit(c, OP_SET, 0), parts, 2);
+        return;
+    }
+    poolWords(c, emit(c, OP_CMD, 0), cmd->words, cmd->nwords);
+}
+
+//+
+// Function:	compileList
+//
+// Purpose:	Compile commands up to one starting with one of the
+//		given keywords, which is left for the caller.
+//
+// Parameters:
+//	c	- The compiler.
+//	ends[]	- The keywords that end the list, ending with KW_NONE.
+//		  If ends[0] is KW_NONE the list runs to the end.
+//
+// Returns	int
+//		0 on success, -1 on error (incomplete is set if the source
+//		ended before an end keyword).
+//-
+
+int compileList(struct compiler *c, const int ends[]) {
+    while (c->next < c->numCmds) {
+        struct srcCmd *cmd = &c->cmds[c->next];
+        int kw = cmdKeyword(cmd);
+        for (int i = 0; ends[i] != KW_NONE; i++) {
+            if (kw == ends[i]) {
+                return 0;
+            }
+        }
+
+        int err = 0;
+        switch (kw) {
+        case KW_IF:
+            err = compileIf(c);
+            break;
+        case KW_WHILE:
+            err = compileWhile(c);
+            break;
+        case KW_FOR:
+            err = compileFor(c);
+            break;
+        case KW_BREAK:
+        case KW_CONTINUE:
+            if (c->loop == NULL) {
+                return compileError(c, cmd->line, "not in a loop:", cmd->words[0]);
+            }
+            // break and continue succeed
+            emit(c, OP_STATUS, 0);
+            if (kw == KW_BREAK) {
+                c->loop->breaks = emit(c, OP_JUMP, c->loop->breaks);
+            } else {
+                emit(c, OP_JUMP, c->loop->continueTo);
+            }
+            err = closeKeyword(c);
+            break;
+        case KW_NONE:
+            compileSimple(c);
+            break;
+        default:
+            return compileError(c, cmd->line, "unexpected", cmd->words[0]);
+        }
+        if (err != 0) {
+            return -1;
+        }
+    }
+    if (ends[0] != KW_NONE) {
+        c->incomplete = 1;
+        if (c->name != NULL) {
+            return compileError(c, c->numCmds ? c->cmds[c->numCmds - 1].line : 0,
+                                "unexpected end of file, expected", keywordNames[ends[0]]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+//+
+// Function:	addSourceCmd
+//
+// Purpose:	Add a command to the commands of the source.
+//
+// Parameters:
+//	c	- The compiler.
+//	words[]	- Its words.
+//	nwords	- Number of words.
+//	line	- Its line.
+//
+// Returns	void
+//-
+
+void addSourceCmd(struct compiler *c, char *words[], int nwords, int line) {
+    if (nwords == 0) {
+        return;
+    }
+    if (c->numCmds == c->maxCmds) {
+        c->maxCmds = c->maxCmds ? 2 * c->maxCmds : 64;
+        c->cmds = realloc(c->cmds, c->maxCmds * sizeof(struct srcCmd));
+        if (c->cmds == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    c->cmds[c->numCmds].words = words;
+    c->cmds[c->numCmds].nwords = nwords;
+    c->cmds[c->numCmds].line = line;
+    c->numCmds++;
+}
+
+//+
+// Function:	countConstructs
+//
+// Purpose:	Count the for, while and if constructs a line opens and
+//		the ones it closes, so that typed lines need only be
+//		compiled once they could make a whole command.
+//
+// Parameters:
+//	line	- The line, which is not changed.
+//	depth	- Constructs open before the line, updated.
+//
+// Returns	int
+//		0 on success, -1 (with a message) if it can't be split.
+//-
+
+int countConstructs(const char *line, int *depth) {
+    struct arenaMark mark = arenaMark(&lineArena);
+    size_t len = strlen(line);
+    char *copy = arenaAlloc(&lineArena, len + 1);
+    char **words;
+
+    memcpy(copy, line, len + 1);
+    int nwords = scanCommandLine(copy, &lineArena, &words);
+    // a keyword counts where a command starts: first on the line,
+    // after ; or &, or after a keyword followed by a command
+    int start = 1;
+    for (int i = 0; i < nwords; i++) {
+        if (isOperator(words[i], ";") || isOperator(words[i], "&")) {
+            start = 1;
+            continue;
+        }
+        if (!start) {
+            continue;
+        }
+        struct srcCmd cmd = {words + i, 1, 0};
+        int kw = cmdKeyword(&cmd);
+        if (kw == KW_IF || kw == KW_WHILE || kw == KW_FOR) {
+            (*depth)++;
+        } else if (kw == KW_FI || kw == KW_DONE) {
+            (*depth)--;
+        }
+        start = kw == KW_IF || kw == KW_WHILE || kw == KW_ELIF || kw == KW_THEN
+                || kw == KW_DO || kw == KW_ELSE;
+    }
+    arenaRelease(&lineArena, mark);
+    return nwords < 0 ? -1 : 0;
+}
+
+//+
+// Function:	compileSource
+//
+// Purpose:	Compile shell source into a program.
+//
+// Parameters:
+//	text		- The source, null terminated. It is changed.
+//	name		- Script name for messages, NULL for commands typed
+//			  or piped in (where a construct may continue on
+//			  the next line).
+//	incomplete	- Set to 1 if the source ended inside a construct.
+//
+// Returns	struct program *
+//		the program (free with freeProgram), or NULL (with a
+//		message unless incomplete) on error.
+//-
+
+struct program * compileSource(char *text, const char *name, int *incomplete) {
+    static const int noEnd[] = {KW_NONE};
+    // the words of the source, kept for the next compile
+    static struct arena sourceArena;
+    struct compiler c;
+    struct program *prog = NULL;
+    char **words;
+    int line = 1;
+
+    memset(&c, 0, sizeof(c));
+    c.name = name;
+    c.arena = &sourceArena;
+    arenaReset(&sourceArena);
+    for (char *p = text; *p != '\0'; line++) {
+        char *newline = strchr(p, '\n');
+        if (newline != NULL) {
+            *newline = '\0';
+        }
+        int nwords = scanCommandLine(p, &sourceArena, &words);
+        if (nwords < 0) {
+            if (name != NULL) {
+                fprintf(stderr, "%s: line %d\n", name, line);
+            }
+            goto done;
+        }
+        // split at ; and &, which stays with its command so that
+        // the command runs in the background
+        int first = 0;
+        for (int i = 0; i < nwords; i++) {
+            if (isOperator(words[i], ";")) {
+                addSourceCmd(&c, words + first, i - first, line);
+                first = i + 1;
+            } else if (isOperator(words[i], "&")) {
+                addSourceCmd(&c, words + first, i + 1 - first, line);
+                first = i + 1;
+            }
+        }
+        addSourceCmd(&c, words + first, nwords - first, line);
+        if (newline == NULL) {
+            break;
+        }
+        p = newline + 1;
+    }
+
+    if (compileList(&c, noEnd) == 0) {
+        // the path is added later for a cached script
+        size_t insnSize = c.numInsns * sizeof(struct insn);
+        prog = malloc(sizeof(struct program));
+        prog->size = sizeof(struct progHeader) + insnSize + c.poolSize;
+        prog->base = malloc(prog->size);
+        if (prog->base == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        prog->mapped = 0;
+        prog->header = (struct progHeader *) prog->base;
+        prog->insns = (struct insn *) (prog->header + 1);
+        prog->pool = (char *) prog->insns + insnSize;
+        memset(prog->header, 0, sizeof(struct progHeader));
+        prog->header->magic = PROG_MAGIC;
+        prog->header->version = PROG_VERSION;
+        prog->header->numInsns = c.numInsns;
+        prog->header->poolSize = c.poolSize;
+        memcpy(prog->insns, c.insns, insnSize);
+        memcpy(prog->pool, c.pool, c.poolSize);
+    }
+
+done:
+    *incomplete = c.incomplete;
+    free(c.cmds);
+    free(c.insns);
+    free(c.pool);
+    return prog;
+}
+
+//+
+// Function:	freeProgram
+//
+// Purpose:	Free a program.
+//
+// Parameters:
+//	prog	- The program.
+//
+// Returns	void
+//-
+
+void freeProgram(struct program *prog) {
+    if (prog->mapped) {
+        munmap(prog->base, prog->size);
+    } else {
+        free(prog->base);
+    }
+    free(prog);
+}
+
+//+
+// Function:	progWords
+//
+// Purpose:	Get the words of an instruction as a null terminated
+//		array of pointers into the pool, operators being
+//		pointers into operators[] again.
+//
+// Parameters:
+//	prog	- The program.
+//	insn	- The instruction.
+//	arena	- Where to allocate the array.
+//
+// Returns	char **
+//		the words
+//-
+
+char ** progWords(struct program *prog, struct insn *insn, struct arena *arena) {
+    uint32_t *offsets = (uint32_t *) (prog->pool + insn->words);
+    char **words = arenaAlloc(arena, (insn->nwords + 1) * sizeof(char *));
+
+    for (uint32_t i = 0; i < insn->nwords; i++) {
+        char *word = prog->pool + offsets[i];
+        words[i] = (word[0] == WORD_OPERATOR) ? operators[word[1] - 'A'] : word;
+    }
+    words[insn->nwords] = NULL;
+    return words;
+}
+
+// the list of a for loop being run
+struct forFrame {
+    struct arena	arena;
+    char **		items;
+    int			numItems;
+    int			nextItem;
+};
+
+//+
+// Function:	runProgram
+//
+// Purpose:	Run a compiled program.
+//
+// Parameters:
+//	prog	- The program.
+//
+// Returns	void
+//-
+
+void runProgram(struct program *prog) {
+    struct forFrame *frames = NULL;
+    int numFrames = 0, maxFrames = 0;
+    // status kept by each while loop across its list, by nesting depth
+    int *whileStatus = NULL;
+    uint32_t numWhileStatus = 0;
+    uint32_t pc = 0;
+
+    while (pc < prog->header->numInsns) {
+        struct insn *insn = &prog->insns[pc++];
+        struct arenaMark mark = arenaMark(&lineArena);
+        char **words, **args;
+        int nargs;
+
+        switch (insn->op) {
+        case OP_CMD:
+            words = progWords(prog, insn, &lineArena);
+            if (hasExpansions(words, insn->nwords)) {
+                nargs = expandWords(words, insn->nwords, &lineArena, &args);
+            } else {
+                args = words;
+                nargs = insn->nwords;
+            }
+            runCommand(args, nargs);
+            // free the background jobs that have finished, so that a
+            // loop starting them doesn't fill the job table
+            char drain[64];
+            if (read(sigChldPipe[0], drain, sizeof(drain)) > 0) {
+                while (read(sigChldPipe[0], drain, sizeof(drain)) > 0);
+                reapChildren(WNOHANG);
+            }
+            notifyJobs();
+            break;
+
+        case OP_SET:
+            words = progWords(prog, insn, &lineArena);
+            if (words[1][0] == WORD_EXPAND) {
+                // no pattern matching in an assignment
+                words[1] = expandVars(words[1] + 1, &lineArena, 0);
+                globUnescape(words[1]);
+            }
+            setVar(words[0], words[1]);
+            lastStatus = 0;
+            break;
+
+        case OP_JUMP:
+            pc = insn->target;
+            break;
+
+        case OP_JUMPFALSE:
+            if (lastStatus != 0) {
+                pc = insn->target;
+            }
+            break;
+
+        case OP_FORSTART:
+            if (numFrames == maxFrames) {
+                maxFrames = maxFrames ? 2 * maxFrames : 8;
+                frames = realloc(frames, maxFrames * sizeof(struct forFrame));
+                if (frames == NULL) {
+                    perror("malloc");
+                    exit(1);
+                }
+            }
+            struct forFrame *frame = &frames[numFrames++];
+            memset(frame, 0, sizeof(*frame));
+            words = progWords(prog, insn, &frame->arena);
+            frame->numItems = expandWords(words, insn->nwords, &frame->arena, &frame->items);
+            // with an empty list the loop succeeds
+            lastStatus = 0;
+            break;
+
+        case OP_FORNEXT:
+            frame = &frames[numFrames - 1];
+            if (frame->nextItem < frame->numItems) {
+                words = progWords(prog, insn, &lineArena);
+                setVar(words[0], frame->items[frame->nextItem++]);
+            } else {
+                pc = insn->target;
+            }
+            break;
+
+        case OP_FOREND:
+            arenaFree(&frames[--numFrames].arena);
+            break;
+
+        case OP_STATUS:
+            lastStatus = insn->target;
+            break;
+
+        case OP_SAVESTATUS:
+            if (insn->target >= numWhileStatus) {
+                numWhileStatus = insn->target + 8;
+                whileStatus = realloc(whileStatus, numWhileStatus * sizeof(int));
+                if (whileStatus == NULL) {
+                    perror("malloc");
+                    exit(1);
+                }
+            }
+            whileStatus[insn->target] = lastStatus;
+            break;
+
+        case OP_LOADSTATUS:
+            lastStatus = insn->target < numWhileStatus ? whileStatus[insn->target] : 0;
+            break;
+        }
+        arenaRelease(&lineArena, mark);
+    }
+    free(frames);
+    free(whileStatus);
+}
+
+//+
+// Function:	cacheFile
+//
+// Purpose:	Find the cache file of a script, making the cache
+//		directory if needed.
+//
+// Parameters:
+//	realPath	- The script's absolute path.
+//	path		- Where to put the cache file's path.
+//	size		- Size of path.
+//
+// Returns	int
+//		0 on success, -1 if there is no cache directory.
+//-
+
+int cacheFile(const char *realPath, char *path, size_t size) {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+
+    if (cache != NULL && cache[0] == '/') {
+        len = snprintf(path, size, "%s", cache);
+    } else if (home != NULL) {
+        len = snprintf(path, size, "%s/.cache", home);
+    } else {
+        return -1;
+    }
+    mkdir(path, 0700);
+    len += snprintf(path + len, size - len, "/shell");
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    snprintf(path + len, size - len, "/%08x.bc", hashString(realPath));
+    return 0;
+}
+
+//+
+// Function:	loadCached
+//
+// Purpose:	Map the cached program of a script, if it is still the
+//		program of the script as it is now. Everything in it is
+//		checked, so a damaged cache file is just not used.
+//
+// Parameters:
+//	cachePath	- The cache file.
+//	realPath	- The script's absolute path.
+//	st		- The script's status.
+//
+// Returns	struct program *
+//		the program, or NULL if it must be compiled.
+//-
+
+struct program * loadCached(const char *cachePath, const char *realPath, struct stat *st) {
+    struct stat cacheStat;
+    int fd = open(cachePath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &cacheStat) != 0 || cacheStat.st_size < (off_t) sizeof(struct progHeader)) {
+        close(fd);
+        return NULL;
+    }
+    // private and writable, as the words are handed to commands
+    char *base = mmap(NULL, cacheStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct progHeader *h = (struct progHeader *) base;
+    size_t insnSize = (size_t) h->numInsns * sizeof(struct insn);
+    char *pool = base + sizeof(struct progHeader) + insnSize;
+    int valid = h->magic == PROG_MAGIC && h->version == PROG_VERSION
+            && h->sourceSize == (uint64_t) st->st_size && h->mtimeSec == st->st_mtim.tv_sec
+            && h->mtimeNsec == st->st_mtim.tv_nsec && h->inode == st->st_ino
+            && sizeof(struct progHeader) + insnSize + h->poolSize == (size_t) cacheStat.st_size
+            && h->pathOff < h->poolSize && pool[h->poolSize - 1] == '\0'
+            && strcmp(pool + h->pathOff, realPath) == 0;
+
+    struct insn *insns = (struct insn *) (h + 1);
+    for (uint32_t i = 0; valid && i < h->numInsns; i++) {
+        valid = insns[i].target <= h->numInsns && insns[i].words % 4 == 0
+             && insns[i].words + (uint64_t) insns[i].nwords * 4 <= h->poolSize;
+        uint32_t *offsets = (uint32_t *) (pool + insns[i].words);
+        for (uint32_t w = 0; valid && w < insns[i].nwords; w++) {
+            valid = offsets[w] < h->poolSize
+                 && (pool[offsets[w]] != WORD_OPERATOR || (unsigned) (pool[offsets[w] + 1] - 'A') < sizeof(operators) / sizeof(operators[0]) - 1);
+        }
+    }
+    if (!valid) {
+        munmap(base, cacheStat.st_size);
+        return NULL;
+    }
+
+    struct program *prog = malloc(sizeof(struct program));
+    prog->base = base;
+    prog->size = cacheStat.st_size;
+    prog->mapped = 1;
+    prog->header = h;
+    prog->insns = insns;
+    prog->pool = pool;
+    return prog;
+}
+
+//+
+// Function:	saveCached
+//
+// Purpose:	Write a script's program to its cache file. It is
+//		written under another name and renamed, so a shell
+//		loading it never sees part of it.
+//
+// Parameters:
+//	cachePath	- The cache file.
+//	prog		- The program.
+//
+// Returns	void
+//-
+
+void saveCached(const char *cachePath, struct program *prog) {
+    char tmpPath[strlen(cachePath) + 8];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", cachePath);
+    int fd = mkstemp(tmpPath);
+    if (fd < 0) {
+        return;
+    }
+    if (write(fd, prog->base, prog->size) != (ssize_t) prog->size || rename(tmpPath, cachePath) != 0) {
+        unlink(tmpPath);
+    }
+    close(fd);
+}
+
+//+
+// Function:	loadScript
+//
+// Purpose:	Get the program of a script, from the cache if it is
+//		there and current, otherwise by compiling it (and then
+//		caching it).
+//
+// Parameters:
+//	path	- The script.
+//
+// Returns	struct program *
+//		the program, or NULL (with a message, and lastStatus set
+//		to 127 if it can't be read or 2 if it has an error).
+//-
+
+struct program * loadScript(const char *path) {
+    struct stat st;
+    char cachePath[CMD_BUFFSIZE];
+    int incomplete;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        lastStatus = 127;
+        return NULL;
+    }
+    char *realPath = realpath(path, NULL);
+    int cached = realPath != NULL && S_ISREG(st.st_mode) && cacheFile(realPath, cachePath, sizeof(cachePath)) == 0;
+    struct program *prog = cached ? loadCached(cachePath, realPath, &st) : NULL;
+    if (prog != NULL) {
+        close(fd);
+        free(realPath);
+        return prog;
+    }
+
+    // map a regular file privately, since compiling splits it in place.
+    // The mapping goes over a zeroed anonymous one a byte longer, so the
+    // text ends in a null even when the file fills its last page.
+    size_t size = 0, mapSize = 0;
+    char *text = NULL;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        mapSize = st.st_size + 1;
+        char *area = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area != MAP_FAILED && mmap(area, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+            madvise(area, st.st_size, MADV_SEQUENTIAL);
+            text = area;
+            size = st.st_size;
+        } else if (area != MAP_FAILED) {
+            munmap(area, mapSize);
+        }
+    }
+    if (text == NULL) {
+        // otherwise read it whole
+        mapSize = 0;
+        size_t max = READ_BLOCK;
+        text = malloc(max);
+        ssize_t n;
+        while (text != NULL && (n = read(fd, text + size, max - size - 1)) > 0) {
+            size += n;
+            if (size + 1 == max) {
+                max *= 2;
+                text = realloc(text, max);
+            }
+        }
+        if (text == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        text[size] = '\0';
+    }
+    close(fd);
+
+    prog = compileSource(text, path, &incomplete);
+    if (mapSize > 0) {
+        munmap(text, mapSize);
+    } else {
+        free(text);
+    }
+    if (prog == NULL) {
+        lastStatus = 2;
+    }
+    if (prog != NULL && cached && size == (size_t) st.st_size) {
+        // the path goes at the end of the pool
+        struct progHeader header = *prog->header;
+        size_t pathLen = strlen(realPath) + 1;
+        header.pathOff = header.poolSize;
+        header.poolSize += pathLen;
+        header.sourceSize = st.st_size;
+        header.mtimeSec = st.st_mtim.tv_sec;
+        header.mtimeNsec = st.st_mtim.tv_nsec;
+        header.inode = st.st_ino;
+        prog->base = realloc(prog->base, prog->size + pathLen);
+        memcpy(prog->base, &header, sizeof(header));
+        memcpy(prog->base + prog->size, realPath, pathLen);
+        prog->size += pathLen;
+        prog->header = (struct progHeader *) prog->base;
+        prog->insns = (struct insn *) (prog->header + 1);
+        prog->pool = (char *) (prog->insns + header.numInsns);
+        saveCached(cachePath, prog);
+    }
+    free(realPath);
+    return prog;
+}
+
+////////////////////////////// Internal Command Handling (Step 3) ///////////////////////////////////
+
+// define command handling function pointer type
+typedef void(*commandFunction)(char * args[], int nargs);
+
+// associate a command name with a command handling function
+struct cmdData{
+   char 	* cmdName;
+   commandFunction 	cmdFunc;
+};
+
+// prototypes for command handling functions
+void exitFunc(char *args[], int nargs);
+void pwdFunc(char *args[], int nargs);
+void cdFunc(char *args[], int nargs);
+void lsFunc(char *args[], int nargs);
+void hashFunc(char *args[], int nargs);
+void setFunc(char *args[], int nargs);
+void jobsFunc(char *args[], int nargs);
+void fgFunc(char *args[], int nargs);
+void waitFunc(char *args[], int nargs);
+void parFunc(char *args[], int nargs);
+void statsFunc(char *args[], int nargs);
+void catFunc(char *args[], int nargs);
+void historyFunc(char *args[], int nargs);
+
+void loadFunc(char *args[], int nargs);
+void sourceFunc(char *args[], int nargs);
+void exportFunc(char *args[], int nargs);
+
+// list commands and functions
+// must be terminated by {NULL, NULL} 
+// These are put in the builtin table when it is first used.
+
+struct cmdData commands[] = {
+   {"exit", exitFunc},
+   {"pwd", pwdFunc},
+   {"cd", cdFunc},
+   {"ls", lsFunc},
+   {"hash", hashFunc},
+   {"set", setFunc},
+   {"jobs", jobsFunc},
+   {"fg", fgFunc},
+   {"wait", waitFunc},
+   {"par", parFunc},
+   {"stats", statsFunc},
+   {"cat", catFunc},
+   {"history", historyFunc},
+   {"load", loadFunc},
+   {"source", sourceFunc},
+   {"export", exportFunc},
+   { NULL, NULL}		// terminator
+};
+
+// Builtins are found through a hash table, holding the commands
+// above and those registered by plugins, chained as the external
+// command table is and keyed with the same hashString.
+
+struct builtinEntry {
+    struct builtinEntry *	next;
+    unsigned int		hashVal;
+    struct cmdData		cmd;		// cmdName is stored after the entry
+};
+
+#define BUILTIN_INIT_BUCKETS 32		// must be a power of two
+
+struct builtinEntry ** builtinTable = NULL;
+unsigned int builtinBuckets = 0;
+unsigned int builtinCount = 0;
+
+//+
+// Function:	registerBuiltin
+//
+// Purpose:	Add a builtin command, replacing any builtin of the same
+//		name. Plugins are given this to add their commands.
+//
+// Parameters:
+//	name	- The command name (copied).
+//	func	- The function that runs it.
+//
+// Returns	int
+//		0 on success, -1 if out of memory.
+//-
+
+int registerBuiltin(const char *name, commandFunction func) {
+    unsigned int h = hashString(name);
+
+    if (builtinBuckets != 0) {
+        for (struct builtinEntry *ent = builtinTable[h & (builtinBuckets - 1)]; ent != NULL; ent = ent->next) {
+            if (ent->hashVal == h && strcmp(ent->cmd.cmdName, name) == 0) {
+                ent->cmd.cmdFunc = func;
+                return 0;
+            }
+        }
+    }
+
+    if (builtinCount >= builtinBuckets) {
+        unsigned int newBuckets = builtinBuckets ? 2 * builtinBuckets : BUILTIN_INIT_BUCKETS;
+        struct builtinEntry **newTable = calloc(newBuckets, sizeof(struct builtinEntry *));
+        if (newTable == NULL) {
+            return -1;
+        }
+        for (unsigned int i = 0; i < builtinBuckets; i++) {
+            struct builtinEntry *ent = builtinTable[i];
+            while (ent != NULL) {
+                struct builtinEntry *next = ent->next;
+                ent->next = newTable[ent->hashVal & (newBuckets - 1)];
+                newTable[ent->hashVal & (newBuckets - 1)] = ent;
+                ent = next;
+            }
+        }
+        free(builtinTable);
+        builtinTable = newTable;
+        builtinBuckets = newBuckets;
+    }
+
+    size_t nameLen = strlen(name) + 1;
+    struct builtinEntry *ent = malloc(sizeof(struct builtinEntry) + nameLen);
+    if (ent == NULL) {
+        return -1;
+    }
+    ent->cmd.cmdName = (char *) (ent + 1);
+    memcpy(ent->cmd.cmdName, name, nameLen);
+    ent->cmd.cmdFunc = func;
+    ent->hashVal = h;
+    ent->next = builtinTable[h & (builtinBuckets - 1)];
+    builtinTable[h & (builtinBuckets - 1)] = ent;
+    builtinCount++;
+    return 0;
+}
+
+//+
+// Function:	initBuiltins
+//
+// Purpose:	Fill the builtin table from commands[].
+//
+// Parameters:	(none)
+//
+// Returns	void
+//-
+
+void initBuiltins(void) {
+    for (int i = 0; commands[i].cmdName != NULL; i++) {
+        if (registerBuiltin(commands[i].cmdName, commands[i].cmdFunc) != 0) {
+            perror("shell: builtins");
+            exit(1);
+        }
+    }
+}
+
+//+
+// Function:	findInternalCommand
+//
+// Purpose:	Looks up an internal command by name.
+//
+// Parameters:
+//	cmdName	- The name of the command.
+//
+// Returns	struct cmdData *
+//		the command's entry, or NULL if it is not an internal command.
+//-
+
+struct cmdData * findInternalCommand(const char *cmdName) {
+    if (builtinBuckets == 0) {
+        initBuiltins();
+    }
+    unsigned int h = hashString(cmdName);
+    for (struct builtinEntry *ent = builtinTable[h & (builtinBuckets - 1)]; ent != NULL; ent = ent->next) {
+        if (ent->hashVal == h && strcmp(ent->cmd.cmdName, cmdName) == 0) {
+            return &ent->cmd;
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function:	doInternalCommand
+//
+// Purpose:	Checks if the first argument is an internal command and executes it if found.
+//
+// Parameters:
+//	args[]	- Array of arguments where args[0] is the command to check.
+//	nargs	- Number of arguments in the args array.
+//
+// Returns	int
+//		1 = args[0] is an internal command
+//		0 = args[0] is not an internal command
+//-
+
+int doInternalCommand(char * args[], int nargs) {
+    char *cmdWord = commandWord(args, nargs);
+    struct cmdData *cmd = cmdWord ? findInternalCommand(cmdWord) : NULL;
+
+    // If no matching internal command was found, return 0
+    if (cmd == NULL) {
+        return 0;
+    }
+
+    // a builtin that doesn't set a status succeeded
+    lastStatus = 0;
+    if (!hasRedirection(args, nargs)) {
+        // Call the associated command function
+        cmd->cmdFunc(args, nargs);
+        return 1;  // Return 1 to indicate that the command was found and executed
+    }
+
+    // the command runs in the shell, so redirect the shell's own
+    // descriptors around the call and put them back afterwards
+    struct redirection redir = {{-1, -1, -1}, 0, NULL};
+    if (parseRedirections(args, &nargs, &redir) != 0) {
+        lastStatus = 1;
+        return 1;
+    }
+    int saved[3];
+    fflush(stdout);
+    for (int j = 0; j < 3; j++) {
+        int i = childFdOrder[j];
+        saved[i] = -1;
+        if (redir.childFd[i] >= 0) {
+            saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+            dup2(redir.childFd[i], i);
+        }
+    }
+    closeRedirections(&redir);
+
+    cmd->cmdFunc(args, nargs);
+
+    fflush(stdout);
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], i);
+            close(saved[i]);
+        } else if (redir.childFd[i] >= 0) {
+            // the shell had nothing open here
+            close(i);
+        }
+    }
+    return 1;
+}
+///////////////////////////////
+// comand Handling Functions //
+///////////////////////////////
+
+//+
+// Function:	exitFunc
+//
+// Purpose:	To exit with given status
+//
+// Parameters:
+//	args[]	- Array of arguments, args[1] is the status. Without it
+//		  the status is that of the last command.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//		no return
+//-
+
+void exitFunc(char *args[], int nargs) {
+    int status = lastStatus;
+    if (nargs > 1) {
+        status = atoi(args[1]);
+    }
+    exit(status);
+}
+
+//+
+// Function:	pwdFunc
+//
+// Purpose:	To print the current working directory.
+//
+// Parameters:
+//	args[]	- Array of arguments (not used here).
+//	nargs	- Number of arguments (not used here).
+//
+// Returns	void
+//-
+
+void pwdFunc(char *args[], int nargs) {
+    char *cwd = getcwd(NULL, 0);  // Get the current working directory
+    if (cwd != NULL) {
+        printf("%s\n", cwd);  // Print the working directory
+        free(cwd);  // Free the memory allocated by getcwd
+    } else {
+        perror("pwd");  // Print error if getcwd fails
+        lastStatus = 1;
+    }
+}
+
+//+
+// Function:	cdFunc
+//
+// Purpose:	To change the current working directory.
+//
+// Parameters:
+//	args[]	- Array of arguments where args[1] is the directory to change to.
+//	nargs	- Number of arguments (1 or 2).
+//
+// Returns	void
+//-
+
+void cdFunc(char *args[], int nargs) {
+    const char *targetDir;
+    
+    // If no argument, change to the home directory
+    if (nargs == 1) {
+        struct passwd *pw = getpwuid(getuid());  // Get the home directory of the current user
+        if (pw != NULL) {
+            targetDir = pw->pw_dir;  // Set the target directory to the user's home directory
+        } else {
+            fprintf(stderr, "cd: could not find home directory\n");
+            lastStatus = 1;
+            return;
+        }
+    } else {
+        targetDir = args[1];  // Set the target directory to the argument
+    }
+
+    // Try to change to the target directory
+    if (chdir(targetDir) != 0) {
+        perror("cd");  // Print error if chdir fails
+        lastStatus = 1;
+    } else if (searchPathRelative) {
+        // remembered locations relative to the old directory are stale
+        hashClear();
+        searchDirsNow();
+    }
+}
+
+// size of the buffer for getdents64, large so that a big directory
+// takes few system calls
+#define LS_DIRENT_BUFF (1024 * 1024)
+// entries at which ls starts statx worker threads, and how many
+#define LS_THREAD_MIN 1024
+#define LS_THREADS 4
+// entries a worker takes at a time
+#define LS_STAT_CHUNK 256
+
+// the metadata ls needs from statx, kept small so that large
+// directories fit in cache
+struct lsInfo {
+    uint64_t	size;
+    uint64_t	blocks;
+    int64_t	mtimeSec;
+    uint32_t	mtimeNsec;
+    uint32_t	mode;
+    uint32_t	nlink;
+    uint32_t	uid;
+    uint32_t	gid;
+    int		valid;		// 0 if statx failed
+};
+
+// the entries of one directory. All the names are stored back to back
+// in one buffer and referred to by offset.
+struct lsList {
+    char *		names;
+    size_t		namesUsed;
+    size_t		namesSize;
+    uint32_t *		nameOff;
+    struct lsInfo *	info;
+    int			count;
+    int			max;
+};
+
+// sort key for one entry. Sorting this array only touches the names
+// when the keys are equal.
+struct lsKey {
+    uint64_t	key;
+    uint32_t	index;
+};
+
+// shared by the statx workers for one directory
+struct lsStatWork {
+    int			dirFd;
+    unsigned int	mask;
+    struct lsList *	list;
+    int			next;		// next entry to hand out
+};
+
+// names, used by the sort comparison
+const char * lsSortNames;
+const uint32_t * lsSortOffsets;
+
+//+
+// Function:	lsAddName
+//
+// Purpose:	Add a name to a directory listing.
+//
+// Parameters:
+//	list	- The listing.
+//	name	- The name of the entry.
+//
+// Returns	void
+//-
+
+void lsAddName(struct lsList *list, const char *name) {
+    size_t len = strlen(name) + 1;
+
+    if (list->namesUsed + len > list->namesSize) {
+        size_t newSize = list->namesSize ? 2 * list->namesSize : 65536;
+        while (newSize < list->namesUsed + len) {
+            newSize *= 2;
+        }
+        char *newNames = realloc(list->names, newSize);
+        if (newNames == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        list->names = newNames;
+        list->namesSize = newSize;
+    }
+    if (list->count == list->max) {
+        int newMax = list->max ? 2 * list->max : 1024;
+        uint32_t *newOff = realloc(list->nameOff, newMax * sizeof(uint32_t));
+        if (newOff == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        list->nameOff = newOff;
+        list->max = newMax;
+    }
+    memcpy(list->names + list->namesUsed, name, len);
+    list->nameOff[list->count++] = list->namesUsed;
+    list->namesUsed += len;
+}
+
+//+
+// Function:	lsReadDir
+//
+// Purpose:	Read all the entries of a directory with getdents64,
+//		a megabyte of entries per system call.
+//
+// Parameters:
+//	dirFd	- Open descriptor for the directory.
+//	list	- The listing to add the names to.
+//	showAll	- 1 to include names starting with a dot.
+//
+// Returns	int
+//		0 on success, -1 with errno set on error.
+//-
+
+int lsReadDir(int dirFd, struct lsList *list, int showAll) {
+    char *buf = malloc(LS_DIRENT_BUFF);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    long n;
+    while ((n = syscall(SYS_getdents64, dirFd, buf, LS_DIRENT_BUFF)) > 0) {
+        for (long pos = 0; pos < n; ) {
+            struct linuxDirent64 *d = (struct linuxDirent64 *) (buf + pos);
+            if (showAll || d->d_name[0] != '.') {
+                lsAddName(list, d->d_name);
+            }
+            pos += d->d_reclen;
+        }
+    }
+    int savedErrno = errno;
+    free(buf);
+    errno = savedErrno;
+    return n < 0 ? -1 : 0;
+}
+
+//+
+// Function:	lsStatRange
+//
+// Purpose:	Fetch the metadata of entries [first, last) with statx.
+//
+// Parameters:
+//	work	- The directory and listing.
+//	first	- First entry.
+//	last	- One past the last entry.
+//
+// Returns	void
+//-
+
+void lsStatRange(struct lsStatWork *work, int first, int last) {
+    struct lsList *list = work->list;
+    struct statx stx;
+
+    for (int i = first; i < last; i++) {
+        struct lsInfo *info = &list->info[i];
+        if (statx(work->dirFd, list->names + list->nameOff[i], AT_SYMLINK_NOFOLLOW,
+                  work->mask, &stx) != 0) {
+            info->valid = 0;
+            continue;
+        }
+        info->size = stx.stx_size;
+        info->blocks = stx.stx_blocks;
+        info->mtimeSec = stx.stx_mtime.tv_sec;
+        info->mtimeNsec = stx.stx_mtime.tv_nsec;
+        info->mode = stx.stx_mode;
+        info->nlink = stx.stx_nlink;
+        info->uid = stx.stx_uid;
+        info->gid = stx.stx_gid;
+        info->valid = 1;
+    }
+}
+
+//+
+// Function:	lsStatWorker
+//
+// Purpose:	Worker thread, takes chunks of entries and stats them
+//		until there are none left.
+//
+// Parameters:
+//	arg	- The struct lsStatWork shared by the workers.
+//
+// Returns	void *
+//		NULL
+//-
+
+void * lsStatWorker(void *arg) {
+    struct lsStatWork *work = arg;
+    int first;
+
+    while ((first = __atomic_fetch_add(&work->next, LS_STAT_CHUNK, __ATOMIC_RELAXED)) < work->list->count) {
+        int last = first + LS_STAT_CHUNK;
+        lsStatRange(work, first, last < work->list->count ? last : work->list->count);
+    }
+    return NULL;
+}
+
+//+
+// Function:	lsStatAll
+//
+// Purpose:	Fetch the metadata of every entry. A large directory is
+//		shared between LS_THREADS threads so that the statx calls
+//		overlap, which matters most when the inodes are not cached.
+//
+// Parameters:
+//	dirFd	- Descriptor of the directory the names are relative to.
+//	list	- The listing.
+//	mask	- The STATX_ fields needed.
+//
+// Returns	void
+//-
+
+void lsStatAll(int dirFd, struct lsList *list, unsigned int mask) {
+    struct lsStatWork work = {dirFd, mask, list, 0};
+    pthread_t threads[LS_THREADS - 1];
+    int numThreads = 0;
+
+    // zeroed, so an entry statx fails on still has a size and time to
+    // sort by
+    list->info = calloc(list->count + 1, sizeof(struct lsInfo));
+    if (list->info == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    if (list->count >= LS_THREAD_MIN) {
+        for (; numThreads < LS_THREADS - 1; numThreads++) {
+            if (pthread_create(&threads[numThreads], NULL, lsStatWorker, &work) != 0) {
+                break;
+            }
+        }
+    }
+    // this thread works too
+    lsStatWorker(&work);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+//+
+// Function:	lsCompare
+//
+// Purpose:	qsort comparison for sort keys, by key and then by name.
+//
+// Parameters:
+//	a, b	- The struct lsKey entries to compare.
+//
+// Returns	int
+//		<0, 0, >0 as for strcmp.
+//-
+
+int lsCompare(const void *a, const void *b) {
+    const struct lsKey *ka = a;
+    const struct lsKey *kb = b;
+
+    if (ka->key != kb->key) {
+        return ka->key < kb->key ? -1 : 1;
+    }
+    return strcmp(lsSortNames + lsSortOffsets[ka->index], lsSortNames + lsSortOffsets[kb->index]);
+}
+
+//+
+// Function:	lsSort
+//
+// Purpose:	Sort a listing. Each entry gets a 64 bit key: the first
+//		8 bytes of the name (big endian, so the order matches strcmp),
+//		the size inverted for -S, or the time inverted for -t, so
+//		that largest or newest sorts first.
+//
+// Parameters:
+//	list	- The listing.
+//	sortBy	- 'n' for name, 'S' for size, 't' for time.
+//
+// Returns	struct lsKey *
+//		the sorted keys (malloc'd).
+//-
+
+struct lsKey * lsSort(struct lsList *list, char sortBy) {
+    struct lsKey *keys = malloc(list->count * sizeof(struct lsKey) + 1);
+    if (keys == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        uint64_t key = 0;
+        if (sortBy == 'S') {
+            key = ~list->info[i].size;
+        } else if (sortBy == 't') {
+            key = ~(uint64_t) (list->info[i].mtimeSec * 1000000000 + list->info[i].mtimeNsec);
+        } else {
+            const unsigned char *name = (const unsigned char *) list->names + list->nameOff[i];
+            for (int b = 0; b < 8; b++) {
+                key <<= 8;
+                if (*name != '\0') {
+                    key |= *name++;
+                }
+            }
+        }
+        keys[i].key = key;
+        keys[i].index = i;
+    }
+
+    lsSortNames = list->names;
+    lsSortOffsets = list->nameOff;
+    qsort(keys, list->count, sizeof(struct lsKey), lsCompare);
+    return keys;
+}
+
+//+
+// Function:	lsModeString
+//
+// Purpose:	Format a file mode as ls -l does, e.g. -rwxr-xr-x.
+//
+// Parameters:
+//	mode	- The st_mode value.
+//	buf	- At least 11 bytes.
+//
+// Returns	char *
+//		buf
+//-
+
+char * lsModeString(uint32_t mode, char *buf) {
+    const char *rwx = "rwxrwxrwx";
+
+    switch (mode & S_IFMT) {
+        case S_IFDIR:  buf[0] = 'd'; break;
+        case S_IFLNK:  buf[0] = 'l'; break;
+        case S_IFCHR:  buf[0] = 'c'; break;
+        case S_IFBLK:  buf[0] = 'b'; break;
+        case S_IFIFO:  buf[0] = 'p'; break;
+        case S_IFSOCK: buf[0] = 's'; break;
+        default:       buf[0] = '-'; break;
+    }
+    for (int i = 0; i < 9; i++) {
+        buf[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    }
+    if (mode & S_ISUID) {
+        buf[3] = (mode & S_IXUSR) ? 's' : 'S';
+    }
+    if (mode & S_ISGID) {
+        buf[6] = (mode & S_IXGRP) ? 's' : 'S';
+    }
+    if (mode & S_ISVTX) {
+        buf[9] = (mode & S_IXOTH) ? 't' : 'T';
+    }
+    buf[10] = '\0';
+    return buf;
+}
+
+//+
+// Function:	lsPrintLong
+//
+// Purpose:	Print one entry in ls -l format. The last user and group
+//		looked up are remembered, since most entries share them.
+//
+// Parameters:
+//	dirFd	- Descriptor of the directory, to read symbolic links.
+//	name	- The name of the entry.
+//	info	- Its metadata.
+//
+// Returns	void
+//-
+
+void lsPrintLong(int dirFd, const char *name, struct lsInfo *info) {
+    static uid_t lastUid = (uid_t) -1;
+    static gid_t lastGid = (gid_t) -1;
+    static char owner[32], group[32];
+    char mode[11], when[32];
+
+    if (!info->valid) {
+        fprintf(stderr, "ls: cannot access '%s'\n", name);
+        return;
+    }
+    if (info->uid != lastUid) {
+        struct passwd *pw = getpwuid(info->uid);
+        pw ? snprintf(owner, sizeof(owner), "%s", pw->pw_name) : snprintf(owner, sizeof(owner), "%u", info->uid);
+        lastUid = info->uid;
+    }
+    if (info->gid != lastGid) {
+        struct group *gr = getgrgid(info->gid);
+        gr ? snprintf(group, sizeof(group), "%s", gr->gr_name) : snprintf(group, sizeof(group), "%u", info->gid);
+        lastGid = info->gid;
+    }
+
+    // like ls, show the year instead of the time for old files
+    time_t mtime = info->mtimeSec;
+    struct tm tm;
+    localtime_r(&mtime, &tm);
+    if (llabs(time(NULL) - mtime) < 182 * 24 * 60 * 60) {
+        strftime(when, sizeof(when), "%b %e %H:%M", &tm);
+    } else {
+        strftime(when, sizeof(when), "%b %e  %Y", &tm);
+    }
+
+    printf("%s %3u %-8s %-8s %8llu %s %s", lsModeString(info->mode, mode), info->nlink,
+           owner, group, (unsigned long long) info->size, when, name);
+    if (S_ISLNK(info->mode)) {
+        char target[4096];
+        ssize_t len = readlinkat(dirFd, name, target, sizeof(target) - 1);
+        if (len >= 0) {
+            target[len] = '\0';
+            printf(" -> %s", target);
+        }
+    }
+    printf("\n");
+}
+
+//+
+// Function:	lsPrint
+//
+// Purpose:	Sort and print a listing.
+//
+// Parameters:
+//	dirFd	- Descriptor of the directory the names are relative to.
+//	list	- The listing.
+//	longFormat	- 1 for -l.
+//	sortBy	- 'n', 'S' or 't'.
+//	showTotal	- 1 to print the total blocks line of -l.
+//
+// Returns	void
+//-
+
+void lsPrint(int dirFd, struct lsList *list, int longFormat, char sortBy, int showTotal) {
+    if (longFormat || sortBy != 'n') {
+        unsigned int mask = longFormat ? STATX_BASIC_STATS : STATX_SIZE | STATX_MTIME;
+        lsStatAll(dirFd, list, mask);
+    }
+    struct lsKey *keys = lsSort(list, sortBy);
+
+    if (longFormat && showTotal) {
+        // st_blocks is in 512 byte units, ls reports 1k blocks
+        unsigned long long total = 0;
+        for (int i = 0; i < list->count; i++) {
+            total += list->info[i].valid ? list->info[i].blocks : 0;
+        }
+        printf("total %llu\n", total / 2);
+    }
+    for (int i = 0; i < list->count; i++) {
+        int index = keys[i].index;
+        const char *name = list->names + list->nameOff[index];
+        if (longFormat) {
+            lsPrintLong(dirFd, name, &list->info[index]);
+        } else {
+            printf("%s\n", name);
+        }
+    }
+    free(keys);
+}
+
+//+
+// Function:	lsFree
+//
+// Purpose:	Free a listing, leaving it empty for reuse.
+//
+// Parameters:
+//	list	- The listing.
+//
+// Returns	void
+//-
+
+void lsFree(struct lsList *list) {
+    free(list->names);
+    free(list->nameOff);
+    free(list->info);
+    memset(list, 0, sizeof(*list));
+}
+
+//+
+// Function:	lsFunc
+//
+// Purpose:	List the contents of directories, by default the current one.
+//
+// Parameters:
+//	args[]	- Array of arguments, options -a, -l, -S and -t (which may
+//		  be combined, as in -la) followed by paths.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void lsFunc(char *args[], int nargs) {
+    int showAll = 0;
+    int longFormat = 0;
+    char sortBy = 'n';
+    int argi;
+
+    for (argi = 1; argi < nargs && args[argi][0] == '-' && args[argi][1] != '\0'; argi++) {
+        for (char *opt = args[argi] + 1; *opt != '\0'; opt++) {
+            switch (*opt) {
+                case 'a': showAll = 1; break;
+                case 'l': longFormat = 1; break;
+                case 'S': sortBy = 'S'; break;
+                case 't': sortBy = 't'; break;
+                default:
+                    // Invalid argument
+                    fprintf(stderr, "ls: invalid option '%s'\n", args[argi]);
+                    lastStatus = 2;
+                    return;
+            }
+        }
+    }
+
+    char *dot[] = {".", NULL};
+    char **paths = argi < nargs ? &args[argi] : dot;
+    int numPaths = argi < nargs ? nargs - argi : 1;
+    struct lsList list;
+    memset(&list, 0, sizeof(list));
+
+    // files named on the command line are listed first, together. A
+    // symlink to a directory is followed, as the second pass does,
+    // and a dangling one is listed as a file.
+    for (int i = 0; i < numPaths; i++) {
+        struct stat statbuf;
+        if (stat(paths[i], &statbuf) != 0 && lstat(paths[i], &statbuf) != 0) {
+            fprintf(stderr, "ls: %s: %s\n", paths[i], strerror(errno));
+            lastStatus = 1;
+        } else if (!S_ISDIR(statbuf.st_mode)) {
+            lsAddName(&list, paths[i]);
+        }
+    }
+    int numFiles = list.count;
+    if (numFiles > 0) {
+        lsPrint(AT_FDCWD, &list, longFormat, sortBy, 0);
+    }
+    lsFree(&list);
+
+    int first = 1;
+    for (int i = 0; i < numPaths; i++) {
+        int dirFd = open(paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            if (errno != ENOTDIR && errno != ENOENT) {
+                fprintf(stderr, "ls: %s: %s\n", paths[i], strerror(errno));
+                lastStatus = 1;
+            }
+            continue;
+        }
+        if (lsReadDir(dirFd, &list, showAll) != 0) {
+            perror("ls");  // Print error if the directory can't be read
+            lastStatus = 1;
+        } else {
+            if (numPaths > 1) {
+                printf("%s%s:\n", (first && numFiles == 0) ? "" : "\n", paths[i]);
+            }
+            lsPrint(dirFd, &list, longFormat, sortBy, 1);
+            first = 0;
+        }
+        lsFree(&list);
+        close(dirFd);
+    }
+}
+
+//+
+// Function:	hashFunc
+//
+// Purpose:	List or change the remembered command locations.
+//
+// Parameters:
+//	args[]	- Array of arguments, -r to forget all locations, -d name
+//		  to forget one, or names to look up and remember.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void hashFunc(char *args[], int nargs) {
+    if (nargs == 1) {
+        if (hashCount == 0) {
+            printf("hash: hash table empty\n");
+            return;
+        }
+        printf("hits\tcommand\n");
+        for (unsigned int i = 0; i < hashBuckets; i++) {
+            for (struct hashEntry *ent = hashTable[i]; ent != NULL; ent = ent->next) {
+                printf("%4d\t%s\n", ent->hits, ent->cmdPath);
+            }
+        }
+    } else if (strcmp(args[1], "-r") == 0) {
+        hashClear();
+    } else if (strcmp(args[1], "-d") == 0) {
+        for (int i = 2; i < nargs; i++) {
+            if (!hashRemove(args[i])) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                lastStatus = 1;
+            }
+        }
+    } else {
+        for (int i = 1; i < nargs; i++) {
+            if (strchr(args[i], '/') != NULL || findCommand(args[i]) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                lastStatus = 1;
+                continue;
+            }
+            // as in bash, an explicit hash resets the hit count
+            struct hashEntry *ent = hashLookup(args[i], hashString(args[i]));
+            if (ent != NULL) {
+                ent->hits = 0;
+            }
+        }
+    }
+}
+
+// a shell option changed by the set builtin. Numeric options have
+// no list of choices, the others take one of the names in the list
+// and store its index.
+struct optData {
+    char *	optName;
+    int *	optValue;
+    const char **	optChoices;
+};
+
+// must be terminated by {NULL, NULL, NULL}
+struct optData options[] = {
+    {"launch", &launchMethod, launchNames},
+    {"pipesize", &pipeSize, NULL},
+    {NULL, NULL, NULL}		// terminator
+};
+
+//+
+// Function:	setFunc
+//
+// Purpose:	List the shell options, or change one.
+//
+// Parameters:
+//	args[]	- Array of arguments, none to list, or the name and
+//		  the new value of an option.
+//	nargs	- Number of arguments (1 or 3).
+//
+// Returns	void
+//-
+
+void setFunc(char *args[], int nargs) {
+    if (nargs == 1) {
+        for (int i = 0; options[i].optName != NULL; i++) {
+            if (options[i].optChoices != NULL) {
+                printf("%s %s\n", options[i].optName, options[i].optChoices[*options[i].optValue]);
+            } else {
+                printf("%s %d\n", options[i].optName, *options[i].optValue);
+            }
+        }
+        return;
+    }
+    if (nargs != 3) {
+        fprintf(stderr, "set: usage: set [name value]\n");
+        lastStatus = 2;
+        return;
+    }
+
+    for (int i = 0; options[i].optName != NULL; i++) {
+        if (strcmp(args[1], options[i].optName) != 0) {
+            continue;
+        }
+        if (options[i].optChoices != NULL) {
+            for (int j = 0; options[i].optChoices[j] != NULL; j++) {
+                if (strcmp(args[2], options[i].optChoices[j]) == 0) {
+                    *options[i].optValue = j;
+                    return;
+                }
+            }
+            fprintf(stderr, "set: %s: invalid value '%s'\n", args[1], args[2]);
+            lastStatus = 1;
+        } else {
+            char *end;
+            long value = strtol(args[2], &end, 0);
+            if (*args[2] == '\0' || *end != '\0' || value < 0 || value > 0x7fffffff) {
+                fprintf(stderr, "set: %s: invalid value '%s'\n", args[1], args[2]);
+                lastStatus = 1;
+                return;
+            }
+            *options[i].optValue = value;
+        }
+        return;
+    }
+    fprintf(stderr, "set: %s: no such option\n", args[1]);
+    lastStatus = 1;
+}
+
+//+
+// Function:	jobsFunc
+//
+// Purpose:	List the background jobs. Finished jobs are listed
+//		once and then removed.
+//
+// Parameters:
+//	args[]	- Array of arguments (not used here).
+//	nargs	- Number of arguments (not used here).
+//
+// Returns	void
+//-
+
+void jobsFunc(char *args[], int nargs) {
+    char state[64];
+
+    reapChildren(WNOHANG);
+    for (int j = 0; j < jobTableSize; j++) {
+        struct job *job = jobTable[j];
+        if (job == NULL || !job->background) {
+            continue;
+        }
+        printf("[%d]  %-24s%s%s\n", job->jobId, jobState(job, state, sizeof(state)),
+               job->cmdText, job->numLive > 0 ? " &" : "");
+        if (job->numLive == 0) {
+            freeJob(job);
+        }
+    }
+}
+
+//+
+// Function:	fgFunc
+//
+// Purpose:	Bring a background job to the foreground, that is
+//		wait for it to finish.
+//
+// Parameters:
+//	args[]	- Array of arguments, args[1] is the optional job spec.
+//	nargs	- Number of arguments (1 or 2).
+//
+// Returns	void
+//-
+
+void fgFunc(char *args[], int nargs) {
+    struct job *job = findJob(nargs > 1 ? args[1] : NULL, "fg");
+    if (job == NULL) {
+        lastStatus = 1;
+        return;
+    }
+    printf("%s\n", job->cmdText);
+    fflush(stdout);
+    job->background = 0;
+    waitForJob(job);
+}
+
+//+
+// Function:	waitFunc
+//
+// Purpose:	Wait for background jobs. With no arguments waits for
+//		all of them, otherwise for the given jobs (%n) or
+//		process ids. The jobs are removed without a notice.
+//
+// Parameters:
+//	args[]	- Array of arguments, job specs or process ids.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void waitFunc(char *args[], int nargs) {
+    if (nargs == 1) {
+        for (int j = 0; j < jobTableSize; j++) {
+            if (jobTable[j] != NULL && jobTable[j]->background) {
+                waitForJob(jobTable[j]);
+            }
+        }
+        return;
     }
 
-    if (numEnts < 0) {
-        perror("ls");  // Print error if scandir fails
-    } else {
-        for (int i = 0; i < numEnts; i++) {
-            printf("%s\n", namelist[i]->d_name);  // Print each file/directory name
-            free(namelist[i]);  // Free memory for each dirent
+    for (int i = 1; i < nargs; i++) {
+        struct job *job = NULL;
+        if (args[i][0] == '%') {
+            job = findJob(args[i], "wait");
+        } else {
+            // a process id, find the job it belongs to
+            pid_t pid = atoi(args[i]);
+            for (int j = 0; j < jobTableSize && job == NULL; j++) {
+                for (int k = 0; jobTable[j] != NULL && k < jobTable[j]->numProcs; k++) {
+                    if (pid > 0 && jobTable[j]->procs[k].pid == pid && jobTable[j]->background) {
+                        job = jobTable[j];
+                    }
+                }
+            }
+            if (job == NULL) {
+                fprintf(stderr, "wait: pid %s is not a child of this shell\n", args[i]);
+            }
+        }
+        if (job != NULL) {
+            waitForJob(job);
+        } else {
+            lastStatus = 1;
+        }
+    }
+}
+
+// most children par keeps running, whatever -j says
+#define PAR_MAX_JOBS 4096
+
+// a running job of the par builtin
+struct parSlot {
+    struct job *	job;
+    int		outFd;		// captured output with -g, else -1
+};
+
+//+
+// Function:	parBuildArgs
+//
+// Purpose:	Build the arguments for one par job from the template,
+//		replacing {} with the input or appending the input if the
+//		template has no {}.
+//
+// Parameters:
+//	arena	- Arena for the new arguments.
+//	tmpl[]	- The command template.
+//	ntmpl	- Number of template arguments.
+//	input	- The input for this job.
+//
+// Returns	char **
+//		the null terminated arguments
+//-
+
+char ** parBuildArgs(struct arena *arena, char *tmpl[], int ntmpl, const char *input) {
+    char **jobArgs = arenaAlloc(arena, (ntmpl + 2) * sizeof(char *));
+    size_t inputLen = strlen(input);
+    int replaced = 0;
+
+    for (int i = 0; i < ntmpl; i++) {
+        char *brace = strstr(tmpl[i], "{}");
+        if (brace == NULL) {
+            jobArgs[i] = tmpl[i];
+            continue;
+        }
+        // count the {} so the new argument can be sized
+        int count = 0;
+        for (char *p = brace; (p = strstr(p, "{}")) != NULL; p += 2) {
+            count++;
+        }
+        char *arg = arenaAlloc(arena, strlen(tmpl[i]) + count * inputLen + 1);
+        char *out = arg;
+        char *from = tmpl[i];
+        for (char *p; (p = strstr(from, "{}")) != NULL; from = p + 2) {
+            memcpy(out, from, p - from);
+            out += p - from;
+            memcpy(out, input, inputLen);
+            out += inputLen;
+        }
+        strcpy(out, from);
+        jobArgs[i] = arg;
+        replaced = 1;
+    }
+    int n = ntmpl;
+    if (!replaced) {
+        jobArgs[n++] = (char *) input;
+    }
+    jobArgs[n] = NULL;
+    return jobArgs;
+}
+
+//+
+// Function:	parFinish
+//
+// Purpose:	Deal with a finished par job: copy its captured output to
+//		stdout in one piece (without passing through the shell)
+//		and free the job.
+//
+// Parameters:
+//	slot	- The slot of the job.
+//
+// Returns	int
+//		1 if the job failed, 0 if it succeeded.
+//-
+
+int parFinish(struct parSlot *slot) {
+    int failed = exitCode(slot->job->status) != 0;
+
+    if (slot->outFd >= 0) {
+        fflush(stdout);
+        lseek(slot->outFd, 0, SEEK_SET);
+        if (copyFdData(slot->outFd, 1) != 0) {
+            perror("par: output");
+        }
+        close(slot->outFd);
+        slot->outFd = -1;
+    }
+    freeJob(slot->job);
+    slot->job = NULL;
+    return failed;
+}
+
+//+
+// Function:	parFunc
+//
+// Purpose:	Run a command for each of a list of inputs, keeping up to
+//		N children running. Children are reaped as they finish and
+//		replaced with the next input. The command is looked up once
+//		through the command cache. The exit status is the number of
+//		jobs that failed (at most 253).
+//
+// Parameters:
+//	args[]	- Array of arguments, see the usage at the top of the file.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void parFunc(char *args[], int nargs) {
+    long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int groupOutput = 0;
+    char *inputFile = NULL;
+    int argi;
+
+    for (argi = 1; argi < nargs && args[argi][0] == '-'; argi++) {
+        if (strcmp(args[argi], "-j") == 0 && argi + 1 < nargs) {
+            maxJobs = atol(args[++argi]);
+        } else if (strcmp(args[argi], "-g") == 0) {
+            groupOutput = 1;
+        } else if (strcmp(args[argi], "-a") == 0 && argi + 1 < nargs) {
+            inputFile = args[++argi];
+        } else {
+            break;
+        }
+    }
+
+    // the template runs up to ::: if there is one
+    int ntmpl = 0;
+    while (argi + ntmpl < nargs && strcmp(args[argi + ntmpl], ":::") != 0) {
+        ntmpl++;
+    }
+    char **tmpl = &args[argi];
+    char **inputArgs = &args[argi + ntmpl];
+    int numInputArgs = nargs - argi - ntmpl;
+    if (numInputArgs > 0) {
+        // skip the :::
+        inputArgs++;
+        numInputArgs--;
+    }
+
+    if (ntmpl == 0 || maxJobs < 1 || (inputFile == NULL) == (argi + ntmpl == nargs)) {
+        fprintf(stderr, "par: usage: par [-j N] [-g] [-a file] command args [::: inputs]\n");
+        lastStatus = 255;
+        return;
+    }
+    // no more slots than there are inputs to fill them
+    if (maxJobs > PAR_MAX_JOBS) {
+        maxJobs = PAR_MAX_JOBS;
+    }
+    if (inputFile == NULL && maxJobs > numInputArgs) {
+        maxJobs = numInputArgs > 0 ? numInputArgs : 1;
+    }
+
+    // look the command up once, unless it changes with the input
+    char *cmdPath = NULL;
+    if (strstr(tmpl[0], "{}") == NULL && (cmdPath = findCommand(tmpl[0])) == NULL) {
+        fprintf(stderr, "par: %s: command not found\n", tmpl[0]);
+        lastStatus = 127;
+        return;
+    }
+    // the cache entry may be replaced by later lookups, keep a copy
+    char cmdPathCopy[CMD_BUFFSIZE];
+    if (cmdPath != NULL) {
+        snprintf(cmdPathCopy, sizeof(cmdPathCopy), "%s", cmdPath);
+        cmdPath = cmdPathCopy;
+    }
+
+    struct parSlot *slots = calloc(maxJobs, sizeof(struct parSlot));
+    if (slots == NULL) {
+        fprintf(stderr, "par: usage: par [-j N] [-g] [-a file] command args [::: inputs]\n");
+        lastStatus = 255;
+        return;
+    }
+
+    struct lineReader input;
+    int inputFd = -1;
+    if (inputFile != NULL) {
+        inputFd = strcmp(inputFile, "-") == 0 ? 0 : open(inputFile, O_RDONLY | O_CLOEXEC);
+        if (inputFd < 0) {
+            fprintf(stderr, "par: %s: %s\n", inputFile, strerror(errno));
+            free(slots);
+            lastStatus = 255;
+            return;
+        }
+        openReader(&input, inputFd);
+    }
+
+    struct arena jobArena = {NULL, NULL};
+    int nextInputArg = 0;
+    int running = 0;
+    int moreInput = 1;
+    long numFailed = 0;
+
+    while (moreInput || running > 0) {
+        // start jobs until all slots are busy
+        while (moreInput && running < maxJobs) {
+            char *item = NULL;
+            if (inputFd >= 0) {
+                while ((item = nextLine(&input)) == NULL && !input.eof) {
+                    fillReader(&input);
+                }
+            } else if (nextInputArg < numInputArgs) {
+                item = inputArgs[nextInputArg++];
+            }
+            if (item == NULL) {
+                moreInput = 0;
+                break;
+            }
+
+            arenaReset(&jobArena);
+            char **jobArgs = parBuildArgs(&jobArena, tmpl, ntmpl, item);
+            char *jobPath = cmdPath ? cmdPath : findCommand(jobArgs[0]);
+            if (jobPath == NULL) {
+                fprintf(stderr, "par: %s: command not found\n", jobArgs[0]);
+                numFailed++;
+                continue;
+            }
+
+            int slot;
+            for (slot = 0; slots[slot].job != NULL; slot++);
+            int childFd[3] = {-1, -1, -1};
+            slots[slot].outFd = -1;
+            if (groupOutput) {
+                slots[slot].outFd = memfd_create("par", MFD_CLOEXEC);
+                childFd[1] = slots[slot].outFd;
+            }
+            pid_t pid = launchCommand(jobPath, jobArgs, groupOutput ? childFd : NULL);
+            if (pid < 0) {
+                if (slots[slot].outFd >= 0) {
+                    close(slots[slot].outFd);
+                }
+                numFailed++;
+                continue;
+            }
+            int njobArgs = 0;
+            while (jobArgs[njobArgs] != NULL) {
+                njobArgs++;
+            }
+            slots[slot].job = newJob(jobArgs, njobArgs, 0);
+            addJobProcess(slots[slot].job, pid, jobArgs[0]);
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        // block until something exits, then collect every finished job
+        if (reapChildren(0) == 0) {
+            break;
+        }
+        for (int slot = 0; slot < maxJobs; slot++) {
+            if (slots[slot].job != NULL && slots[slot].job->numLive == 0) {
+                numFailed += parFinish(&slots[slot]);
+                running--;
+            }
+        }
+    }
+
+    // jobs left if reaping stopped early
+    for (int slot = 0; slot < maxJobs; slot++) {
+        if (slots[slot].job != NULL) {
+            if (slots[slot].outFd >= 0) {
+                close(slots[slot].outFd);
+            }
+            freeJob(slots[slot].job);
+        }
+    }
+    if (inputFd > 0) {
+        close(inputFd);
+    }
+    if (inputFd >= 0) {
+        if (input.mapped) {
+            munmap(input.buf, input.size);
+        } else {
+            free(input.buf);
+        }
+        free(input.lastLine);
+    }
+    for (struct arenaBlock *block = jobArena.first, *next; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(slots);
+    lastStatus = numFailed > 253 ? 253 : numFailed;
+}
+
+//+
+// Function:	statsFunc
+//
+// Purpose:	Print the statistics of the external commands run this
+//		session, or the histograms of the named commands.
+//
+// Parameters:
+//	args[]	- Array of arguments, -r to clear, or command names.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void statsFunc(char *args[], int nargs) {
+    char mean[16], p50[16], p90[16], p99[16], max[16];
+
+    if (nargs > 1 && strcmp(args[1], "-r") == 0) {
+        for (int i = 0; i < STATS_HASH_SIZE; i++) {
+            while (statsTable[i] != NULL) {
+                struct cmdStats *next = statsTable[i]->next;
+                free(statsTable[i]);
+                statsTable[i] = next;
+            }
+        }
+        return;
+    }
+
+    if (nargs > 1) {
+        for (int i = 1; i < nargs; i++) {
+            unsigned int h = hashString(args[i]);
+            struct cmdStats *st;
+            for (st = statsTable[h % STATS_HASH_SIZE]; st != NULL; st = st->next) {
+                if (st->hashVal == h && strcmp(st->cmdName, args[i]) == 0) {
+                    break;
+                }
+            }
+            if (st == NULL) {
+                fprintf(stderr, "stats: %s: no runs recorded\n", args[i]);
+                lastStatus = 1;
+            } else {
+                printHistogram(st);
+            }
+        }
+        return;
+    }
+
+    printf("%-16s %7s %8s %8s %8s %8s %8s %9s %9s %9s %8s\n", "command", "runs", "mean", "p50",
+           "p90", "p99", "max", "user", "sys", "maxrss", "csw");
+    for (int i = 0; i < STATS_HASH_SIZE; i++) {
+        for (struct cmdStats *st = statsTable[i]; st != NULL; st = st->next) {
+            printf("%-16s %7ld %8s %8s %8s %8s %8s %8.3fs %8.3fs %7ldkB %8ld\n", st->cmdName, st->count,
+                   formatSeconds(st->wallTotal / st->count, mean, sizeof(mean)),
+                   formatSeconds(statsPercentile(st, 50), p50, sizeof(p50)),
+                   formatSeconds(statsPercentile(st, 90), p90, sizeof(p90)),
+                   formatSeconds(statsPercentile(st, 99), p99, sizeof(p99)),
+                   formatSeconds(st->wallMax, max, sizeof(max)),
+                   st->usage.ru_utime.tv_sec + st->usage.ru_utime.tv_usec / 1e6,
+                   st->usage.ru_stime.tv_sec + st->usage.ru_stime.tv_usec / 1e6,
+                   st->usage.ru_maxrss, st->usage.ru_nvcsw + st->usage.ru_nivcsw);
         }
-        free(namelist);  // Free the namelist array
     }
-}
\ No newline at end of file
+}
+
+//+
+// Function:	copyFdData
+//
+// Purpose:	Copy everything from one descriptor to another inside the
+//		kernel. splice is used when either end is a pipe,
+//		copy_file_range between regular files and sendfile for the
+//		rest. If the kernel refuses (e.g. an O_APPEND output, or
+//		files on different filesystems) it falls back to the next
+//		method, and last of all to read and write.
+//
+// Parameters:
+//	inFd	- Descriptor to read from, from its current offset.
+//	outFd	- Descriptor to write to.
+//
+// Returns	int
+//		0 on success, -1 with errno set on error.
+//-
+
+int copyFdData(int inFd, int outFd) {
+    struct stat inStat, outStat;
+    // as much as the kernel will take in one call
+    const size_t chunk = 1 << 30;
+    ssize_t n;
+
+    if (fstat(inFd, &inStat) != 0 || fstat(outFd, &outStat) != 0) {
+        return -1;
+    }
+
+    if (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode)) {
+        while ((n = splice(inFd, NULL, outFd, NULL, chunk, SPLICE_F_MORE)) > 0);
+        if (n == 0) {
+            return 0;
+        }
+        // nothing has been copied if the first call failed like this
+        if (errno != EINVAL && errno != ENOSYS) {
+            return -1;
+        }
+    }
+
+    if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)) {
+        while ((n = copy_file_range(inFd, NULL, outFd, NULL, chunk, 0)) > 0);
+        if (n == 0) {
+            return 0;
+        }
+        if (errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EBADF && errno != EOPNOTSUPP) {
+            return -1;
+        }
+    }
+
+    if (S_ISREG(inStat.st_mode)) {
+        while ((n = sendfile(outFd, inFd, NULL, chunk)) > 0);
+        if (n == 0) {
+            return 0;
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+            return -1;
+        }
+    }
+
+    char buf[65536];
+    while ((n = read(inFd, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0, w; done < n; done += w) {
+            if ((w = write(outFd, buf + done, n - done)) < 0) {
+                return -1;
+            }
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+//+
+// Function:	catFunc
+//
+// Purpose:	Copy files, or stdin if there are none, to stdout.
+//
+// Parameters:
+//	args[]	- Array of arguments, the files to copy ("-" for stdin).
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void catFunc(char *args[], int nargs) {
+    char *stdinArgs[] = {"cat", "-", NULL};
+    int failed = 0;
+
+    if (nargs == 1) {
+        args = stdinArgs;
+        nargs = 2;
+    }
+    // anything the shell printed must come first
+    fflush(stdout);
+
+    for (int i = 1; i < nargs; i++) {
+        int fd = strcmp(args[i], "-") == 0 ? 0 : open(args[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            failed = 1;
+            continue;
+        }
+        if (copyFdData(fd, 1) != 0) {
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            failed = 1;
+        }
+        if (fd != 0) {
+            close(fd);
+        }
+    }
+    lastStatus = failed;
+}
+
+//+
+// Function:	historyFunc
+//
+// Purpose:	List recent history entries, or search the history.
+//
+// Parameters:
+//	args[]	- Array of arguments, a count, or -s and the text to find.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void historyFunc(char *args[], int nargs) {
+    size_t len;
+    const char *entry;
+
+    if (!histSync()) {
+        fprintf(stderr, "history: not available\n");
+        lastStatus = 1;
+        return;
+    }
+    int64_t count = hist.numEntries;
+
+    if (nargs == 3 && strcmp(args[1], "-s") == 0) {
+        // collect the matches newest first, print them oldest first
+        int64_t numFound = 0, maxFound = 0;
+        int64_t *found = NULL;
+        for (int64_t n = histFind(args[2], 0, count); n >= 0; n = histFind(args[2], 0, n)) {
+            if (numFound == maxFound) {
+                maxFound = maxFound ? 2 * maxFound : 64;
+                int64_t *newFound = realloc(found, maxFound * sizeof(int64_t));
+                if (newFound == NULL) {
+                    break;
+                }
+                found = newFound;
+            }
+            found[numFound++] = n;
+        }
+        for (int64_t i = numFound - 1; i >= 0; i--) {
+            if ((entry = histEntry(found[i], &len)) == NULL) {
+                continue;
+            }
+            printf("%5lld  %.*s\n", (long long) found[i] + 1, (int) len, entry);
+        }
+        free(found);
+        lastStatus = numFound == 0;
+        return;
+    }
+
+    int64_t show = HIST_SHOW_DEFAULT;
+    if (nargs == 2) {
+        show = atoll(args[1]);
+    } else if (nargs > 2) {
+        fprintf(stderr, "history: usage: history [N | -s text]\n");
+        lastStatus = 2;
+        return;
+    }
+    for (int64_t n = (count > show) ? count - show : 0; n < count; n++) {
+        if ((entry = histEntry(n, &len)) != NULL) {
+            printf("%5lld  %.*s\n", (long long) n + 1, (int) len, entry);
+        }
+    }
+    lastStatus = 0;
+}
+
+//+
+// Function:	loadFunc
+//
+// Purpose:	Load builtin plugins, or list those loaded. A plugin
+//		stays loaded until the shell exits, since its commands
+//		are in the builtin table.
+//
+// Parameters:
+//	args[]	- Array of arguments, the plugin files. A name without a
+//		  / is searched for as dlopen does (LD_LIBRARY_PATH etc).
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+// plugins loaded, in order
+char ** loadedPlugins = NULL;
+int numLoadedPlugins = 0;
+
+void loadFunc(char *args[], int nargs) {
+    static const struct shellPluginApi api = {
+        SHELL_PLUGIN_VERSION,
+        registerBuiltin,
+        &lastStatus
+    };
+
+    if (nargs == 1) {
+        for (int i = 0; i < numLoadedPlugins; i++) {
+            printf("%s\n", loadedPlugins[i]);
+        }
+        lastStatus = 0;
+        return;
+    }
+
+    lastStatus = 0;
+    for (int i = 1; i < nargs; i++) {
+        void *handle = dlopen(args[i], RTLD_NOW | RTLD_LOCAL);
+        if (handle == NULL) {
+            fprintf(stderr, "load: %s\n", dlerror());
+            lastStatus = 1;
+            continue;
+        }
+        int (*init)(const struct shellPluginApi *) = (int (*)(const struct shellPluginApi *)) dlsym(handle, SHELL_PLUGIN_INIT);
+        if (init == NULL) {
+            fprintf(stderr, "load: %s: no %s\n", args[i], SHELL_PLUGIN_INIT);
+            dlclose(handle);
+            lastStatus = 1;
+            continue;
+        }
+        if (builtinBuckets == 0) {
+            initBuiltins();
+        }
+        // commands it registers before failing stay registered, so
+        // the plugin can't be unloaded either way
+        if (init(&api) != 0) {
+            fprintf(stderr, "load: %s: initialisation failed\n", args[i]);
+            lastStatus = 1;
+            continue;
+        }
+        char **newLoaded = realloc(loadedPlugins, (numLoadedPlugins + 1) * sizeof(char *));
+        if (newLoaded != NULL) {
+            loadedPlugins = newLoaded;
+            loadedPlugins[numLoadedPlugins++] = strdup(args[i]);
+        }
+    }
+}
+
+//+
+// Function:	sourceFunc
+//
+// Purpose:	Run a script in this shell, so that the variables it
+//		sets and directory it changes to stay set. It is loaded
+//		through the script cache like any script.
+//
+// Parameters:
+//	args[]	- Array of arguments, the script then its arguments,
+//		  which are $1... while it runs.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void sourceFunc(char *args[], int nargs) {
+    if (nargs < 2) {
+        fprintf(stderr, "source: usage: source file [args]\n");
+        lastStatus = 2;
+        return;
+    }
+    struct program *prog = loadScript(args[1]);
+    if (prog == NULL) {
+        return;
+    }
+    char **savedArgs = scriptArgs;
+    int savedNum = numScriptArgs;
+    if (nargs > 2) {
+        // $0 stays the shell's
+        args[1] = scriptArgs[0];
+        scriptArgs = args + 1;
+        numScriptArgs = nargs - 1;
+    }
+    lastStatus = 0;
+    runProgram(prog);
+    freeProgram(prog);
+    scriptArgs = savedArgs;
+    numScriptArgs = savedNum;
+}
+
+//+
+// Function:	exportFunc
+//
+// Purpose:	Put variables in the environment of commands the shell
+//		runs.
+//
+// Parameters:
+//	args[]	- Array of arguments, each name (exporting the shell
+//		  variable) or name=value.
+//	nargs	- Number of arguments.
+//
+// Returns	void
+//-
+
+void exportFunc(char *args[], int nargs) {
+    lastStatus = 0;
+    for (int i = 1; i < nargs; i++) {
+        size_t len = isVarName(args[i]);
+        if (len == 0 || (args[i][len] != '\0' && args[i][len] != '=')) {
+            fprintf(stderr, "export: %s: not a valid name\n", args[i]);
+            lastStatus = 1;
+            continue;
+        }
+        if (args[i][len] == '=') {
+            args[i][len] = '\0';
+            setVar(args[i], args[i] + len + 1);
+        }
+        struct variable *var = findVar(args[i], len);
+        if (var != NULL && setenv(args[i], var->value, 1) != 0) {
+            perror("export");
+            lastStatus = 1;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+//+
+// File:	shellplugin.h
+//
+// Purpose:	Interface between the shell and builtin plugins. A plugin is
+//		a shared object loaded with the shell's load builtin; the
+//		shell calls its shellPluginInit, which registers the plugin's
+//		commands. They then run inside the shell like any other
+//		builtin, with no fork or exec.
+//
+//		A plugin command is called with the command's arguments
+//		(args[0] is its name, args[nargs] is NULL) after its
+//		redirections have been applied, and sets *api->lastStatus to
+//		its exit status. It must not exit or keep pointers to args.
+//
+//		Build a plugin with: cc -shared -fPIC -o name.so name.c
+//-
+
+#ifndef SHELLPLUGIN_H
+#define SHELLPLUGIN_H
+
+// changed whenever struct shellPluginApi changes incompatibly
+#define SHELL_PLUGIN_VERSION 1
+
+// name of the function each plugin must define
+#define SHELL_PLUGIN_INIT "shellPluginInit"
+
+typedef void (*shellCommandFunction)(char * args[], int nargs);
+
+struct shellPluginApi {
+    int		version;	// SHELL_PLUGIN_VERSION of the shell
+    // add a builtin, replacing any builtin of the same name.
+    // Returns 0, or -1 if out of memory.
+    int		(*registerBuiltin)(const char * name, shellCommandFunction func);
+    int *	lastStatus;	// exit status of the last command
+};
+
+//+
+// Function:	shellPluginInit
+//
+// Purpose:	Defined by each plugin, called once when it is loaded.
+//
+// Parameters:
+//	api	- The shell's interface, which stays valid while the
+//		  shell runs.
+//
+// Returns	int
+//		0 on success, anything else makes load fail.
+//-
+
+int shellPluginInit(const struct shellPluginApi * api);
+
+#endif
@@ -0,0 +1,198 @@
+//+
+// File:	test.c
+//
+// Purpose:	Checks of the shell's word expansion. shell.c is included
+//		directly, with its main compiled out, as in bench.c, so
+//		that command lines can be split and compared with the
+//		arguments they should give. The checks run in a scratch
+//		directory holding g/a, g/b and x.dat, and cover patterns
+//		and the splitting of variable values into fields, and
+//		short programs are run to check what they print. The
+//		history is checked against another shell appending.
+//
+//		Each failure is reported on stderr, and the exit status is
+//		the number of failures.
+//
+//		usage: shelltest
+//-
+
+#define SHELL_NO_MAIN
+#include "shell.c"
+
+int testFailures = 0;
+
+//+
+// Function:	checkSplit
+//
+// Purpose:	Split a command line and compare the arguments, joined
+//		with a space and each in [], with the expected text.
+//
+// Parameters:
+//	line	- The command line.
+//	expect	- The arguments expected, such as "[echo] [g/a]".
+//
+// Returns	void
+//-
+
+void checkSplit(const char *line, const char *expect) {
+    struct arena arena = {NULL, NULL};
+    char *work = strdup(line);
+    char **args;
+    char got[1024] = "";
+    size_t used = 0;
+
+    int nargs = splitCommandLine(work, &arena, &args);
+    for (int i = 0; i < nargs && used < sizeof(got); i++) {
+        used += snprintf(got + used, sizeof(got) - used, "%s[%s]", i ? " " : "", args[i]);
+    }
+    if (strcmp(got, expect) != 0) {
+        fprintf(stderr, "shelltest: %s\n  expected %s\n  got      %s\n", line, expect, got);
+        testFailures++;
+    }
+    arenaFree(&arena);
+    free(work);
+}
+
+//+
+// Function:	checkRun
+//
+// Purpose:	Compile and run shell source with stdout going to a
+//		scratch file, and compare what it printed with the
+//		expected text.
+//
+// Parameters:
+//	source	- The source.
+//	expect	- The output expected.
+//
+// Returns	void
+//-
+
+void checkRun(const char *source, const char *expect) {
+    char *work = strdup(source);
+    char got[1024];
+    int incomplete;
+
+    fflush(stdout);
+    int saved = dup(1);
+    int fd = open("out", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, 1);
+    struct program *prog = compileSource(work, "checkRun", &incomplete);
+    if (prog != NULL) {
+        runProgram(prog);
+        freeProgram(prog);
+    }
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    ssize_t n = pread(fd, got, sizeof(got) - 1, 0);
+    got[n > 0 ? n : 0] = '\0';
+    close(fd);
+    unlink("out");
+    if (strcmp(got, expect) != 0) {
+        fprintf(stderr, "shelltest: %s\n  expected %s  got      %s", source, expect, got);
+        testFailures++;
+    }
+    free(work);
+}
+
+int main(void) {
+    char dir[] = "/tmp/shelltestXXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        perror("shelltest");
+        return 1;
+    }
+    mkdir("g", 0700);
+    close(open("g/a", O_WRONLY | O_CREAT, 0600));
+    close(open("g/b", O_WRONLY | O_CREAT, 0600));
+    close(open("x.dat", O_WRONLY | O_CREAT, 0600));
+
+    // patterns
+    checkSplit("echo g/*", "[echo] [g/a] [g/b]");
+    checkSplit("echo *.dat", "[echo] [x.dat]");
+    checkSplit("echo '*.dat'", "[echo] [*.dat]");
+    // a pattern that matches nothing is left whole, directory and all
+    checkSplit("echo g/nomatch*", "[echo] [g/nomatch*]");
+    checkSplit("echo /nonexistdir/*", "[echo] [/nonexistdir/*]");
+    checkSplit("rm -r g/*.tmp", "[rm] [-r] [g/*.tmp]");
+
+    // unquoted values are split into fields, and the fields matched
+    setVar("x", "a b");
+    setVar("y", "*.dat");
+    setVar("e", "");
+    checkSplit("echo $x", "[echo] [a] [b]");
+    checkSplit("echo \"$x\"", "[echo] [a b]");
+    checkSplit("echo $y", "[echo] [x.dat]");
+    checkSplit("echo \"$y\"", "[echo] [*.dat]");
+    checkSplit("echo pre$x", "[echo] [prea] [b]");
+    checkSplit("echo \"a  b\"$e", "[echo] [a  b]");
+    checkSplit("echo $e end", "[echo] [end]");
+    checkSplit("echo \"$e\" end", "[echo] [] [end]");
+    checkSplit("echo '$x' \\$x", "[echo] [$x] [$x]");
+
+    initSearchPath();
+    initJobs();
+
+    // a builtin that fails takes the else branch
+    checkRun("if ls /nonexistent 2>/dev/null; then echo yes; else echo no $?; fi\n", "no 1\n");
+    checkRun("ls -Z 2>/dev/null; echo $?\n", "2\n");
+    checkRun("if hash nosuchcmd 2>/dev/null; then echo yes; else echo no; fi\n", "no\n");
+    checkRun("set bogus 1 2>/dev/null; echo $?; set bogus 2>/dev/null; echo $?\n", "1\n2\n");
+    checkRun("wait 99999 2>/dev/null; echo $?; fg 2>/dev/null; echo $?\n", "1\n1\n");
+    checkRun("if pwd >/dev/null; then echo yes; fi\n", "yes\n");
+
+    // a huge -j is capped rather than ending the shell
+    checkRun("par -j 100000000000000 echo ::: a; echo $?\n", "a\n0\n");
+
+    // & ends a command as ; does
+    checkRun("true & echo x\n", "x\n");
+    checkRun("for f in a b; do true & echo $f; done\n", "a\nb\n");
+
+    // a construct that runs no body succeeds, and a loop has the
+    // status of the last body command it ran
+    checkRun("while false; do :; done; echo $?\n", "0\n");
+    checkRun("x=; while test -z \"$x\"; do x=1; false; done; echo $?\n", "1\n");
+    checkRun("false; for f in; do :; done; echo $?\n", "0\n");
+    checkRun("if false; then :; fi; echo $?\n", "0\n");
+    checkRun("while true; do false; break; done; echo $?\n", "0\n");
+
+    // finished background jobs are freed between commands, so the job
+    // table doesn't grow past its first size
+    checkRun("for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do true & sleep 0.05; done\n", "");
+    if (jobTableSize > 16) {
+        fprintf(stderr, "shelltest: finished jobs not freed, job table has %d slots\n", jobTableSize);
+        testFailures++;
+    }
+
+    // another shell appending after the lock is dropped doesn't
+    // change the entries this shell looks up
+    char histPath[sizeof(dir) + 8];
+    snprintf(histPath, sizeof(histPath), "%s/hist", dir);
+    setenv("HISTFILE", histPath, 1);
+    histAdd("echo one");
+    int fd = open(histPath, O_WRONLY | O_APPEND);
+    if (write(fd, "other\n", 6) != 6) {
+        perror(histPath);
+    }
+    close(fd);
+    hist.index->logSize += 6;
+    size_t len;
+    const char *entry = histEntry(0, &len);
+    if (entry == NULL || len != 8 || memcmp(entry, "echo one", 8) != 0 || histEntry(1, &len) != NULL) {
+        fprintf(stderr, "shelltest: history entry changed by another shell's append\n");
+        testFailures++;
+    }
+    unlink("hist");
+    unlink("hist.idx");
+
+    unlink("g/a");
+    unlink("g/b");
+    unlink("x.dat");
+    rmdir("g");
+    if (chdir("/") != 0 || rmdir(dir) != 0) {
+        perror(dir);
+    }
+    if (testFailures == 0) {
+        printf("shelltest: all passed\n");
+    }
+    return testFailures;
+}
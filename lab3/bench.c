@@ -0,0 +1,281 @@
+//
+//  bench.c
+//  Lab3Test2
+//
+//  Benchmark sweep for main. Generates input files with gen in a
+//  scratch directory, then runs main once for each combination of
+//  queue, wait strategy, producers, consumers, capacity and batch,
+//  with -s csv, and
+//  collects the statistics line of each run: records a second, latency
+//  percentiles and CPU use. Combinations a queue can't run (spsc with
+//  more than one thread a side, mpsc with more than one consumer) are
+//  skipped.
+//
+//  The results are written as CSV, one run per line after a header,
+//  or as a JSON array with -j.
+//
+//  Usage: lab3bench [-j] [-m main] [-g gen] [-n lines] [-d distribution]
+//                   [-q queues] [-P producers] [-C consumers]
+//                   [-c capacities] [-b batches] [-W waits] [-x options]
+//  where main and gen are the programs to run (default ./lab3 and
+//  ./gen), lines is the number of values per producer (default
+//  1000000), distribution is passed to gen, each list is comma
+//  separated, and options are more options for every run of main,
+//  such as "-O -p cpu".
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#define MAX_LIST 32
+
+// test number of the generated files, t<BENCH_TEST><n>.dat
+#define BENCH_TEST 9
+
+// output as JSON rather than CSV
+int benchJson = 0;
+int benchResults = 0;
+
+//+
+// Function: parseList
+//
+// Purpose:  Split a comma separated list into up to MAX_LIST words, in
+//           place. Returns the number of words.
+//-
+
+int parseList(char *list, char *words[]){
+    int n = 0;
+    for (char *word = strtok(list, ","); word != NULL; word = strtok(NULL, ",")){
+        if (n == MAX_LIST){
+            fprintf(stderr, "at most %d values in a list\n", MAX_LIST);
+            exit(1);
+        }
+        words[n++] = word;
+    }
+    return n;
+}
+
+//+
+// Function: run
+//
+// Purpose:  Run a command and check that it succeeded, keeping its
+//           first two lines of output (the statistics header and
+//           values) when header and values aren't NULL.
+//-
+
+void run(const char *command, char *header, char *values, size_t size){
+    FILE *out = popen(command, "r");
+    if (out == NULL){
+        perror(command);
+        exit(1);
+    }
+    if (header != NULL && (fgets(header, size, out) == NULL || fgets(values, size, out) == NULL)){
+        fprintf(stderr, "no statistics from: %s\n", command);
+        exit(1);
+    }
+    // let it finish
+    char discard[256];
+    while (fgets(discard, sizeof(discard), out) != NULL){
+    }
+    int status = pclose(out);
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "failed: %s\n", command);
+        exit(1);
+    }
+}
+
+//+
+// Function: benchReport
+//
+// Purpose:  Write the statistics of one run, from main's CSV header
+//           and values.
+//-
+
+void benchReport(char *header, char *values){
+    header[strcspn(header, "\n")] = '\0';
+    values[strcspn(values, "\n")] = '\0';
+    if (!benchJson){
+        if (benchResults == 0){
+            printf("%s\n", header);
+        }
+        printf("%s\n", values);
+    } else {
+        char *names[MAX_LIST];
+        char *fields[MAX_LIST];
+        int n = parseList(header, names);
+        if (parseList(values, fields) != n){
+            fprintf(stderr, "statistics don't match their header\n");
+            exit(1);
+        }
+        printf("%s\n  {", benchResults ? "," : "[");
+        for (int i = 0; i < n; i++){
+            // numbers as they are, anything else as a string
+            char *end;
+            strtod(fields[i], &end);
+            const char *quote = *end == '\0' && end != fields[i] ? "" : "\"";
+            printf("%s\"%s\": %s%s%s", i ? ", " : "", names[i], quote, fields[i], quote);
+        }
+        printf("}");
+    }
+    benchResults++;
+    fflush(stdout);
+}
+
+//+
+// Function: removeFiles
+//
+// Purpose:  Remove the files main and gen made, named prefix<n>.dat.
+//-
+
+void removeFiles(const char *prefix, int count){
+    char name[64];
+    for (int i = 0; i < count; i++){
+        snprintf(name, sizeof(name), "%s%d.dat", prefix, i);
+        unlink(name);
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const char *mainProg = "./lab3";
+    const char *genProg = "./gen";
+    long long lines = 1000000;
+    const char *dist = "uniform";
+    const char *extra = "";
+    char queueList[256] = "mutex,mpmc,spsc,mpsc,sharded";
+    char prodList[256] = "1,4";
+    char consList[256] = "1,4";
+    char capList[256] = "64,4096";
+    char batchList[256] = "64";
+    char waitList[256] = "cond";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jm:g:n:d:q:P:C:c:b:W:x:")) != -1){
+        switch (opt){
+        case 'j':
+            benchJson = 1;
+            break;
+        case 'm':
+            mainProg = optarg;
+            break;
+        case 'g':
+            genProg = optarg;
+            break;
+        case 'n':
+            if ((lines = atoll(optarg)) <= 0){
+                fprintf(stderr, "lines must be greater than 0, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            dist = optarg;
+            break;
+        case 'q':
+            snprintf(queueList, sizeof(queueList), "%s", optarg);
+            break;
+        case 'P':
+            snprintf(prodList, sizeof(prodList), "%s", optarg);
+            break;
+        case 'C':
+            snprintf(consList, sizeof(consList), "%s", optarg);
+            break;
+        case 'c':
+            snprintf(capList, sizeof(capList), "%s", optarg);
+            break;
+        case 'b':
+            snprintf(batchList, sizeof(batchList), "%s", optarg);
+            break;
+        case 'W':
+            snprintf(waitList, sizeof(waitList), "%s", optarg);
+            break;
+        case 'x':
+            extra = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j] [-m main] [-g gen] [-n lines] [-d distribution] [-q queues] [-P producers] [-C consumers] [-c capacities] [-b batches] [-W waits] [-x options]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    char *queues[MAX_LIST], *prods[MAX_LIST], *conss[MAX_LIST], *caps[MAX_LIST], *batches[MAX_LIST], *waits[MAX_LIST];
+    int numQueues = parseList(queueList, queues);
+    int numProds = parseList(prodList, prods);
+    int numConss = parseList(consList, conss);
+    int numCaps = parseList(capList, caps);
+    int numBatches = parseList(batchList, batches);
+    int numWaits = parseList(waitList, waits);
+    int maxProducers = 0, maxConsumers = 0;
+    for (int i = 0; i < numProds; i++){
+        if (atoi(prods[i]) > maxProducers){
+            maxProducers = atoi(prods[i]);
+        }
+    }
+    for (int i = 0; i < numConss; i++){
+        if (atoi(conss[i]) > maxConsumers){
+            maxConsumers = atoi(conss[i]);
+        }
+    }
+    if (maxProducers <= 0 || maxConsumers <= 0){
+        fprintf(stderr, "need at least one producer and consumer\n");
+        exit(1);
+    }
+
+    // the programs are run from the scratch directory
+    char mainPath[PATH_MAX], genPath[PATH_MAX];
+    if (realpath(mainProg, mainPath) == NULL){
+        perror(mainProg);
+        exit(1);
+    }
+    if (realpath(genProg, genPath) == NULL){
+        perror(genProg);
+        exit(1);
+    }
+    char dir[] = "/tmp/lab3benchXXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0){
+        perror(dir);
+        exit(1);
+    }
+
+    char command[PATH_MAX + 512];
+    char prefix[32];
+    snprintf(command, sizeof(command), "'%s' -n %lld -d %s %d %d", genPath, lines, dist, BENCH_TEST, maxProducers);
+    run(command, NULL, NULL, 0);
+
+    char header[1024], values[1024];
+    for (int q = 0; q < numQueues; q++){
+        for (int p = 0; p < numProds; p++){
+            for (int c = 0; c < numConss; c++){
+                int producers = atoi(prods[p]), consumers = atoi(conss[c]);
+                if ((strcmp(queues[q], "spsc") == 0 && (producers > 1 || consumers > 1))
+                        || (strcmp(queues[q], "mpsc") == 0 && consumers > 1)){
+                    continue;
+                }
+                for (int k = 0; k < numCaps; k++){
+                    for (int b = 0; b < numBatches; b++){
+                        for (int w = 0; w < numWaits; w++){
+                            snprintf(command, sizeof(command), "'%s' -v off -s csv -q %s -W %s -c %s -b %s %s %d %d %d",
+                                     mainPath, queues[q], waits[w], caps[k], batches[b], extra, BENCH_TEST, producers, consumers);
+                            run(command, header, values, sizeof(header));
+                            benchReport(header, values);
+                            snprintf(prefix, sizeof(prefix), "out%d", BENCH_TEST);
+                            removeFiles(prefix, consumers > producers ? consumers : producers);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (benchJson && benchResults > 0){
+        printf("\n]\n");
+    }
+
+    snprintf(prefix, sizeof(prefix), "t%d", BENCH_TEST);
+    removeFiles(prefix, maxProducers);
+    if (chdir("/") != 0 || rmdir(dir) != 0){
+        perror(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+//
+//  bintotext.c
+//  Lab3Test2
+//
+//  Converts the binary output files of main -o binary back into text,
+//  one value per line, the same as main writes without -o binary.
+//
+//  Usage: bintotext [file...]
+//  The files (or stdin) are converted in turn and written to stdout.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// start of a binary output file, as main writes it
+#define OUTPUT_MAGIC "L3B1"
+struct outputHeader {
+    char magic[4];
+    uint32_t recordSize;	// bytes per value
+};
+
+#define RECORDS 65536		// values read at a time
+
+//+
+// Function: convert
+//
+// Purpose:  Convert one binary file to text on stdout. Returns 0, or 1
+//           if it isn't a binary output file or is cut short.
+//-
+
+int convert(FILE *in, const char *name){
+    struct outputHeader header;
+    static int32_t values[RECORDS];
+    size_t n;
+
+    if (fread(&header, sizeof(header), 1, in) != 1
+            || memcmp(header.magic, OUTPUT_MAGIC, sizeof(header.magic)) != 0
+            || header.recordSize != sizeof(int32_t)){
+        fprintf(stderr, "%s: not a binary output file\n", name);
+        return 1;
+    }
+    // read bytes, so a partial value at the end is seen
+    size_t left = 0;
+    while ((n = fread((char *)values + left, 1, sizeof(values) - left, in)) > 0){
+        n += left;
+        for (size_t i = 0; i < n / sizeof(int32_t); i++){
+            printf("%d\n", values[i]);
+        }
+        left = n % sizeof(int32_t);
+        memmove(values, (char *)values + n - left, left);
+    }
+    if (ferror(in)){
+        perror(name);
+        return 1;
+    }
+    if (left != 0){
+        fprintf(stderr, "%s: truncated\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+//+
+// Function: main
+//
+// Purpose:  Convert each file named on the command line, or stdin.
+//-
+
+int main(int argc, char * argv[]) {
+    int status = 0;
+
+    // stdout is written in large blocks
+    static char outBuf[1 << 20];
+    setvbuf(stdout, outBuf, _IOFBF, sizeof(outBuf));
+
+    if (argc == 1){
+        return convert(stdin, "stdin");
+    }
+    for (int i = 1; i < argc; i++){
+        FILE *in = fopen(argv[i], "rb");
+        if (in == NULL){
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        status |= convert(in, argv[i]);
+        fclose(in);
+    }
+    return status;
+}
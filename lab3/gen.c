@@ -0,0 +1,174 @@
+//
+//  gen.c
+//  Lab3Test2
+//
+//  Generates input files for main: t<testNum><n>.dat for each producer
+//  n, one value per line.
+//
+//  Usage: gen [-n lines] [-d distribution] [-e percent] [-s seed]
+//             testNum numFiles
+//  where lines is the number of lines in each file (default 1000),
+//  distribution is how the values are chosen:
+//     seq      1, 2, 3, ... continuing from one file to the next, so
+//              the files together hold each value once (the default);
+//              after 2147483647 (INT32_MAX) it starts again at 1
+//     uniform  any int, positive or negative
+//     small    0 to 999
+//     digits   1 to 10 digits, each length equally likely, either sign
+//  percent is the share of lines that are malformed (default 0), to
+//  test how main skips them, and seed makes the values repeatable (the
+//  same seed gives the same files).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+enum distribution {DIST_SEQ, DIST_UNIFORM, DIST_SMALL, DIST_DIGITS};
+const char *distributionNames[] = {"seq", "uniform", "small", "digits", NULL};
+
+// lines main must reject: not a number, empty, too big for an int and
+// trailing junk
+const char *malformed[] = {"abc", "", "99999999999", "12x"};
+
+//+
+// Function: nextRandom
+//
+// Purpose:  Step a xorshift64* generator, which is fast and, unlike
+//           rand, the same everywhere for a given seed.
+//-
+
+uint64_t nextRandom(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//+
+// Function: nextValue
+//
+// Purpose:  Choose the value for line i of file n.
+//-
+
+long long nextValue(enum distribution dist, uint64_t *state, int n, long long lines, long long i){
+    uint64_t r = nextRandom(state);
+
+    switch (dist){
+    case DIST_UNIFORM:
+        return (int32_t)(uint32_t)r;
+    case DIST_SMALL:
+        return r % 1000;
+    case DIST_DIGITS: {
+        // a length from 1 to 10, then a value of that length and a sign
+        int digits = 1 + r % 10;
+        long long low = 1;
+        for (int d = 1; d < digits; d++){
+            low *= 10;
+        }
+        long long high = digits == 10 ? INT32_MAX : low * 10 - 1;
+        if (digits == 1){
+            low = 0;
+        }
+        r = nextRandom(state);
+        long long value = low + (long long)((r >> 1) % (uint64_t)(high - low + 1));
+        return (r & 1) ? -value : value;
+    }
+    default:
+        // wrap rather than go past what main reads as an int
+        return (n * lines + i) % INT32_MAX + 1;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    long long lines = 1000;
+    enum distribution dist = DIST_SEQ;
+    int errorPercent = 0;
+    uint64_t seed = time(NULL);
+    int opt;
+    const char *progName = argv[0];
+
+    while ((opt = getopt(argc, argv, "n:d:e:s:")) != -1){
+        switch (opt){
+        case 'n':
+            if ((lines = atoll(optarg)) < 0){
+                fprintf(stderr, "lines must be at least 0, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            for (dist = 0; distributionNames[dist] != NULL; dist++){
+                if (strcmp(optarg, distributionNames[dist]) == 0){
+                    break;
+                }
+            }
+            if (distributionNames[dist] == NULL){
+                fprintf(stderr, "distribution must be seq, uniform, small or digits, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'e':
+            errorPercent = atoi(optarg);
+            if (errorPercent < 0 || errorPercent > 100){
+                fprintf(stderr, "percent must be 0 to 100, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            exit(1);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc != 3){
+        fprintf(stderr, "Usage: %s [-n lines] [-d distribution] [-e percent] [-s seed] testNum numFiles\n", progName);
+        exit(1);
+    }
+    int testNum = atoi(argv[1]);
+    int numFiles = atoi(argv[2]);
+    if (testNum <= 0){
+        fprintf(stderr, "testNum must be greater than 0, you said %s\n", argv[1]);
+        exit(1);
+    }
+    if (numFiles <= 0){
+        fprintf(stderr, "must be at least one file, you said %s\n", argv[2]);
+        exit(1);
+    }
+
+    static char outBuf[1 << 20];
+    for (int n = 0; n < numFiles; n++){
+        char name[32];
+        snprintf(name, sizeof(name), "t%d%d.dat", testNum, n);
+        FILE *out = fopen(name, "w");
+        if (out == NULL){
+            perror(name);
+            exit(1);
+        }
+        setvbuf(out, outBuf, _IOFBF, sizeof(outBuf));
+
+        // each file has its own stream of numbers, never all zero
+        uint64_t state = (seed + n + 1) * 0x9E3779B97F4A7C15ULL;
+        if (state == 0){
+            state = 1;
+        }
+        for (long long i = 0; i < lines; i++){
+            if (errorPercent > 0 && nextRandom(&state) % 100 < (uint64_t)errorPercent){
+                fprintf(out, "%s\n", malformed[nextRandom(&state) % 4]);
+            } else {
+                fprintf(out, "%lld\n", nextValue(dist, &state, n, lines, i));
+            }
+        }
+        if (fclose(out) != 0){
+            perror(name);
+            exit(1);
+        }
+    }
+    return 0;
+}
@@ -5,6 +5,7 @@
 //  Created by Thomas Dean on 2023-10-13.
 //
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -13,37 +14,1817 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 
 // Parameter strucutre for threads
 struct threadParm{
     // name of file to read or write
-    char fileName[20];
+    char fileName[32];
     // thread num for debug messages
     int threadNum;
 };
 
+// a value on its way from a producer to a consumer, with where it came
+// from so that ordered output can put it back in place
+struct record {
+    int value;
+    int producer;	// thread number of the producer
+    long seq;		// number of values before it from that producer
+    uint32_t sent;	// when the producer sent it, with -s (see statsNow)
+};
+
 // Global Vars
 // the current test number
 int testNum = 0;
 
-// function prototypes
-void simulate_interrupt(void);
+// function prototypes
+void simulate_interrupt(void);
+int queuePut(const struct record *recs, int n, int *first);
+int queueGet(struct record *recs, int n, int *first);
+
+// mutexes
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t empty  = PTHREAD_COND_INITIALIZER;
+pthread_cond_t full  = PTHREAD_COND_INITIALIZER;
+
+//*********Begin Shared Variables*************
+// number of running producers
+atomic_int numProdRunning = 0;
+// buffer, of numSlots values (set with -c). numElements is atomic
+// so that a spinning or sleeping waiter can look at it unlocked.
+int numSlots = 3;
+atomic_int numElements = 0;
+int head = 0;
+int tail = 0;
+struct record *buffer;
+//*********End Shared Variables*************
+
+// most values a thread moves to or from the buffer at once (set with -b)
+int batchSize = 1;
+
+// The buffer between producers and consumers is either the mutex
+// protected buffer above or a lock-free ring. The ring comes in three
+// forms: any number of producers and consumers (mpmc), one producer
+// and one consumer (spsc) and many producers with one consumer (mpsc).
+// The single sided forms skip the compare and swap on their side.
+// Or there is a ring for each consumer (sharded).
+enum queueKind {QUEUE_MUTEX, QUEUE_MPMC, QUEUE_SPSC, QUEUE_MPSC, QUEUE_SHARDED};
+const char *queueNames[] = {"mutex", "mpmc", "spsc", "mpsc", "sharded", NULL};
+enum queueKind queueKind = QUEUE_MUTEX;
+
+#define CACHE_LINE 64
+
+//*********Begin Waiting*************
+// How a thread waits for the buffer, set with -W:
+//   cond   producers and consumers of the mutex buffer wait on its
+//          condition variables, those of a ring yield the CPU and try
+//          again (the default)
+//   spin   spin with a pause instruction until the buffer is ready,
+//          never giving up the CPU, for the lowest latency. Only for
+//          threads with a CPU each: otherwise a waiter spins out its
+//          time slice while the thread it waits for can't run
+//   futex  spin for a while, then sleep on a futex. Every put or get
+//          wakes it, a system call whether or not anyone sleeps
+//   event  spin for a while, then sleep on an eventcount: like futex,
+//          but sleepers say so first and a put or get only makes the
+//          system call when there are some
+// Consumers wait on valuesAdded and producers on valuesTaken. The
+// short waits on a ring slot or a reorder window spin and then yield
+// with every strategy except spin, which never yields.
+enum waitStrategy {WAIT_COND, WAIT_SPIN, WAIT_FUTEX, WAIT_EVENT};
+const char *waitStrategyNames[] = {"cond", "spin", "futex", "event", NULL};
+enum waitStrategy waitStrategy = WAIT_COND;
+
+// times a waiter checks before it sleeps or yields
+#define WAIT_SPINS 256
+
+struct waitPoint {
+    _Alignas(CACHE_LINE) atomic_uint epoch;	// changed to wake sleepers
+    atomic_int waiters;				// sleepers, for event
+};
+
+struct waitPoint valuesAdded;
+struct waitPoint valuesTaken;
+
+//+
+// Function: cpuRelax
+//
+// Purpose:  Tell the CPU this is a spin loop, so it saves power and
+//           lets the other hyperthread run.
+//-
+
+static inline void cpuRelax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+//+
+// Function: waitBackoff
+//
+// Purpose:  Wait a little in a loop waiting for another thread to
+//           finish with something: pause for the first WAIT_SPINS
+//           calls, counted in *spins (which stops there), then yield
+//           the CPU. -W spin always pauses.
+//-
+
+void waitBackoff(int *spins){
+    if (*spins < WAIT_SPINS){
+        (*spins)++;
+        cpuRelax();
+    } else if (waitStrategy == WAIT_SPIN){
+        cpuRelax();
+    } else {
+        sched_yield();
+    }
+}
+
+//+
+// Function: waitFor
+//
+// Purpose:  Wait at a wait point until ready() says the buffer is
+//           ready, or for cond just yield once. It may return early,
+//           so the caller tries again and comes back if it must.
+//-
+
+void waitFor(struct waitPoint *w, int (*ready)(void)){
+    if (waitStrategy == WAIT_COND){
+        sched_yield();
+        return;
+    }
+    if (waitStrategy == WAIT_SPIN){
+        while (!ready()){
+            cpuRelax();
+        }
+        return;
+    }
+    for (int i = 0; i < WAIT_SPINS; i++){
+        if (ready()){
+            return;
+        }
+        cpuRelax();
+    }
+    if (waitStrategy == WAIT_EVENT){
+        // Say so before the last look: then either waitWake sees this
+        // sleeper, or this look sees what it woke for (both sides are
+        // sequentially consistent)
+        atomic_fetch_add(&w->waiters, 1);
+    }
+    unsigned key = atomic_load(&w->epoch);
+    if (!ready()){
+        // returns at once if the epoch has moved on since the look
+        syscall(SYS_futex, &w->epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+    }
+    if (waitStrategy == WAIT_EVENT){
+        atomic_fetch_sub(&w->waiters, 1);
+    }
+}
+
+//+
+// Function: waitWake
+//
+// Purpose:  Wake every thread sleeping at a wait point, after making
+//           what it waits for ready.
+//-
+
+void waitWake(struct waitPoint *w){
+    if (waitStrategy == WAIT_EVENT){
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&w->waiters, memory_order_relaxed) == 0){
+            return;
+        }
+    } else if (waitStrategy != WAIT_FUTEX){
+        return;
+    }
+    atomic_fetch_add(&w->epoch, 1);
+    syscall(SYS_futex, &w->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+//*********End Waiting*************
+
+// A slot's sequence number says whose turn it is: it equals the
+// position for the producer that will fill it, and the position plus
+// one once it holds a value for the consumer. The consumer then sets
+// it to the position plus the capacity, for the producer on the next
+// lap. So producers and consumers only meet on the slots themselves.
+struct ringSlot {
+    atomic_size_t seq;
+    struct record rec;
+};
+
+// head and tail are on their own cache lines, so producers moving
+// head don't take the line consumers are using for tail.
+struct ring {
+    _Alignas(CACHE_LINE) atomic_size_t head;	// next position to fill
+    _Alignas(CACHE_LINE) atomic_size_t tail;	// next position to empty
+    _Alignas(CACHE_LINE) size_t mask;		// capacity - 1, a power of two
+    struct ringSlot *slots;
+};
+
+struct ring ring;
+
+//+
+// Function: ringCapacity
+//
+// Purpose:  Round a ring's capacity up to a power of two, so that a
+//           position maps to its slot with a mask.
+//-
+
+size_t ringCapacity(size_t capacity){
+    size_t size = 1;
+    while (size < capacity){
+        size <<= 1;
+    }
+    return size;
+}
+
+//+
+// Function: ringInit
+//
+// Purpose:  Set up a lock-free ring with at least the given number of
+//           slots.
+//-
+
+void ringInit(struct ring *r, size_t capacity){
+    size_t size = ringCapacity(capacity);
+    r->slots = aligned_alloc(CACHE_LINE, (size * sizeof(struct ringSlot) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1));
+    if (r->slots == NULL){
+        perror("ring");
+        exit(1);
+    }
+    for (size_t i = 0; i < size; i++){
+        atomic_init(&r->slots[i].seq, i);
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = size - 1;
+}
+
+//+
+// Function: ringPut
+//
+// Purpose:  Try to add up to n values to the ring, in consecutive
+//           positions claimed at once. With multi set any number of
+//           producers may call it at once, and claim the positions with
+//           a compare and swap on head; otherwise there must be only one
+//           producer, which just moves head. Sets *first to the slot of
+//           the first value. Returns the number added, 0 if the ring is
+//           full.
+//-
+
+int ringPut(struct ring *r, const struct record *recs, int n, int multi, int *first){
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t count;
+
+    while (1){
+        // positions up to a lap past tail have been taken by consumers,
+        // so their slots are free or about to be
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        size_t space = tail + r->mask + 1 - pos;
+        if ((intptr_t)space <= 0){
+            return 0;
+        }
+        count = (size_t)n < space ? (size_t)n : space;
+        if (!multi){
+            atomic_store_explicit(&r->head, pos + count, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + count,
+                memory_order_relaxed, memory_order_relaxed)){
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++){
+        struct ringSlot *slot = &r->slots[(pos + i) & r->mask];
+        // wait for a consumer still reading the last lap's value
+        for (int spins = 0; atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + i; ){
+            waitBackoff(&spins);
+        }
+        slot->rec = recs[i];
+        atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+    }
+    *first = pos & r->mask;
+    return count;
+}
+
+//+
+// Function: ringGet
+//
+// Purpose:  Try to take up to n values from the ring, for any number of
+//           consumers if multi is set, otherwise for the only one. Sets
+//           *first to the slot of the first value. Returns the number
+//           taken, 0 if the ring is empty.
+//-
+
+int ringGet(struct ring *r, struct record *recs, int n, int multi, int *first){
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t count;
+
+    while (1){
+        // positions before head have been taken by producers, so they
+        // are filled or about to be
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t avail = head - pos;
+        if ((intptr_t)avail <= 0){
+            return 0;
+        }
+        count = (size_t)n < avail ? (size_t)n : avail;
+        if (!multi){
+            atomic_store_explicit(&r->tail, pos + count, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + count,
+                memory_order_relaxed, memory_order_relaxed)){
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++){
+        struct ringSlot *slot = &r->slots[(pos + i) & r->mask];
+        // wait for the producer that claimed it to fill it
+        for (int spins = 0; atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + i + 1; ){
+            waitBackoff(&spins);
+        }
+        recs[i] = slot->rec;
+        // free the slot for the producer on the next lap
+        atomic_store_explicit(&slot->seq, pos + i + r->mask + 1, memory_order_release);
+    }
+    *first = pos & r->mask;
+    return count;
+}
+
+//+
+// Function: ringRoom
+//
+// Purpose:  Tell whether a ring has room for a value. tail is read
+//           first, so head can't look to be behind it.
+//-
+
+int ringRoom(struct ring *r){
+    size_t tail = atomic_load(&r->tail);
+    return atomic_load(&r->head) - tail <= r->mask;
+}
+
+//+
+// Function: ringValues
+//
+// Purpose:  Tell whether a ring has a value.
+//-
+
+int ringValues(struct ring *r){
+    size_t tail = atomic_load(&r->tail);
+    return atomic_load(&r->head) != tail;
+}
+
+//+
+// Function: ringHasRoom
+//
+// Purpose:  Tell whether a producer of the ring can go on.
+//-
+
+int ringHasRoom(void){
+    return ringRoom(&ring);
+}
+
+//+
+// Function: ringHasValues
+//
+// Purpose:  Tell whether a consumer of the ring has something to do:
+//           there is a value, or there are no producers left.
+//-
+
+int ringHasValues(void){
+    return ringValues(&ring) || atomic_load(&numProdRunning) == 0;
+}
+
+// With the sharded queue each consumer has its own mpmc ring, so
+// consumers don't all contend for one tail. A producer starts with
+// the shard of its home consumer and moves to the next when one is
+// full; a consumer whose shard is empty steals from the others.
+struct ring *shards;
+int numShards = 0;
+
+// the shard the calling thread uses first
+_Thread_local int homeShard = 0;
+
+// consumers make their own shards (so that a pinned consumer's shard
+// is in its own NUMA node's memory) before the producers start
+pthread_barrier_t shardsReady;
+
+//+
+// Function: shardsHaveRoom
+//
+// Purpose:  Tell whether any shard has room for a value.
+//-
+
+int shardsHaveRoom(void){
+    for (int i = 0; i < numShards; i++){
+        if (ringRoom(&shards[i])){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//+
+// Function: shardsHaveValues
+//
+// Purpose:  Tell whether a consumer has something to do: any shard
+//           has a value, or there are no producers left.
+//-
+
+int shardsHaveValues(void){
+    for (int i = 0; i < numShards; i++){
+        if (ringValues(&shards[i])){
+            return 1;
+        }
+    }
+    return atomic_load(&numProdRunning) == 0;
+}
+
+//+
+// Function: shardPut
+//
+// Purpose:  Add up to n values to a shard, starting with the calling
+//           thread's home shard. Returns the number added, waiting
+//           while every shard is full.
+//-
+
+int shardPut(const struct record *recs, int n, int *first){
+    int count;
+
+    while (1){
+        for (int i = 0; i < numShards; i++){
+            struct ring *r = &shards[(homeShard + i) % numShards];
+            if ((count = ringPut(r, recs, n, 1, first)) > 0){
+                return count;
+            }
+        }
+        waitFor(&valuesTaken, shardsHaveRoom);
+    }
+}
+
+//+
+// Function: shardGet
+//
+// Purpose:  Take up to n values from the calling consumer's shard, or
+//           steal them from another if it is empty. Returns the number
+//           taken, or 0 when every shard is empty and all producers
+//           are done.
+//-
+
+int shardGet(struct record *recs, int n, int *first){
+    int count;
+
+    while (1){
+        // a producer's last values are in before it stops running, so
+        // once none are running one more look finds anything left
+        int done = (atomic_load(&numProdRunning) == 0);
+        for (int i = 0; i < numShards; i++){
+            struct ring *r = &shards[(homeShard + i) % numShards];
+            if ((count = ringGet(r, recs, n, 1, first)) > 0){
+                return count;
+            }
+        }
+        if (done){
+            return 0;
+        }
+        waitFor(&valuesAdded, shardsHaveValues);
+    }
+}
+
+//+
+// Function: bufferHasRoom
+//
+// Purpose:  Tell whether the mutex buffer has room, for a waiter that
+//           doesn't hold the mutex.
+//-
+
+int bufferHasRoom(void){
+    return atomic_load(&numElements) < numSlots;
+}
+
+//+
+// Function: bufferHasValues
+//
+// Purpose:  Tell whether a consumer of the mutex buffer has something
+//           to do, for a waiter that doesn't hold the mutex.
+//-
+
+int bufferHasValues(void){
+    return atomic_load(&numElements) > 0 || atomic_load(&numProdRunning) == 0;
+}
+
+//+
+// Function: queuePut
+//
+// Purpose:  Add n values to the buffer between producers and consumers,
+//           as many at a time as there is room for, waiting while it is
+//           full. Sets *first to the position of the first value; the
+//           rest follow it, wrapping at the end of the buffer. Returns
+//           the number added, which may be less than n.
+//-
+
+int queuePut(const struct record *recs, int n, int *first){
+    int count;
+
+    if (queueKind == QUEUE_SHARDED){
+        count = shardPut(recs, n, first);
+        waitWake(&valuesAdded);
+        return count;
+    }
+    if (queueKind != QUEUE_MUTEX){
+        // only an spsc ring has a single producer
+        while ((count = ringPut(&ring, recs, n, queueKind != QUEUE_SPSC, first)) == 0){
+            waitFor(&valuesTaken, ringHasRoom);
+        }
+        waitWake(&valuesAdded);
+        return count;
+    }
+
+    // Lock before accessing shared variables
+    pthread_mutex_lock(&mutex);
+
+    // Wait if the buffer is full
+    while (numElements == numSlots) {
+        if (waitStrategy == WAIT_COND){
+            pthread_cond_wait(&full, &mutex);  // Wait until space becomes available
+        } else {
+            pthread_mutex_unlock(&mutex);
+            waitFor(&valuesTaken, bufferHasRoom);
+            pthread_mutex_lock(&mutex);
+        }
+    }
+
+    // Add as many values as fit to the buffer
+    count = numSlots - numElements;
+    if (count > n){
+        count = n;
+    }
+    *first = head;
+    for (int i = 0; i < count; i++){
+        buffer[head] = recs[i];
+        head = (head + 1) % numSlots;
+    }
+    numElements += count;
+
+    // Signal a consumer that the buffer is not empty. It passes the
+    // signal on if it leaves values for another.
+    if (waitStrategy == WAIT_COND){
+        pthread_cond_signal(&empty);
+        if (numElements < numSlots){
+            pthread_cond_signal(&full);
+        }
+    } else {
+        waitWake(&valuesAdded);
+    }
+
+    // Unlock after modifying shared variables
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+//+
+// Function: queueGet
+//
+// Purpose:  Take up to n values from the buffer, waiting while it is
+//           empty and there are producers running. Sets *first to the
+//           position of the first value. Returns the number taken, or 0
+//           when the buffer is empty and all producers are done.
+//-
+
+int queueGet(struct record *recs, int n, int *first){
+    int count;
+
+    if (queueKind == QUEUE_SHARDED){
+        count = shardGet(recs, n, first);
+        waitWake(&valuesTaken);
+        return count;
+    }
+    if (queueKind != QUEUE_MUTEX){
+        // only an mpmc ring has several consumers
+        int multi = (queueKind == QUEUE_MPMC);
+        while ((count = ringGet(&ring, recs, n, multi, first)) == 0){
+            if (atomic_load(&numProdRunning) == 0){
+                // a producer's last values are in before it stops
+                // running, so look once more
+                return ringGet(&ring, recs, n, multi, first);
+            }
+            waitFor(&valuesAdded, ringHasValues);
+        }
+        waitWake(&valuesTaken);
+        return count;
+    }
+
+    pthread_mutex_lock(&mutex);
+
+    // Wait if the buffer is empty and there are producers
+    while (numElements == 0 && numProdRunning > 0) {
+        if (waitStrategy == WAIT_COND){
+            pthread_cond_wait(&empty, &mutex);  // Wait until the buffer has data
+        } else {
+            pthread_mutex_unlock(&mutex);
+            waitFor(&valuesAdded, bufferHasValues);
+            pthread_mutex_lock(&mutex);
+        }
+    }
+
+    // If the buffer is empty and no producers are running, exit
+    if (numElements == 0 && numProdRunning == 0) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+
+    // Read values from the buffer
+    count = numElements < n ? numElements : n;
+    *first = tail;
+    for (int i = 0; i < count; i++){
+        recs[i] = buffer[tail];
+        tail = (tail + 1) % numSlots;
+    }
+    numElements -= count;
+
+    // Signal the producer that the buffer is not full, and pass the
+    // signal to another consumer if values are left
+    if (waitStrategy == WAIT_COND){
+        pthread_cond_signal(&full);
+        if (numElements > 0){
+            pthread_cond_signal(&empty);
+        }
+    } else {
+        waitWake(&valuesTaken);
+    }
+
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+//*********Begin Logging*************
+// Trace messages don't go to stdout from the threads doing the work.
+// Each thread has its own ring of log entries, which only it fills
+// and only the log writer thread empties, so logging takes no lock
+// and makes no system call. A per record message just stores its
+// format and numbers, and the writer does the formatting. Messages
+// are written in order for each thread, but those of different
+// threads are interleaved as the writer gets to them.
+
+enum logLevels {LOG_OFF, LOG_SUMMARY, LOG_RECORD};
+const char *logLevelNames[] = {"off", "summary", "record", NULL};
+// most detailed messages written (set with -v)
+int logLevel = LOG_RECORD;
+
+#define LOG_ENTRIES 4096		// per thread, a power of two
+#define LOG_TEXT 56
+
+// a message: a format taking up to four ints, or (if fmt is NULL)
+// text already formatted. One cache line.
+struct logEntry {
+    const char *fmt;
+    union {
+        int args[4];
+        char text[LOG_TEXT];
+    };
+};
+
+struct logRing {
+    _Alignas(CACHE_LINE) atomic_size_t head;	// next entry to fill
+    _Alignas(CACHE_LINE) atomic_size_t tail;	// next entry to write
+    _Atomic(struct logRing *) next;		// all rings, for the writer
+    struct logEntry entries[LOG_ENTRIES];
+};
+
+// the calling thread's ring, made on its first message
+_Thread_local struct logRing *threadLog = NULL;
+
+// every thread's ring, oldest first, so the writer gets to earlier
+// threads' messages first
+_Atomic(struct logRing *) logRings = NULL;
+struct logRing *lastLogRing = NULL;
+pthread_mutex_t logRingsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_t logThread;
+atomic_int logStopping = 0;
+
+//+
+// Function: logEntry
+//
+// Purpose:  Claim the next entry of the calling thread's log ring,
+//           waiting for the writer if it is full. The entry is passed
+//           to the writer with logCommit.
+//-
+
+struct logEntry * logEntry(void){
+    struct logRing *log = threadLog;
+
+    if (log == NULL){
+        log = aligned_alloc(CACHE_LINE, sizeof(struct logRing));
+        if (log == NULL){
+            perror("log");
+            exit(1);
+        }
+        atomic_init(&log->head, 0);
+        atomic_init(&log->tail, 0);
+        atomic_init(&log->next, NULL);
+        pthread_mutex_lock(&logRingsMutex);
+        if (lastLogRing == NULL){
+            atomic_store(&logRings, log);
+        } else {
+            atomic_store(&lastLogRing->next, log);
+        }
+        lastLogRing = log;
+        pthread_mutex_unlock(&logRingsMutex);
+        threadLog = log;
+    }
+    size_t head = atomic_load_explicit(&log->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&log->tail, memory_order_acquire) == LOG_ENTRIES){
+        sched_yield();
+    }
+    return &log->entries[head & (LOG_ENTRIES - 1)];
+}
+
+//+
+// Function: logCommit
+//
+// Purpose:  Pass the entry from logEntry to the writer.
+//-
+
+void logCommit(void){
+    atomic_fetch_add_explicit(&threadLog->head, 1, memory_order_release);
+}
+
+//+
+// Function: logRecord
+//
+// Purpose:  Log a per record message, a format with up to four %d.
+//           It costs a test of logLevel when they are not wanted.
+//-
+
+static inline void logRecord(const char *fmt, int a, int b, int c, int d){
+    if (logLevel < LOG_RECORD){
+        return;
+    }
+    struct logEntry *entry = logEntry();
+    entry->fmt = fmt;
+    entry->args[0] = a;
+    entry->args[1] = b;
+    entry->args[2] = c;
+    entry->args[3] = d;
+    logCommit();
+}
+
+//+
+// Function: logMessage
+//
+// Purpose:  Log a message at the given level, formatted now as printf
+//           does (and cut to LOG_TEXT - 1 characters).
+//-
+
+void logMessage(int level, const char *fmt, ...){
+    if (logLevel < level){
+        return;
+    }
+    struct logEntry *entry = logEntry();
+    va_list ap;
+    va_start(ap, fmt);
+    entry->fmt = NULL;
+    vsnprintf(entry->text, LOG_TEXT, fmt, ap);
+    va_end(ap);
+    logCommit();
+}
+
+//+
+// Function: logDrain
+//
+// Purpose:  Write the waiting entries of every thread's ring to stdout.
+//           Returns the number written.
+//-
+
+int logDrain(void){
+    int written = 0;
+
+    // rings are only added at the end, so the list can be followed
+    // while another thread adds one
+    for (struct logRing *log = atomic_load(&logRings); log != NULL; log = atomic_load(&log->next)){
+        size_t tail = atomic_load_explicit(&log->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&log->head, memory_order_acquire);
+        for (; tail != head; tail++){
+            struct logEntry *entry = &log->entries[tail & (LOG_ENTRIES - 1)];
+            if (entry->fmt == NULL){
+                fputs(entry->text, stdout);
+                putchar('\n');
+            } else {
+                printf(entry->fmt, entry->args[0], entry->args[1], entry->args[2], entry->args[3]);
+            }
+            written++;
+            // give the entry back as soon as it is written, so a
+            // thread with a full ring waits no longer than it must
+            atomic_store_explicit(&log->tail, tail + 1, memory_order_release);
+        }
+    }
+    return written;
+}
+
+//+
+// Function: logWriter
+//
+// Purpose:  The log writer thread. Writes entries as they arrive,
+//           flushing stdout and sleeping briefly when there are none,
+//           until logStop is called and everything is written.
+//-
+
+void * logWriter(void * parm){
+    struct timespec idle = {0, 200000};
+    (void) parm;
+
+    while (1){
+        int stopping = atomic_load(&logStopping);
+        if (logDrain() == 0){
+            fflush(stdout);
+            if (stopping){
+                break;
+            }
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+//+
+// Function: logStart
+//
+// Purpose:  Start the log writer thread, if anything is to be logged.
+//-
+
+void logStart(void){
+    if (logLevel > LOG_OFF && pthread_create(&logThread, NULL, logWriter, NULL) != 0){
+        perror("log writer");
+        exit(1);
+    }
+}
+
+//+
+// Function: logStop
+//
+// Purpose:  Write everything logged and stop the log writer thread.
+//-
+
+void logStop(void){
+    if (logLevel == LOG_OFF){
+        return;
+    }
+    atomic_store(&logStopping, 1);
+    pthread_join(logThread, NULL);
+    struct logRing *log = atomic_load(&logRings);
+    while (log != NULL){
+        struct logRing *next = atomic_load(&log->next);
+        free(log);
+        log = next;
+    }
+    atomic_store(&logRings, NULL);
+    lastLogRing = NULL;
+    threadLog = NULL;
+}
+//*********End Logging*************
+
+//*********Begin Input*************
+// A producer's file is mapped whole when it can be, and otherwise read
+// in large blocks, and its lines are parsed where they lie rather than
+// copied out one at a time. Each line must hold one integer: spaces or
+// tabs around it, a sign and a trailing \r are allowed. Anything else
+// is reported with its line number and skipped rather than read as 0.
+//
+// Lines of just digits with an optional minus sign, which is all
+// of them in generated data, are parsed 16 bytes at a time with SSE4.1
+// where the CPU has it. Anything else falls back to the scalar parser.
+
+#define INPUT_BLOCK (1 << 20)		// bytes read at a time when not mapped
+#define INPUT_PAD 16			// zeros after the data, for vector loads
+
+struct inputFile {
+    const char *name;
+    int fd;
+    int mapped;		// data is a mapping of the whole file
+    int eof;
+    char *data;
+    size_t size;	// bytes allocated when not mapped
+    size_t pos;		// start of the next line
+    size_t complete;	// end of the last whole line in data
+    size_t end;		// end of the data
+    size_t vectorEnd;	// a line starting before this can be loaded 16 bytes at once
+    int lineNo;		// line number of the line at pos
+    int errors;		// malformed lines skipped
+};
+
+// vector parsing is used if the CPU can do it
+int useVectorParse = 0;
+
+//+
+// Function: inputOpen
+//
+// Purpose:  Open an input file, mapping it if it is a regular file.
+//           Returns 0, or -1 with errno set if it can't be opened.
+//-
+
+int inputOpen(struct inputFile *in, const char *name){
+    struct stat st;
+
+    memset(in, 0, sizeof(*in));
+    in->name = name;
+    in->lineNo = 1;
+    if ((in->fd = open(name, O_RDONLY)) < 0){
+        return -1;
+    }
+    if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode)){
+        if (st.st_size == 0){
+            in->eof = 1;
+            return 0;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (map != MAP_FAILED){
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            in->mapped = 1;
+            in->eof = 1;
+            in->data = map;
+            in->size = in->end = in->complete = st.st_size;
+            in->vectorEnd = st.st_size >= 16 ? st.st_size - 15 : 0;
+            return 0;
+        }
+    }
+    in->size = INPUT_BLOCK;
+    if (posix_memalign((void **)&in->data, 4096, in->size + INPUT_PAD) != 0){
+        close(in->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+//+
+// Function: inputClose
+//
+// Purpose:  Close an input file, and report how many lines were skipped.
+//-
+
+void inputClose(struct inputFile *in){
+    if (in->mapped){
+        munmap(in->data, in->size);
+    } else {
+        free(in->data);
+    }
+    close(in->fd);
+    if (in->errors > 0){
+        fprintf(stderr, "%s: %d malformed lines skipped\n", in->name, in->errors);
+    }
+}
+
+//+
+// Function: inputFill
+//
+// Purpose:  Read more of a file that isn't mapped, keeping any partial
+//           last line. The buffer grows if a line doesn't fit.
+//-
+
+void inputFill(struct inputFile *in){
+    if (in->pos > 0){
+        memmove(in->data, in->data + in->pos, in->end - in->pos);
+        in->end -= in->pos;
+        in->pos = 0;
+    }
+    if (in->end == in->size){
+        char *data;
+        if (posix_memalign((void **)&data, 4096, 2 * in->size + INPUT_PAD) != 0){
+            perror(in->name);
+            exit(1);
+        }
+        memcpy(data, in->data, in->end);
+        free(in->data);
+        in->data = data;
+        in->size *= 2;
+    }
+    ssize_t n;
+    do {
+        n = read(in->fd, in->data + in->end, in->size - in->end);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0){
+        if (n < 0){
+            perror(in->name);
+        }
+        in->eof = 1;
+    } else {
+        in->end += n;
+    }
+
+    // no stray newline after the data for a vector load to find
+    memset(in->data + in->end, 0, INPUT_PAD);
+    in->vectorEnd = in->end;
+    if (in->eof){
+        in->complete = in->end;
+    } else {
+        char *last = memrchr(in->data, '\n', in->end);
+        in->complete = last ? last + 1 - in->data : 0;
+    }
+}
+
+//+
+// Function: parseScalar
+//
+// Purpose:  Parse the line at p, which ends at a newline or at end.
+//           Sets *next to the start of the next line. Returns 1 with
+//           the value in *value, or 0 if the line is malformed.
+//-
+
+int parseScalar(const char *p, const char *end, int *value, const char **next){
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL){
+        eol = end;
+    }
+    *next = eol + (eol < end);
+
+    while (p < eol && (*p == ' ' || *p == '\t')){
+        p++;
+    }
+    int neg = 0;
+    if (p < eol && (*p == '-' || *p == '+')){
+        neg = (*p++ == '-');
+    }
+    const char *digits = p;
+    int64_t v = 0;
+    while (p < eol && *p >= '0' && *p <= '9'){
+        v = v * 10 + (*p++ - '0');
+        if (v > (int64_t)INT32_MAX + 1){
+            return 0;
+        }
+    }
+    if (p == digits){
+        return 0;
+    }
+    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')){
+        p++;
+    }
+    if (p != eol || (!neg && v > INT32_MAX)){
+        return 0;
+    }
+    *value = neg ? (int)-v : (int)v;
+    return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// shuffles moving the first n bytes of a vector to its end, with
+// zeros before them
+uint8_t rightAlign[17][16];
+
+//+
+// Function: parseVector
+//
+// Purpose:  Parse the line at p if it is up to 10 digits with an
+//           optional minus sign, ended by a newline within 16 bytes
+//           (all of which must be readable). The digits are checked and
+//           moved to the end of a vector, then combined pairwise with
+//           multiply-adds: into 2, 4 and 8 digit numbers. Returns the
+//           length of the line with its newline, or 0 if it must go to
+//           the scalar parser.
+//-
+
+__attribute__((target("sse4.1")))
+int parseVector(const char *p, int *value){
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    int newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+    if (newlines == 0){
+        return 0;
+    }
+    int len = __builtin_ctz(newlines);
+    int neg = (p[0] == '-');
+    int want = ((1 << len) - 1) & ~neg;
+
+    // bytes that are digits, as 0 to 9
+    __m128i d = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    if (len - neg == 0 || len - neg > 10 || (_mm_movemask_epi8(isDigit) & want) != want){
+        return 0;
+    }
+
+    d = _mm_shuffle_epi8(_mm_and_si128(d, isDigit), _mm_loadu_si128((const __m128i *)rightAlign[len]));
+    d = _mm_maddubs_epi16(d, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+    d = _mm_madd_epi16(d, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    d = _mm_packus_epi32(d, d);
+    d = _mm_madd_epi16(d, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    int64_t v = (int64_t)_mm_cvtsi128_si32(d) * 100000000 + _mm_extract_epi32(d, 1);
+    if (neg){
+        v = -v;
+    }
+    if (v < INT32_MIN || v > INT32_MAX){
+        return 0;
+    }
+    *value = (int)v;
+    return len + 1;
+}
+#endif
+
+//+
+// Function: parseInit
+//
+// Purpose:  Choose the vector parser if the CPU has SSE4.1.
+//-
+
+void parseInit(void){
+#if defined(__x86_64__) || defined(__i386__)
+    for (int n = 0; n <= 16; n++){
+        for (int i = 0; i < 16; i++){
+            int from = i - (16 - n);
+            rightAlign[n][i] = from >= 0 ? from : 0x80;
+        }
+    }
+    __builtin_cpu_init();
+    useVectorParse = __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+//+
+// Function: inputValues
+//
+// Purpose:  Read up to max values from an input file, with the line
+//           number of each in lines[] if it isn't NULL. Malformed lines
+//           are reported and skipped. Returns the number read, 0 at the
+//           end of the file.
+//-
+
+int inputValues(struct inputFile *in, int *values, int *lines, int max){
+    int count = 0;
+
+    while (count < max){
+        if (in->pos == in->complete){
+            if (in->eof){
+                break;
+            }
+            inputFill(in);
+            continue;
+        }
+
+        const char *p = in->data + in->pos;
+        const char *next;
+        int len = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        if (useVectorParse && in->pos < in->vectorEnd){
+            len = parseVector(p, &values[count]);
+        }
+#endif
+        if (len > 0){
+            next = p + len;
+        } else if (!parseScalar(p, in->data + in->complete, &values[count], &next)){
+            int lineLen = next - p;
+            if (lineLen > 0 && next[-1] == '\n'){
+                lineLen--;
+            }
+            fprintf(stderr, "%s:%d: malformed value '%.*s'\n", in->name, in->lineNo, lineLen > 40 ? 40 : lineLen, p);
+            in->errors++;
+            in->pos = next - in->data;
+            in->lineNo++;
+            continue;
+        }
+        if (lines != NULL){
+            lines[count] = in->lineNo;
+        }
+        count++;
+        in->pos = next - in->data;
+        in->lineNo++;
+    }
+    return count;
+}
+//*********End Input*************
+
+//*********Begin Output*************
+// A consumer formats its values straight into a large page aligned
+// buffer and writes it out a block at a time, keeping any partial
+// block for the next write. With -d the file is opened with O_DIRECT,
+// so the blocks go to the disk without being copied through the page
+// cache (the end of the file, which is rarely a whole block, is
+// written normally). With -o binary the values are written as they
+// are, four bytes each after a short header, and bintotext turns such
+// a file back into text.
+
+#define OUTPUT_BLOCK (1 << 20)		// bytes written at a time
+#define OUTPUT_ALIGN 4096		// alignment O_DIRECT needs
+#define OUTPUT_MAX_TEXT 12		// longest value as text: "-2147483648\n"
+
+enum outputFormats {OUTPUT_TEXT, OUTPUT_BINARY};
+const char *outputFormatNames[] = {"text", "binary", NULL};
+int outputFormat = OUTPUT_TEXT;
+// open output files with O_DIRECT (set with -d)
+int outputDirect = 0;
+
+// start of a binary output file
+#define OUTPUT_MAGIC "L3B1"
+struct outputHeader {
+    char magic[4];
+    uint32_t recordSize;	// bytes per value
+};
+
+struct outputFile {
+    const char *name;
+    int fd;
+    int direct;		// fd has O_DIRECT
+    char *buf;
+    size_t used;
+};
+
+// "00" to "99", to format two digits at a time
+const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+//+
+// Function: formatInt
+//
+// Purpose:  Write a value in decimal with a newline at p, which must
+//           have room for OUTPUT_MAX_TEXT bytes. Returns the end.
+//-
+
+static inline char * formatInt(char *p, int value){
+    uint32_t v = value;
+    if (value < 0){
+        *p++ = '-';
+        v = -(uint32_t)value;
+    }
+    int len = 1;
+    for (uint32_t t = v; t >= 10; t /= 10){
+        len++;
+    }
+    char *end = p + len;
+    *end = '\n';
+    char *q = end;
+    while (v >= 100){
+        unsigned pair = (v % 100) * 2;
+        v /= 100;
+        *--q = digitPairs[pair + 1];
+        *--q = digitPairs[pair];
+    }
+    if (v >= 10){
+        *--q = digitPairs[v * 2 + 1];
+        *--q = digitPairs[v * 2];
+    } else {
+        *--q = '0' + v;
+    }
+    return end + 1;
+}
+
+//+
+// Function: outputWrite
+//
+// Purpose:  Write len bytes of the buffer. Exits on an error.
+//-
+
+void outputWrite(struct outputFile *out, size_t len){
+    for (size_t done = 0; done < len; ){
+        ssize_t n = write(out->fd, out->buf + done, len - done);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            perror(out->name);
+            exit(1);
+        }
+        done += n;
+    }
+}
+
+//+
+// Function: outputFlush
+//
+// Purpose:  Write the whole blocks in the buffer, moving what is left
+//           to its start.
+//-
+
+void outputFlush(struct outputFile *out){
+    size_t len = out->used & ~(size_t)(OUTPUT_ALIGN - 1);
+    if (len == 0){
+        return;
+    }
+    // what is left is shorter than what was written, so no overlap
+    outputWrite(out, len);
+    memcpy(out->buf, out->buf + len, out->used - len);
+    out->used -= len;
+}
+
+//+
+// Function: outputOpen
+//
+// Purpose:  Create an output file, in the format chosen with -o.
+//           Returns 0, or -1 with errno set if it can't be created.
+//-
+
+int outputOpen(struct outputFile *out, const char *name){
+    memset(out, 0, sizeof(*out));
+    out->name = name;
+    out->fd = -1;
+    if (outputDirect){
+        // not every file system can do it
+        out->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        out->direct = (out->fd >= 0);
+    }
+    if (out->fd < 0 && (out->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0){
+        return -1;
+    }
+    if (posix_memalign((void **)&out->buf, OUTPUT_ALIGN, OUTPUT_BLOCK) != 0){
+        close(out->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (outputFormat == OUTPUT_BINARY){
+        struct outputHeader header = {OUTPUT_MAGIC, sizeof(int32_t)};
+        memcpy(out->buf, &header, sizeof(header));
+        out->used = sizeof(header);
+    }
+    return 0;
+}
+
+//+
+// Function: outputValues
+//
+// Purpose:  Add the values of n records to an output file.
+//-
 
-// mutexes
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t empty  = PTHREAD_COND_INITIALIZER;
-pthread_cond_t full  = PTHREAD_COND_INITIALIZER;
+void outputValues(struct outputFile *out, const struct record *recs, int n){
+    if (outputFormat == OUTPUT_BINARY){
+        for (int i = 0; i < n; i++){
+            if (OUTPUT_BLOCK - out->used < sizeof(int32_t)){
+                outputFlush(out);
+            }
+            int32_t value = recs[i].value;
+            memcpy(out->buf + out->used, &value, sizeof(value));
+            out->used += sizeof(value);
+        }
+        return;
+    }
+    for (int i = 0; i < n; i++){
+        if (OUTPUT_BLOCK - out->used < OUTPUT_MAX_TEXT){
+            outputFlush(out);
+        }
+        out->used = formatInt(out->buf + out->used, recs[i].value) - out->buf;
+    }
+}
 
-//*********Begin Shared Variables*************
-// number of running producers
-int numProdRunning = 0;
-// buffer
-#define numSlots 3
-int numElements = 0;
-int head = 0;
-int tail = 0;
-int buffer[numSlots];
-//*********End Shared Variables*************
+//+
+// Function: outputClose
+//
+// Purpose:  Write the rest of an output file and close it.
+//-
+
+void outputClose(struct outputFile *out){
+    outputFlush(out);
+    if (out->used > 0){
+        // the last partial block can't be written with O_DIRECT
+        if (out->direct){
+            fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) & ~O_DIRECT);
+        }
+        outputWrite(out, out->used);
+    }
+    if (close(out->fd) != 0){
+        perror(out->name);
+        exit(1);
+    }
+    free(out->buf);
+}
+//*********End Output*************
+
+//*********Begin Ordered Output*************
+// With -O the output keeps each producer's order: out<test><n>.dat
+// holds the values of producer n, in the order of its input file. The
+// consumers still take records from the buffer in parallel, and put
+// each in its producer's stream, a window of slots indexed by the
+// record's sequence number. Whichever consumer fills the slot the
+// stream is waiting for writes it, and any that follow it, to the
+// stream's file. A producer never gets a window ahead of what has
+// been written, so a record always has a free slot and consumers
+// never wait for each other.
+
+int orderedOutput = 0;
+// slots in each stream's window (set with -w), a power of two
+int reorderWindow = 16384;
+
+struct reorderSlot {
+    atomic_long seq;		// sequence number of the record in it, -1 if none yet
+    int value;
+};
+
+struct stream {
+    _Alignas(CACHE_LINE) atomic_long next;	// sequence number to write next
+    atomic_int writing;				// a consumer is writing
+    struct reorderSlot *slots;
+    struct outputFile out;
+};
+
+struct stream *streams;
+
+//+
+// Function: streamsOpen
+//
+// Purpose:  Set up a stream for each producer and create its file,
+//           out<test><n>.dat.
+//-
+
+void streamsOpen(int numProducers){
+    reorderWindow = ringCapacity(reorderWindow);
+    streams = aligned_alloc(CACHE_LINE, numProducers * sizeof(struct stream));
+    if (streams == NULL){
+        perror("streams");
+        exit(1);
+    }
+    for (int i = 0; i < numProducers; i++){
+        struct stream *s = &streams[i];
+        char *name = malloc(32);
+        atomic_init(&s->next, 0);
+        atomic_init(&s->writing, 0);
+        s->slots = malloc(reorderWindow * sizeof(struct reorderSlot));
+        if (s->slots == NULL || name == NULL){
+            perror("streams");
+            exit(1);
+        }
+        for (int j = 0; j < reorderWindow; j++){
+            atomic_init(&s->slots[j].seq, -1);
+        }
+        snprintf(name, 32, "out%d%d.dat", testNum, i);
+        if (outputOpen(&s->out, name) != 0){
+            perror(name);
+            exit(1);
+        }
+    }
+}
+
+//+
+// Function: streamsClose
+//
+// Purpose:  Write the rest of each stream's file and close it. Every
+//           record has been written by the time all threads are done.
+//-
+
+void streamsClose(int numProducers){
+    for (int i = 0; i < numProducers; i++){
+        outputClose(&streams[i].out);
+        free((char *)streams[i].out.name);
+        free(streams[i].slots);
+    }
+    free(streams);
+}
+
+//+
+// Function: streamRoom
+//
+// Purpose:  Find how many of n records from sequence number seq on a
+//           producer may send without getting a window ahead of what
+//           has been written, waiting until it is at least one.
+//-
+
+int streamRoom(int producer, long seq, int n){
+    struct stream *s = &streams[producer];
+    long room;
+    int spins = 0;
+
+    while ((room = atomic_load_explicit(&s->next, memory_order_acquire) + reorderWindow - seq) <= 0){
+        waitBackoff(&spins);
+    }
+    return room < n ? (int) room : n;
+}
+
+//+
+// Function: streamPut
+//
+// Purpose:  Put a record in its producer's stream, then write whatever
+//           the stream can now write in order, unless another consumer
+//           is already doing so.
+//-
+
+void streamPut(const struct record *rec){
+    struct stream *s = &streams[rec->producer];
+    struct reorderSlot *slot = &s->slots[rec->seq & (reorderWindow - 1)];
+
+    slot->value = rec->value;
+    atomic_store(&slot->seq, rec->seq);
+
+    // The writer looks at the slot again after it stops writing, so
+    // either it sees this record or this consumer sees it has stopped
+    // (both are sequentially consistent).
+    while (atomic_exchange(&s->writing, 1) == 0){
+        long next = atomic_load_explicit(&s->next, memory_order_relaxed);
+        struct reorderSlot *ready;
+        while (atomic_load_explicit(&(ready = &s->slots[next & (reorderWindow - 1)])->seq, memory_order_acquire) == next){
+            struct record out = {ready->value, rec->producer, next, 0};
+            outputValues(&s->out, &out, 1);
+            next++;
+        }
+        atomic_store_explicit(&s->next, next, memory_order_release);
+        atomic_store(&s->writing, 0);
+        if (atomic_load(&s->slots[next & (reorderWindow - 1)].seq) != next){
+            break;
+        }
+    }
+}
+//*********End Ordered Output*************
+
+//*********Begin Statistics*************
+// With -s the run ends with one line of statistics on stdout, as CSV
+// (after a header line) or as a JSON object: records a second, the
+// percentiles of each record's time from its producer to a consumer,
+// and the CPU time used. Each consumer counts latencies into its own
+// histogram, whose buckets are 1 ns wide up to 16 ns and then an
+// eighth of a power of two wide, so a percentile is within about 6%.
+
+enum statsFormat {STATS_OFF, STATS_CSV, STATS_JSON};
+const char *statsFormatNames[] = {"off", "csv", "json", NULL};
+enum statsFormat statsFormat = STATS_OFF;
+
+#define LATENCY_BUCKETS 256
+
+struct latencyHist {
+    _Alignas(CACHE_LINE) uint64_t counts[LATENCY_BUCKETS];
+    uint32_t max;
+};
+
+struct latencyHist *latencyHists;
+
+//+
+// Function: statsNow
+//
+// Purpose:  Read the monotonic clock in nanoseconds, keeping the low 32
+//           bits, which is all a record has room for. Differences are
+//           right for latencies under 4 seconds.
+//-
+
+uint32_t statsNow(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+}
+
+//+
+// Function: latencyBucket
+//
+// Purpose:  Find the histogram bucket for a latency.
+//-
+
+int latencyBucket(uint32_t ns){
+    if (ns < 16){
+        return ns;
+    }
+    int log2 = 31 - __builtin_clz(ns);
+    return 16 + (log2 - 4) * 8 + (int)((ns >> (log2 - 3)) & 7);
+}
+
+//+
+// Function: latencyValue
+//
+// Purpose:  Give the latency in the middle of a histogram bucket.
+//-
+
+double latencyValue(int bucket){
+    if (bucket < 16){
+        return bucket;
+    }
+    int log2 = (bucket - 16) / 8 + 4;
+    double width = (double)(1u << (log2 - 3));
+    return (8 + (bucket - 16) % 8) * width + width / 2;
+}
+
+//+
+// Function: statsInit
+//
+// Purpose:  Make a histogram for each consumer.
+//-
+
+void statsInit(int numConsumers){
+    latencyHists = aligned_alloc(CACHE_LINE, numConsumers * sizeof(struct latencyHist));
+    if (latencyHists == NULL){
+        perror("statistics");
+        exit(1);
+    }
+    memset(latencyHists, 0, numConsumers * sizeof(struct latencyHist));
+}
+
+//+
+// Function: statsRecord
+//
+// Purpose:  Count the latencies of n records a consumer just took, all
+//           against one reading of the clock.
+//-
+
+void statsRecord(int consumer, const struct record *recs, int n){
+    struct latencyHist *hist = &latencyHists[consumer];
+    uint32_t now = statsNow();
+
+    for (int i = 0; i < n; i++){
+        uint32_t ns = now - recs[i].sent;
+        hist->counts[latencyBucket(ns)]++;
+        if (ns > hist->max){
+            hist->max = ns;
+        }
+    }
+}
+
+//+
+// Function: statsReport
+//
+// Purpose:  Merge the consumers' histograms and write the statistics
+//           for a run that took the given wall time, with the CPU time
+//           used between the two resource usages.
+//-
+
+void statsReport(int numProducers, int numConsumers, double seconds,
+        const struct rusage *start, const struct rusage *end){
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *percentiles[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+    uint64_t counts[LATENCY_BUCKETS] = {0};
+    uint64_t records = 0;
+    uint32_t max = 0;
+    double latency[4] = {0};
+
+    for (int i = 0; i < numConsumers; i++){
+        for (int b = 0; b < LATENCY_BUCKETS; b++){
+            counts[b] += latencyHists[i].counts[b];
+            records += latencyHists[i].counts[b];
+        }
+        if (latencyHists[i].max > max){
+            max = latencyHists[i].max;
+        }
+    }
+    for (int p = 0; p < 4; p++){
+        uint64_t rank = (uint64_t)(fractions[p] * records);
+        uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++){
+            seen += counts[b];
+            if (seen > rank){
+                latency[p] = latencyValue(b);
+                break;
+            }
+        }
+    }
+    double user = (end->ru_utime.tv_sec - start->ru_utime.tv_sec) + (end->ru_utime.tv_usec - start->ru_utime.tv_usec) / 1e6;
+    double sys = (end->ru_stime.tv_sec - start->ru_stime.tv_sec) + (end->ru_stime.tv_usec - start->ru_stime.tv_usec) / 1e6;
+
+    // the same fields either way, so a driver can treat them alike
+    const char *names[] = {"queue", "wait", "producers", "consumers", "capacity", "batch", "ordered",
+        "records", "seconds", "records_per_s", percentiles[0], percentiles[1], percentiles[2],
+        percentiles[3], "max_ns", "user_s", "sys_s", "cpu_pct", NULL};
+    char values[18][32];
+    snprintf(values[0], 32, "%s", queueNames[queueKind]);
+    snprintf(values[1], 32, "%s", waitStrategyNames[waitStrategy]);
+    snprintf(values[2], 32, "%d", numProducers);
+    snprintf(values[3], 32, "%d", numConsumers);
+    snprintf(values[4], 32, "%d", numSlots);
+    snprintf(values[5], 32, "%d", batchSize);
+    snprintf(values[6], 32, "%d", orderedOutput);
+    snprintf(values[7], 32, "%llu", (unsigned long long)records);
+    snprintf(values[8], 32, "%.6f", seconds);
+    snprintf(values[9], 32, "%.0f", records / seconds);
+    for (int p = 0; p < 4; p++){
+        snprintf(values[10 + p], 32, "%.0f", latency[p]);
+    }
+    snprintf(values[14], 32, "%u", max);
+    snprintf(values[15], 32, "%.3f", user);
+    snprintf(values[16], 32, "%.3f", sys);
+    snprintf(values[17], 32, "%.1f", 100 * (user + sys) / seconds);
+
+    if (statsFormat == STATS_JSON){
+        for (int i = 0; names[i] != NULL; i++){
+            // only the queue and wait are strings
+            printf(i == 0 ? "{\"%s\": \"%s\"" : i == 1 ? ", \"%s\": \"%s\"" : ", \"%s\": %s", names[i], values[i]);
+        }
+        printf("}\n");
+    } else {
+        for (int i = 0; names[i] != NULL; i++){
+            printf("%s%s", names[i], names[i + 1] ? "," : "\n");
+        }
+        for (int i = 0; names[i] != NULL; i++){
+            printf("%s%s", values[i], names[i + 1] ? "," : "\n");
+        }
+    }
+    fflush(stdout);
+}
+//*********End Statistics*************
+
+//*********Begin Thread Placement*************
+// With -p cpu each thread is pinned to one CPU, and with -p node to the
+// CPUs of one NUMA node, going round the CPUs (or nodes) the process is
+// allowed to use: producers first, then consumers.
+
+enum pinModes {PIN_NONE, PIN_CPU, PIN_NODE};
+const char *pinModeNames[] = {"none", "cpu", "node", NULL};
+int pinMode = PIN_NONE;
+
+// the CPU sets threads are pinned to in turn
+cpu_set_t *pinSets = NULL;
+int numPinSets = 0;
+
+//+
+// Function: addPinSet
+//
+// Purpose:  Add a CPU set to pin threads to, if it isn't empty.
+//-
+
+void addPinSet(cpu_set_t *set){
+    if (CPU_COUNT(set) == 0){
+        return;
+    }
+    pinSets = realloc(pinSets, (numPinSets + 1) * sizeof(cpu_set_t));
+    if (pinSets == NULL){
+        perror("pin");
+        exit(1);
+    }
+    pinSets[numPinSets++] = *set;
+}
+
+//+
+// Function: pinInit
+//
+// Purpose:  Find the CPU sets for the pinning chosen with -p: each CPU
+//           the process may use, or the usable CPUs of each NUMA node
+//           (from /sys/devices/system/node/node<n>/cpulist, as 0-3,8).
+//-
+
+void pinInit(void){
+    cpu_set_t allowed, set;
+
+    if (pinMode == PIN_NONE){
+        return;
+    }
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        perror("sched_getaffinity");
+        exit(1);
+    }
+    if (pinMode == PIN_CPU){
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+            if (CPU_ISSET(cpu, &allowed)){
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                addPinSet(&set);
+            }
+        }
+        return;
+    }
+
+    for (int node = 0; ; node++){
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL){
+            break;
+        }
+        int first, last;
+        char sep;
+        CPU_ZERO(&set);
+        while (fscanf(f, "%d", &first) == 1){
+            last = first;
+            if (fscanf(f, "%c", &sep) == 1 && sep == '-'){
+                if (fscanf(f, "%d", &last) != 1 || fscanf(f, "%c", &sep) != 1){
+                    sep = '\n';
+                }
+            }
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+                if (CPU_ISSET(cpu, &allowed)){
+                    CPU_SET(cpu, &set);
+                }
+            }
+            if (sep != ','){
+                break;
+            }
+        }
+        fclose(f);
+        addPinSet(&set);
+    }
+    // no NUMA information: one node
+    if (numPinSets == 0){
+        addPinSet(&allowed);
+    }
+}
+
+//+
+// Function: pinAttr
+//
+// Purpose:  Set up the attributes for thread number n (counting
+//           producers then consumers), so that it starts pinned.
+//-
+
+void pinAttr(pthread_attr_t *attr, int n){
+    pthread_attr_init(attr);
+    if (numPinSets > 0){
+        pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &pinSets[n % numPinSets]);
+    }
+}
+//*********End Thread Placement*************
 
 //+
 // Function: producer
@@ -55,59 +1836,73 @@ int buffer[numSlots];
 
 void * producer(void * parm){
     struct threadParm *prodParm = (struct threadParm *) parm;
-    const unsigned int linelen= 1024; 
-    char line[linelen];
-    int lineNo = 0;
-    int value = 0;
+    struct inputFile in;
+    long numRead = 0;
+    int numValues;
 
-    printf("Enter producer %d\n",prodParm->threadNum);
-
-    FILE * inFile = fopen(prodParm->fileName,"r");
-    if (inFile == NULL){
-        perror(prodParm->fileName);
-        printf("Exit because producer %d can't open file\n",prodParm->threadNum);
+    // the batch buffers are on the heap, as -b has no upper bound
+    int *values = malloc(batchSize * sizeof(int));
+    int *lines = malloc(batchSize * sizeof(int));
+    struct record *recs = malloc(batchSize * sizeof(struct record));
+    if (values == NULL || lines == NULL || recs == NULL){
+        perror("malloc");
         exit(1);
     }
 
-    while(fgets(line, linelen, inFile)){
-        lineNo++;
-        value = atoi(line);
+    // spread the producers over the consumers' shards
+    homeShard = prodParm->threadNum % (numShards > 0 ? numShards : 1);
+    logMessage(LOG_SUMMARY, "Enter producer %d",prodParm->threadNum);
 
-        // Lock before accessing shared variables
-        pthread_mutex_lock(&mutex);
+    if (inputOpen(&in, prodParm->fileName) != 0){
+        perror(prodParm->fileName);
+        fprintf(stderr, "Exit because producer %d can't open file\n",prodParm->threadNum);
+        exit(1);
+    }
 
-        // Wait if the buffer is full
-        while (numElements == numSlots) {
-            pthread_cond_wait(&full, &mutex);  // Wait until space becomes available
+    // read a batch of values at a time
+    while((numValues = inputValues(&in, values, lines, batchSize)) > 0){
+        uint32_t sent = statsFormat != STATS_OFF ? statsNow() : 0;
+        for (int i = 0; i < numValues; i++){
+            recs[i].value = values[i];
+            recs[i].producer = prodParm->threadNum;
+            recs[i].seq = numRead + i;
+            recs[i].sent = sent;
         }
-
-        // Add value to the buffer
-        printf("Producer thread %d adding %d: %d at position %d\n", prodParm -> threadNum, lineNo, value, head);
-        buffer[head] = value;
-        head = (head + 1) % numSlots;
-        numElements++;
-
-        // Signal the consumer that the buffer is not empty
-        pthread_cond_signal(&empty);
-
-        // Unlock after modifying shared variables
-        pthread_mutex_unlock(&mutex);
+        // Add them to the buffer, as many at a time as fit
+        for (int done = 0; done < numValues; ){
+            int position;
+            int count = numValues - done;
+            if (orderedOutput){
+                count = streamRoom(prodParm->threadNum, numRead + done, count);
+            }
+            count = queuePut(recs + done, count, &position);
+            for (int i = 0; i < count; i++){
+                logRecord("Producer thread %d adding %d: %d at position %d\n", prodParm -> threadNum, lines[done + i], values[done + i], (position + i) % numSlots);
+            }
+            done += count;
+        }
+        numRead += numValues;
     }
 
-    // Lock before decrementing numProdRunning
+    // Lock before decrementing numProdRunning, so a consumer of the
+    // mutex buffer can't miss the broadcast
     pthread_mutex_lock(&mutex);
     numProdRunning--;
 
     // Broadcast signal if last producer
     if (numProdRunning == 0) {
         pthread_cond_broadcast(&empty);
+        waitWake(&valuesAdded);
     }
 
     // Unlock after decrementing numProdRunning
     pthread_mutex_unlock(&mutex);
 
-    fclose(inFile);
-    printf("Exit producer %d\n",prodParm->threadNum);
+    inputClose(&in);
+    free(values);
+    free(lines);
+    free(recs);
+    logMessage(LOG_SUMMARY, "Exit producer %d after %ld values",prodParm->threadNum, numRead);
     return NULL;
 }
 
@@ -122,53 +1917,55 @@ void * producer(void * parm){
 void * consumer(void * parm){
     struct threadParm *consParm = (struct threadParm *) parm;
     int lineNo = 0;
-    int value = 0;
+    int count;
     int location;
+    struct outputFile out;
+
+    struct record *recs = malloc(batchSize * sizeof(struct record));
+    if (recs == NULL){
+        perror("malloc");
+        exit(1);
+    }
 
-    printf("Enter consumer %d\n",consParm->threadNum);
+    if (queueKind == QUEUE_SHARDED){
+        // made here so that its memory is local to this thread
+        homeShard = consParm->threadNum;
+        ringInit(&shards[homeShard], numSlots);
+        pthread_barrier_wait(&shardsReady);
+    }
+    logMessage(LOG_SUMMARY, "Enter consumer %d",consParm->threadNum);
 
-    FILE * outFile = fopen(consParm->fileName,"w");
-    if (outFile == NULL){
+    // with ordered output the files are the producers' streams
+    if (!orderedOutput && outputOpen(&out, consParm->fileName) != 0){
         perror(consParm->fileName);
-        printf("Exiting because consumer %d can't open file\n",consParm->threadNum);
+        fprintf(stderr, "Exiting because consumer %d can't open file\n",consParm->threadNum);
         exit(1);
     }
 
-    while(1){
-        pthread_mutex_lock(&mutex);
-
-        // Wait if the buffer is empty and there are producers
-        while (numElements == 0 && numProdRunning > 0) {
-            pthread_cond_wait(&empty, &mutex);  // Wait until the buffer has data
+    // Read values until the buffer is empty and no producers are running
+    while((count = queueGet(recs, batchSize, &location)) > 0){
+        if (statsFormat != STATS_OFF){
+            statsRecord(consParm->threadNum, recs, count);
         }
-
-        // If the buffer is empty and no producers are running, exit
-        if (numElements == 0 && numProdRunning == 0) {
-            pthread_mutex_unlock(&mutex);
-            break;
+        for (int i = 0; i < count; i++){
+            logRecord("Consumer thread %d pulled %d: %d from position %d\n", consParm -> threadNum, lineNo, recs[i].value, (location + i) % numSlots);
+            lineNo++;
+            if (orderedOutput){
+                streamPut(&recs[i]);
+            }
+        }
+        // Write the values to the file
+        if (!orderedOutput){
+            outputValues(&out, recs, count);
         }
-
-        // Read value from the buffer
-        value = buffer[tail];
-        location = tail;
-        tail = (tail + 1) % numSlots;
-        numElements--;
-
-        // Signal the producer that the buffer is not full
-        pthread_cond_signal(&full);
-
-        pthread_mutex_unlock(&mutex);
-
-        // Write value to the file
-        printf("Consumer thread %d pulled %d: %d from position %d\n", consParm -> threadNum, lineNo, value, location);
-        fprintf(outFile,"%d\n", value);
-
-        lineNo++;
     }
 
     // Done.
-    fclose(outFile);
-    printf("Exiting consumer %d\n",consParm->threadNum);
+    if (!orderedOutput){
+        outputClose(&out);
+    }
+    free(recs);
+    logMessage(LOG_SUMMARY, "Exiting consumer %d after %d values",consParm->threadNum, lineNo);
     return NULL;
 }
 
@@ -178,29 +1975,154 @@ void * consumer(void * parm){
 //
 // Purpose:  This function decodes the command line and then starts up the producer
 //           and consumer threads.
+//
+//           Usage: main [-q queue] [-c capacity] [-b batch] [-v level]
+//                       [-o format] [-d] [-p pin] [-O] [-w window]
+//                       [-s stats] [-W wait] testNum numProducers
+//                       numConsumers
+//           where queue is mutex (the default), mpmc, spsc (one producer
+//           and one consumer), mpsc (one consumer) or sharded, capacity is the
+//           number of values the buffer holds (default 3, rounded up to
+//           a power of two for a ring) and batch is the most values a
+//           thread moves to or from the buffer at once (default 1).
+//           level is how much is logged: off, summary (threads starting
+//           and stopping) or record (every value, the default).
+//           format is text (the default) or binary for the output files,
+//           and -d writes them with O_DIRECT. pin is none (the default),
+//           cpu or node, to pin each thread to a CPU or NUMA node. The
+//           sharded queue gives each consumer its own ring, and
+//           consumers steal from each other when theirs is empty.
+//           -O writes each producer's values in order, to
+//           out<testNum><producer>.dat, with window slots (default
+//           16384) for reordering each producer's values.
+//           stats is off (the default), csv or json, to end with a
+//           line of throughput, latency and CPU statistics on stdout.
+//           wait is how threads wait for the buffer: cond (the
+//           default), spin, futex or event (see Waiting).
 //-
 
-int main(int argc, const char * argv[]) {
-    
-    // constants
-    const unsigned int maxProducers = 5;
-    const unsigned int maxConsumers = 5;
+int main(int argc, char * argv[]) {
     
     // thread vars
-    pthread_t prod_thread[maxProducers];
-    pthread_t cons_thread[maxConsumers];
-    struct threadParm prod_parm[maxConsumers];
-    struct threadParm cons_parm[maxProducers];
+    pthread_t *prod_thread;
+    pthread_t *cons_thread;
+    struct threadParm *prod_parm;
+    struct threadParm *cons_parm;
+    pthread_attr_t attr;
+    struct rusage startUsage, endUsage;
+    struct timespec startTime, endTime;
 
     int numProducers = 0;
     int numConsumers = 0;
+    int opt;
+    const char *progName = argv[0];
 
      // seed the random number generator
     srand48(time(NULL));
 
+    while ((opt = getopt(argc, argv, "q:c:b:v:o:dp:Ow:s:W:")) != -1){
+        switch (opt){
+        case 'W':
+            for (waitStrategy = 0; waitStrategyNames[waitStrategy] != NULL; waitStrategy++){
+                if (strcmp(optarg, waitStrategyNames[waitStrategy]) == 0){
+                    break;
+                }
+            }
+            if (waitStrategyNames[waitStrategy] == NULL){
+                fprintf(stderr, "wait must be cond, spin, futex or event, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            for (statsFormat = 0; statsFormatNames[statsFormat] != NULL; statsFormat++){
+                if (strcmp(optarg, statsFormatNames[statsFormat]) == 0){
+                    break;
+                }
+            }
+            if (statsFormatNames[statsFormat] == NULL){
+                fprintf(stderr, "statistics must be off, csv or json, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'O':
+            orderedOutput = 1;
+            break;
+        case 'w':
+            if ((reorderWindow = atoi(optarg)) <= 0){
+                fprintf(stderr, "window must be greater than 0, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            for (pinMode = 0; pinModeNames[pinMode] != NULL; pinMode++){
+                if (strcmp(optarg, pinModeNames[pinMode]) == 0){
+                    break;
+                }
+            }
+            if (pinModeNames[pinMode] == NULL){
+                fprintf(stderr, "pinning must be none, cpu or node, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            for (outputFormat = 0; outputFormatNames[outputFormat] != NULL; outputFormat++){
+                if (strcmp(optarg, outputFormatNames[outputFormat]) == 0){
+                    break;
+                }
+            }
+            if (outputFormatNames[outputFormat] == NULL){
+                fprintf(stderr, "output format must be text or binary, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            outputDirect = 1;
+            break;
+        case 'v':
+            for (logLevel = 0; logLevelNames[logLevel] != NULL; logLevel++){
+                if (strcmp(optarg, logLevelNames[logLevel]) == 0){
+                    break;
+                }
+            }
+            if (logLevelNames[logLevel] == NULL){
+                fprintf(stderr, "log level must be off, summary or record, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            if ((numSlots = atoi(optarg)) <= 0){
+                fprintf(stderr, "capacity must be greater than 0, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'b':
+            if ((batchSize = atoi(optarg)) <= 0){
+                fprintf(stderr, "batch must be greater than 0, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'q':
+            for (queueKind = 0; queueNames[queueKind] != NULL; queueKind++){
+                if (strcmp(optarg, queueNames[queueKind]) == 0){
+                    break;
+                }
+            }
+            if (queueNames[queueKind] == NULL){
+                fprintf(stderr, "queue must be mutex, mpmc, spsc, mpsc or sharded, you said %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            exit(1);
+        }
+    }
+    // the options are followed by the positional arguments
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // check that there are 4 arguments, error if otherwise
     if (argc != 4){
-        fprintf(stderr,"Usage: %s testNum numProducers numconsumers\n", argv[0]);
+        fprintf(stderr,"Usage: %s [-q queue] [-c capacity] [-b batch] [-v level] [-o format] [-d] [-p pin] [-O] [-w window] [-s stats] [-W wait] testNum numProducers numconsumers\n", progName);
         exit(1);
     }
     // convert the testNumber on the command line (argument 1) from string to number.
@@ -211,49 +2133,105 @@ int main(int argc, const char * argv[]) {
     }
     // convert the number of producers on the command line (arg 2) from string to number.
     // An invalid number will convert as zero
-    if ((numProducers = atoi(argv[2]))==0){
+    if ((numProducers = atoi(argv[2]))<=0){
         fprintf(stderr, "must be at least one producer, you said %s\n",argv[2]);
         exit(1);
     }
-    if (numProducers > maxProducers){
-        fprintf(stderr, "No more than %d Producers, you said %d\n",maxProducers, numProducers);
-        exit(1);
-    }
     // convert the number of consumers on the command line (arg 2) from string to number.
     // An invalid number will convert as zero
-    if ((numConsumers = atoi(argv[3]))==0){
+    if ((numConsumers = atoi(argv[3]))<=0){
         fprintf(stderr, "must be at least one consumer, you said %s\n", argv[3]);
         exit(1);
     }
-    if (numConsumers > maxConsumers){
-        fprintf(stderr, "No more than %d Producers, you said %d\n",maxProducers, numProducers);
+    // there is no limit but memory on the number of threads
+    prod_thread = calloc(numProducers, sizeof(pthread_t));
+    prod_parm = calloc(numProducers, sizeof(struct threadParm));
+    cons_thread = calloc(numConsumers, sizeof(pthread_t));
+    cons_parm = calloc(numConsumers, sizeof(struct threadParm));
+    if (prod_thread == NULL || prod_parm == NULL || cons_thread == NULL || cons_parm == NULL){
+        perror("threads");
         exit(1);
     }
-    printf("Test Number %d\n", testNum);
-    printf("Number of producers %d\n", numProducers);
-    printf("Number of consumers %d\n", numConsumers);
+    if ((queueKind == QUEUE_SPSC && (numProducers > 1 || numConsumers > 1))
+            || (queueKind == QUEUE_MPSC && numConsumers > 1)){
+        fprintf(stderr, "queue %s can't have %d producers and %d consumers\n",
+                queueNames[queueKind], numProducers, numConsumers);
+        exit(1);
+    }
+    logStart();
+    parseInit();
+    pinInit();
+    if (queueKind == QUEUE_SHARDED){
+        // the consumers set them up
+        numShards = numConsumers;
+        shards = aligned_alloc(CACHE_LINE, numShards * sizeof(struct ring));
+        if (shards == NULL){
+            perror("shards");
+            exit(1);
+        }
+        pthread_barrier_init(&shardsReady, NULL, numConsumers + 1);
+        numSlots = ringCapacity(numSlots);
+    } else if (queueKind != QUEUE_MUTEX){
+        ringInit(&ring, numSlots);
+        numSlots = ring.mask + 1;
+    } else if ((buffer = malloc(numSlots * sizeof(struct record))) == NULL){
+        perror("buffer");
+        exit(1);
+    }
+    logMessage(LOG_SUMMARY, "Test Number %d", testNum);
+    logMessage(LOG_SUMMARY, "Number of producers %d", numProducers);
+    logMessage(LOG_SUMMARY, "Number of consumers %d", numConsumers);
+    logMessage(LOG_SUMMARY, "Queue %s", queueNames[queueKind]);
+    logMessage(LOG_SUMMARY, "Capacity %d, batch %d", numSlots, batchSize);
+    logMessage(LOG_SUMMARY, "Pinning %s over %d sets of CPUs", pinModeNames[pinMode], numPinSets);
+    logMessage(LOG_SUMMARY, "Waiting %s", waitStrategyNames[waitStrategy]);
 
-    // start the producers
-    for (int i = 0; i < numProducers; i++){
-        // race condition. If the consumers start before the producers
-        // then they may not see running producers, so incrmeent here.
-        pthread_mutex_lock(&mutex);
-        numProdRunning++;
-        pthread_mutex_unlock(&mutex);
+    // race condition. If the consumers start before the producers
+    // then they may not see running producers, so count them all first.
+    pthread_mutex_lock(&mutex);
+    numProdRunning = numProducers;
+    pthread_mutex_unlock(&mutex);
 
-	// specify input data file and thread number
-        sprintf(prod_parm[i].fileName,"t%d%d.dat",testNum,i);
-        prod_parm[i].threadNum = i;
-        printf("Main: starting producer %d with file %s\n", i, prod_parm[i].fileName);
-        pthread_create(&prod_thread[i],NULL,producer,&prod_parm[i]);
+    if (orderedOutput){
+        streamsOpen(numProducers);
+        logMessage(LOG_SUMMARY, "Ordered output, window %d", reorderWindow);
     }
+    if (statsFormat != STATS_OFF){
+        statsInit(numConsumers);
+    }
+    getrusage(RUSAGE_SELF, &startUsage);
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
 
+    // start the consumers first, so that they have made their shards
+    // before the producers start
     for (int i = 0; i < numConsumers; i++){
 	// specify output data file and thread number
-        sprintf(cons_parm[i].fileName,"out%d%d.dat",testNum,i);
+        snprintf(cons_parm[i].fileName,sizeof(cons_parm[i].fileName),"out%d%d.dat",testNum,i);
         cons_parm[i].threadNum = i;
-        printf("Main: starting consumer %d with file %s\n", i, cons_parm[i].fileName);
-        pthread_create(&cons_thread[i],NULL,consumer,&cons_parm[i]);
+        logMessage(LOG_SUMMARY, "Main: starting consumer %d with file %s", i, cons_parm[i].fileName);
+        pinAttr(&attr, numProducers + i);
+        if (pthread_create(&cons_thread[i],&attr,consumer,&cons_parm[i]) != 0){
+            perror("consumer");
+            exit(1);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (queueKind == QUEUE_SHARDED){
+        pthread_barrier_wait(&shardsReady);
+    }
+
+    // start the producers
+    for (int i = 0; i < numProducers; i++){
+	// specify input data file and thread number
+        snprintf(prod_parm[i].fileName,sizeof(prod_parm[i].fileName),"t%d%d.dat",testNum,i);
+        prod_parm[i].threadNum = i;
+        logMessage(LOG_SUMMARY, "Main: starting producer %d with file %s", i, prod_parm[i].fileName);
+        pinAttr(&attr, i);
+        if (pthread_create(&prod_thread[i],&attr,producer,&prod_parm[i]) != 0){
+            perror("producer");
+            exit(1);
+        }
+        pthread_attr_destroy(&attr);
     }
    
     // wait for threads to complete 
@@ -263,6 +2241,17 @@ int main(int argc, const char * argv[]) {
     for (int i = 0; i < numConsumers; i++){
         pthread_join(cons_thread[i],NULL);
     }
+    if (orderedOutput){
+        streamsClose(numProducers);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    getrusage(RUSAGE_SELF, &endUsage);
+    logStop();
+    if (statsFormat != STATS_OFF){
+        statsReport(numProducers, numConsumers,
+                (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1e9,
+                &startUsage, &endUsage);
+    }
 
     return 0;
 }